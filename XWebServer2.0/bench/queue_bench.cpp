@@ -0,0 +1,121 @@
+/*
+   工作队列在多线程竞争下的基准测试：thread_safe_queue 和 mpmc_ring
+   用法：./queue_bench [每组放入的请求数，默认 2000000] [环形队列容量，默认 65536]
+   依次测量 1x1、2x2、4x4、8x8 个生产者和消费者，消费者取不到时让出处理器，
+   输出每秒完成的放入加取出次数，放入的是指针，和线程池中的请求一样
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "../thread_safe_queue/thread_safe_queue.h"
+#include "../thread_safe_queue/mpmc_ring.h"
+
+struct job
+{
+   long     id;
+};
+
+/*两种队列放入和取出的接口不同，统一成 put 和 take*/
+struct locked_queue
+{
+   thread_safe_queue<job*> queue;
+
+   explicit locked_queue(size_t) {}
+   void put(job* j) { queue.push(j); }
+   bool take(job*& j) { return queue.try_pop(j); }
+};
+
+struct ring_queue
+{
+   mpmc_ring<job*> queue;
+
+   explicit ring_queue(size_t capacity) : queue(capacity) {}
+   void put(job* j) { queue.push(j); }
+   bool take(job*& j) { return queue.try_pop(j); }
+};
+
+template<typename Q>
+static double run(int producers, int consumers, long total, size_t capacity)
+{
+   Q q(capacity);
+   std::vector<job> jobs(total);
+   std::atomic<long> taken(0);
+   std::atomic<long> checksum(0);
+   std::atomic<bool> go(false);
+   std::vector<std::thread> threads;
+
+   for (int p = 0; p < producers; ++p)
+   {
+      threads.emplace_back([&, p]
+      {
+         while ( !go.load(std::memory_order_acquire) )
+            std::this_thread::yield();
+         for (long i = p; i < total; i += producers)
+         {
+            jobs[i].id = i;
+            q.put(&jobs[i]);
+         }
+      });
+   }
+
+   for (int c = 0; c < consumers; ++c)
+   {
+      threads.emplace_back([&]
+      {
+         while ( !go.load(std::memory_order_acquire) )
+            std::this_thread::yield();
+         long sum = 0;
+         job* j = NULL;
+         while ( taken.load(std::memory_order_relaxed) < total )
+         {
+            if ( q.take(j) )
+            {
+               sum += j->id;
+               taken.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+               std::this_thread::yield();
+            }
+         }
+         checksum.fetch_add(sum);
+      });
+   }
+
+   auto start = std::chrono::steady_clock::now();
+   go.store(true, std::memory_order_release);
+   for (std::thread& t : threads)
+      t.join();
+   double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+   /*每个请求恰好取出一次*/
+   if ( checksum.load() != total * (total - 1) / 2 )
+   {
+      fprintf(stderr, "checksum mismatch\n");
+      exit(1);
+   }
+   return total * 2 / elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+   long total = argc > 1 ? atol(argv[1]) : 2000000;
+   size_t capacity = argc > 2 ? (size_t)atol(argv[2]) : 65536;
+   printf("%ld jobs per run, ring capacity %zu, %u cpus\n", total, capacity,
+          std::thread::hardware_concurrency());
+   printf("%-10s %18s %18s\n", "prod x con", "thread_safe_queue", "mpmc_ring");
+
+   const int configs[] = { 1, 2, 4, 8 };
+   for (int n : configs)
+   {
+      double locked = run<locked_queue>(n, n, total, capacity);
+      double ring = run<ring_queue>(n, n, total, capacity);
+      printf("%2d x %-5d %13.2f M/s %13.2f M/s\n", n, n, locked / 1e6, ring / 1e6);
+   }
+   return 0;
+}
@@ -0,0 +1,162 @@
+/*
+   数据库连接用尽时静态资源吞吐的基准测试
+   用法：先启动 Xserver，再运行 ./static_bench [端口，默认 1888] [静态请求的并发数，默认 16]
+         [登录请求的并发数，默认 64] [每个阶段的秒数，默认 5]
+   第一阶段只请求静态页面，第二阶段同时用大量登录请求占满数据库连接池（用户名各不相同，缓存不会命中），
+   输出两个阶段静态请求的吞吐和延迟，静态请求不占用数据库连接时两者应该接近
+   服务端用较小的 -s（比如 -s 1）更容易看出差别
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+typedef std::chrono::steady_clock bench_clock;
+
+static int g_port = 1888;
+
+/*发送一个短连接请求并读完响应，成功返回 true*/
+static bool request(const std::string& req)
+{
+   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   if ( fd < 0 )
+      return false;
+
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(g_port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if ( connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 )
+   {
+      close(fd);
+      return false;
+   }
+
+   size_t sent = 0;
+   while ( sent < req.size() )
+   {
+      ssize_t n = write(fd, req.data() + sent, req.size() - sent);
+      if ( n <= 0 )
+         break;
+      sent += n;
+   }
+
+   char buf[16384];
+   bool ok = false, first = true;
+   ssize_t n;
+   while ( (n = read(fd, buf, sizeof(buf))) > 0 )
+   {
+      if ( first )
+         ok = n > 12 && memcmp(buf + 9, "200", 3) == 0;
+      first = false;
+   }
+   close(fd);
+   return ok;
+}
+
+struct phase_result
+{
+   double            qps;
+   double            p50_ms;
+   double            p99_ms;
+   unsigned long     errors;
+};
+
+/*static_clients 个线程请求静态页面，db_clients 个线程同时发登录请求，持续 seconds 秒*/
+static phase_result run_phase(int static_clients, int db_clients, int seconds, unsigned long* logins)
+{
+   std::atomic<bool> stop(false);
+   std::atomic<unsigned long> errors(0), db_done(0);
+   std::vector<std::vector<double>> latencies(static_clients);
+   std::vector<std::thread> threads;
+
+   const std::string get = "GET /log.html HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n";
+   for (int i = 0; i < static_clients; ++i)
+   {
+      threads.emplace_back([&, i]
+      {
+         while ( !stop )
+         {
+            auto start = bench_clock::now();
+            if ( !request(get) )
+               ++errors;
+            latencies[i].push_back(
+               std::chrono::duration<double, std::milli>(bench_clock::now() - start).count());
+         }
+      });
+   }
+
+   for (int i = 0; i < db_clients; ++i)
+   {
+      threads.emplace_back([&, i]
+      {
+         for (unsigned long n = 0; !stop; ++n)
+         {
+            std::string body = "user=bench_" + std::to_string(i) + "_" + std::to_string(n) + "&password=x";
+            request("POST /2CGISQL.cgi HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n"
+                    "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+            ++db_done;
+         }
+      });
+   }
+
+   auto start = bench_clock::now();
+   std::this_thread::sleep_for(std::chrono::seconds(seconds));
+   stop = true;
+   double elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+   for (std::thread& t : threads)
+      t.join();
+
+   std::vector<double> all;
+   for (auto& l : latencies)
+      all.insert(all.end(), l.begin(), l.end());
+   std::sort(all.begin(), all.end());
+
+   phase_result res;
+   res.qps = all.size() / elapsed;
+   res.p50_ms = all.empty() ? 0 : all[all.size() / 2];
+   res.p99_ms = all.empty() ? 0 : all[all.size() * 99 / 100];
+   res.errors = errors;
+   if ( logins )
+      *logins = db_done;
+   return res;
+}
+
+int main(int argc, char* argv[])
+{
+   g_port = argc > 1 ? atoi(argv[1]) : 1888;
+   int static_clients = argc > 2 ? atoi(argv[2]) : 16;
+   int db_clients = argc > 3 ? atoi(argv[3]) : 64;
+   int seconds = argc > 4 ? atoi(argv[4]) : 5;
+
+   if ( !request("GET /log.html HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n") )
+   {
+      fprintf(stderr, "no server on port %d\n", g_port);
+      return 1;
+   }
+
+   printf("static clients %d, login clients %d, %d s per phase\n", static_clients, db_clients, seconds);
+
+   phase_result base = run_phase(static_clients, 0, seconds, NULL);
+   printf("%-22s %10.0f req/s  p50 %7.2f ms  p99 %7.2f ms  errors %lu\n",
+          "static only", base.qps, base.p50_ms, base.p99_ms, base.errors);
+
+   unsigned long logins = 0;
+   phase_result loaded = run_phase(static_clients, db_clients, seconds, &logins);
+   printf("%-22s %10.0f req/s  p50 %7.2f ms  p99 %7.2f ms  errors %lu  (%lu logins)\n",
+          "static + login load", loaded.qps, loaded.p50_ms, loaded.p99_ms, loaded.errors, logins);
+
+   printf("static throughput under DB load: %.1f%% of baseline\n",
+          base.qps > 0 ? loaded.qps * 100 / base.qps : 0.0);
+   return 0;
+}
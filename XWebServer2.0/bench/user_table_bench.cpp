@@ -0,0 +1,103 @@
+/*
+   用户表查找的基准测试：std::map、std::unordered_map 和 flat_table
+   用法：./user_table_bench [用户数量，默认 1000000]
+   依次测量插入、查找已存在的用户、查找不存在的用户，输出每次操作的平均耗时
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+
+#include "../user/flat_table.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ns(bench_clock::time_point start, size_t ops)
+{
+   return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / ops;
+}
+
+template <typename Table>
+static void run(const char* name, const std::vector<std::string>& users,
+                const std::vector<std::string>& hits, const std::vector<std::string>& misses)
+{
+   Table table;
+   size_t found = 0;
+
+   auto start = bench_clock::now();
+   for (const std::string& u : users)
+      table.emplace(u, u);
+   double insert_ns = elapsed_ns(start, users.size());
+
+   start = bench_clock::now();
+   for (const std::string& u : hits)
+      found += table.find(u) != table.end();
+   double hit_ns = elapsed_ns(start, hits.size());
+
+   start = bench_clock::now();
+   for (const std::string& u : misses)
+      found += table.find(u) != table.end();
+   double miss_ns = elapsed_ns(start, misses.size());
+
+   printf("%-20s insert %8.1f ns   hit %8.1f ns   miss %8.1f ns   (found %zu)\n",
+          name, insert_ns, hit_ns, miss_ns, found);
+}
+
+static void run_flat(const std::vector<std::string>& users,
+                     const std::vector<std::string>& hits, const std::vector<std::string>& misses)
+{
+   flat_table table;
+   std::string value;
+   size_t found = 0;
+
+   auto start = bench_clock::now();
+   for (const std::string& u : users)
+      table.insert(u, u);
+   double insert_ns = elapsed_ns(start, users.size());
+
+   start = bench_clock::now();
+   for (const std::string& u : hits)
+      found += table.find(u, value);
+   double hit_ns = elapsed_ns(start, hits.size());
+
+   start = bench_clock::now();
+   for (const std::string& u : misses)
+      found += table.find(u, value);
+   double miss_ns = elapsed_ns(start, misses.size());
+
+   printf("%-20s insert %8.1f ns   hit %8.1f ns   miss %8.1f ns   (found %zu)\n",
+          "flat_table", insert_ns, hit_ns, miss_ns, found);
+}
+
+int main(int argc, char* argv[])
+{
+   size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+   std::vector<std::string> users, hits, misses;
+   users.reserve(n);
+   char buf[64];
+   for (size_t i = 0; i < n; ++i)
+   {
+      snprintf(buf, sizeof(buf), "user_%08zu", i);
+      users.push_back(buf);
+      snprintf(buf, sizeof(buf), "user_%08zu_x", i);
+      misses.push_back(buf);
+   }
+
+   std::mt19937_64 rng(42);
+   hits = users;
+   std::shuffle(users.begin(), users.end(), rng);
+   std::shuffle(hits.begin(), hits.end(), rng);
+
+   printf("%zu users\n", n);
+   run<std::map<std::string, std::string>>("std::map", users, hits, misses);
+   run<std::unordered_map<std::string, std::string>>("std::unordered_map", users, hits, misses);
+   run_flat(users, hits, misses);
+   return 0;
+}
@@ -0,0 +1,106 @@
+/*
+   线程池空闲开销和唤醒延迟的基准测试
+   用法：./worker_pool_bench [工作线程数，默认 8] [空闲阶段秒数，默认 2]
+   1、空闲：没有请求时整个进程占用的 CPU（100% 表示一个核）
+   2、稀疏请求：每 1ms 放入一个请求，工作线程在两次请求之间已经休眠，统计从放入到开始处理的延迟
+   3、连续请求：事件循环所在的线程连续放入请求，统计吞吐
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "../pool/thread_pool.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static std::atomic<long> g_done(0);
+
+struct job
+{
+   bench_clock::time_point    queued;
+   double                     latency_us;
+
+   void process()
+   {
+      latency_us = std::chrono::duration<double, std::micro>(bench_clock::now() - queued).count();
+      g_done.fetch_add(1, std::memory_order_release);
+   }
+};
+
+static double cpu_seconds()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wait_done(long n)
+{
+   while ( g_done.load(std::memory_order_acquire) < n )
+      std::this_thread::yield();
+}
+
+int main(int argc, char* argv[])
+{
+   int threads = argc > 1 ? atoi(argv[1]) : 8;
+   int idle_seconds = argc > 2 ? atoi(argv[2]) : 2;
+
+   connection_pool conn_pool;
+   thread_pool<job>* pool = new thread_pool<job>(&conn_pool, threads);
+   printf("%d workers on %u cpus\n", threads, std::thread::hardware_concurrency());
+
+   /*空闲阶段，先等线程都启动*/
+   std::this_thread::sleep_for(std::chrono::milliseconds(200));
+   double cpu_start = cpu_seconds();
+   auto wall_start = bench_clock::now();
+   std::this_thread::sleep_for(std::chrono::seconds(idle_seconds));
+   double wall = std::chrono::duration<double>(bench_clock::now() - wall_start).count();
+   printf("%-16s cpu %7.1f%%\n", "idle", (cpu_seconds() - cpu_start) * 100 / wall);
+
+   /*稀疏请求，测唤醒延迟*/
+   const int sparse = 2000;
+   std::vector<job> jobs(sparse);
+   for (int i = 0; i < sparse; ++i)
+   {
+      jobs[i].queued = bench_clock::now();
+      pool->append(&jobs[i]);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   wait_done(sparse);
+
+   std::vector<double> lat;
+   for (const job& j : jobs)
+      lat.push_back(j.latency_us);
+   std::sort(lat.begin(), lat.end());
+   printf("%-16s p50 %7.1f us  p99 %7.1f us  max %8.1f us\n", "wakeup (1ms gap)",
+          lat[lat.size() / 2], lat[lat.size() * 99 / 100], lat.back());
+
+   /*连续请求，测吞吐*/
+   const int burst = 1000000;
+   std::vector<job> burst_jobs(burst);
+   g_done = 0;
+   auto start = bench_clock::now();
+   for (int i = 0; i < burst; ++i)
+   {
+      burst_jobs[i].queued = bench_clock::now();
+      pool->append(&burst_jobs[i]);
+   }
+   wait_done(burst);
+   double elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+   lat.clear();
+   for (const job& j : burst_jobs)
+      lat.push_back(j.latency_us);
+   std::sort(lat.begin(), lat.end());
+   printf("%-16s %9.0f req/s  p50 %7.1f us  p99 %7.1f us\n", "burst",
+          burst / elapsed, lat[lat.size() / 2], lat[lat.size() * 99 / 100]);
+
+   delete pool;
+   return 0;
+}
@@ -20,19 +20,58 @@ Config::Config()
    //优雅关闭链接，默认不使用
    OPT_LINGER = 0;
 
-   //数据库连接池数量,默认8
+   //数据库连接池的最大连接数,默认8
    sql_num = 8;
 
+   //数据库连接池的最小连接数,默认2,不够时按需新建
+   sql_min = 2;
+
+   //只读从库列表,默认为空,读写都走主库
+   replicas = "";
+
+   //用户数据的存储后端,默认mysql,可选shard:地址列表[/旧地址列表]、sqlite[:路径]、memory
+   user_store = "mysql";
+
+   //登录会话的有效期（秒）,默认1800
+   session_ttl = 1800;
+
+   //用户表快照的写入间隔（秒）,默认0,不使用快照
+   snapshot_interval = 0;
+
+   //查询结果缓存的内存预算（MB）,默认8,0表示不使用
+   query_cache_mb = 8;
+
    //线程池内的线程数量,默认8
    thread_num = 8;
 
    //关闭日志,默认不关闭
    close_log = 0;
+
+   //虚拟主机配置文件,默认不使用
+   vhost_file = "";
+
+   //反向代理路由配置文件,默认不使用
+   proxy_file = "";
+
+   //FastCGI 路由配置文件,默认不使用
+   fcgi_file = "";
+
+   //注册合并提交的时间窗口,默认1000微秒
+   reg_window = 1000;
+
+   //注册合并提交一批最多的请求数,默认64
+   reg_batch = 64;
+
+   //登录查询合并的时间窗口,默认200微秒
+   lookup_window = 200;
+
+   //每个工作线程的专属数据库连接数,默认0,都使用共享的连接池
+   sql_local = 0;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
    int opt;
-   const char *str = "p:l:m:o:s:t:c:";
+   const char *str = "p:l:m:o:s:t:c:v:x:f:w:b:a:n:u:e:k:q:r:g:";
    while ((opt = getopt(argc, argv, str)) != -1)
    {
       switch (opt)
@@ -72,6 +111,71 @@ void Config::parse_arg(int argc, char*argv[]){
             close_log = atoi(optarg);
             break;
          }
+         case 'v':
+         {
+            vhost_file = optarg;
+            break;
+         }
+         case 'x':
+         {
+            proxy_file = optarg;
+            break;
+         }
+         case 'f':
+         {
+            fcgi_file = optarg;
+            break;
+         }
+         case 'w':
+         {
+            reg_window = atoi(optarg);
+            break;
+         }
+         case 'b':
+         {
+            reg_batch = atoi(optarg);
+            break;
+         }
+         case 'a':
+         {
+            sql_local = atoi(optarg);
+            break;
+         }
+         case 'n':
+         {
+            sql_min = atoi(optarg);
+            break;
+         }
+         case 'u':
+         {
+            user_store = optarg;
+            break;
+         }
+         case 'e':
+         {
+            session_ttl = atoi(optarg);
+            break;
+         }
+         case 'k':
+         {
+            snapshot_interval = atoi(optarg);
+            break;
+         }
+         case 'q':
+         {
+            query_cache_mb = atoi(optarg);
+            break;
+         }
+         case 'r':
+         {
+            replicas = optarg;
+            break;
+         }
+         case 'g':
+         {
+            lookup_window = atoi(optarg);
+            break;
+         }
          default:
             break;
       }
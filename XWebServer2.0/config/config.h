@@ -29,15 +29,54 @@ public:
    //优雅关闭链接
    int OPT_LINGER;
 
-   //数据库连接池数量
+   //数据库连接池的最大连接数
    int sql_num;
 
+   //数据库连接池的最小连接数
+   int sql_min;
+
+   //只读从库列表，逗号分隔的 主机:端口
+   std::string replicas;
+
+   //用户数据的存储后端
+   std::string user_store;
+
+   //登录会话的有效期（秒）
+   int session_ttl;
+
+   //用户表快照的写入间隔（秒），0 表示不使用快照
+   int snapshot_interval;
+
+   //查询结果缓存的内存预算（MB），0 表示不使用
+   int query_cache_mb;
+
    //线程池内的线程数量
    int thread_num;
 
    //是否关闭日志
    int close_log;
 
+   //虚拟主机配置文件
+   std::string vhost_file;
+
+   //反向代理路由配置文件
+   std::string proxy_file;
+
+   //FastCGI 路由配置文件
+   std::string fcgi_file;
+
+   //注册合并提交的时间窗口（微秒），0 表示不合并
+   int reg_window;
+
+   //注册合并提交时一批最多的请求数
+   int reg_batch;
+
+   //登录查询合并的时间窗口（微秒），0 表示不合并
+   int lookup_window;
+
+   //每个工作线程的专属数据库连接数
+   int sql_local;
+
 };
 
 #endif
@@ -0,0 +1,831 @@
+#include "fastcgi.h"
+#include "../http/response.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
+static const int FCGI_VERSION_1     = 1;
+static const int FCGI_RESPONDER     = 1;
+static const int FCGI_KEEP_CONN     = 1;
+static const int FCGI_HEADER_LEN    = 8;
+static const int FCGI_MAX_CONTENT   = 65535;
+
+fastcgi_client::fastcgi_client() : m_eventfd(-1), m_epollfd(-1), m_close_log(0)
+{
+
+}
+
+fastcgi_client::~fastcgi_client()
+{
+   if ( m_eventfd != -1 )
+   {
+      close(m_eventfd);
+   }
+}
+
+fastcgi_client* fastcgi_client::get_instance()
+{
+   static fastcgi_client client;
+   return &client;
+}
+
+bool fastcgi_client::load(const char* file_name)
+{
+   FILE* fp = fopen(file_name, "r");
+   if ( fp == NULL )
+      return false;
+
+   char line[1024];
+   while ( fgets(line, sizeof(line), fp) )
+   {
+      char prefix[256], addr[256], root[512];
+      int max_conns = MAX_CONNS;
+
+      if ( line[0] == '#' )
+         continue;
+      if ( sscanf(line, "%255s %255s %511s %d", prefix, addr, root, &max_conns) < 3 || prefix[0] != '/' )
+         continue;
+
+      fcgi_route route;
+      route.prefix = prefix;
+      route.script_root = root;
+      route.name = addr;
+      route.max_conns = max_conns > 0 ? max_conns : MAX_CONNS;
+      bzero(&route.addr, sizeof(route.addr));
+
+      /*unix:/路径 或者 IP:端口*/
+      if ( strncmp(addr, "unix:", 5) == 0 )
+      {
+         sockaddr_un* un = (sockaddr_un*)&route.addr;
+         un->sun_family = AF_UNIX;
+         strncpy(un->sun_path, addr + 5, sizeof(un->sun_path) - 1);
+         route.addr_len = sizeof(sockaddr_un);
+      }
+      else
+      {
+         char* colon = strrchr(addr, ':');
+         if ( !colon )
+            continue;
+         *colon = '\0';
+
+         sockaddr_in* in = (sockaddr_in*)&route.addr;
+         in->sin_family = AF_INET;
+         in->sin_port = htons(atoi(colon + 1));
+         if ( inet_pton(AF_INET, addr, &in->sin_addr) != 1 )
+            continue;
+         route.addr_len = sizeof(sockaddr_in);
+      }
+
+      fcgi_conn conn;
+      conn.fd = -1;
+      conn.connecting = false;
+      conn.mpx = false;
+      conn.probed = false;
+      conn.out_off = 0;
+      conn.next_id = 1;
+      route.conns.assign(route.max_conns, conn);
+
+      m_routes.push_back(route);
+   }
+   fclose(fp);
+
+   /*前缀长的优先匹配*/
+   std::stable_sort(m_routes.begin(), m_routes.end(),
+                    [](const fcgi_route& a, const fcgi_route& b)
+                    { return a.prefix.size() > b.prefix.size(); });
+   return true;
+}
+
+int fastcgi_client::init(int epollfd, int close_log)
+{
+   m_epollfd = epollfd;
+   m_close_log = close_log;
+   m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   return m_eventfd;
+}
+
+int fastcgi_client::match(const char* url) const
+{
+   for (size_t i = 0; i < m_routes.size(); ++i)
+   {
+      if ( strncmp(url, m_routes[i].prefix.c_str(), m_routes[i].prefix.size()) == 0 )
+         return i;
+   }
+   return -1;
+}
+
+void fastcgi_client::submit(int client_fd, int route, bool keep_alive,
+                            param_list params, std::string body)
+{
+   fcgi_request* req = new fcgi_request;
+   req->client_fd = client_fd;
+   req->route = route;
+   req->conn = -1;
+   req->id = 0;
+   req->keep_alive = keep_alive;
+   req->deadline = time(NULL) + FCGI_TIMEOUT;
+   req->params = std::move(params);
+   req->body = std::move(body);
+   req->out_off = 0;
+   req->replied = false;
+   m_jobs.push(req);
+
+   uint64_t one = 1;
+   ::write(m_eventfd, &one, sizeof(one));
+}
+
+void fastcgi_client::watch(int fd, uint32_t events, bool add)
+{
+   epoll_event event;
+   event.data.fd = fd;
+   event.events = events;
+   epoll_ctl(m_epollfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+}
+
+void fastcgi_client::dispatch(proxy_result& res)
+{
+   uint64_t cnt = 0;
+   ::read(m_eventfd, &cnt, sizeof(cnt));
+
+   fcgi_request* req = NULL;
+   while ( m_jobs.try_pop(req) )
+   {
+      fd_owner owner = { OWNER_CLIENT, req->route, -1, req };
+      m_owners[req->client_fd] = owner;
+      res.started.push_back(req->client_fd);
+
+      /*客户端连接此时处于 EPOLLONESHOT 失效状态，重新注册为只关注错误*/
+      watch(req->client_fd, 0, false);
+      assign(req, res);
+   }
+}
+
+/*
+   多路复用的连接可以同时跑多个请求，不支持（或者还不知道是否支持）的连接一次只跑一个
+   优先放到已经建立的、请求最少的连接上，都满了再新建连接，连接数到上限就排队
+*/
+void fastcgi_client::assign(fcgi_request* req, proxy_result& res)
+{
+   fcgi_route& route = m_routes[req->route];
+
+   int best = -1, spare = -1;
+   for (int i = 0; i < (int)route.conns.size(); ++i)
+   {
+      fcgi_conn& conn = route.conns[i];
+      if ( conn.fd == -1 )
+      {
+         if ( spare == -1 )
+            spare = i;
+         continue;
+      }
+
+      int capacity = (conn.probed && conn.mpx) ? MAX_MPX_REQUESTS : 1;
+      if ( (int)conn.requests.size() < capacity &&
+           (best == -1 || conn.requests.size() < route.conns[best].requests.size()) )
+         best = i;
+   }
+
+   if ( best == -1 && spare != -1 )
+   {
+      if ( !open_conn(req->route, spare) )
+      {
+         LOG_ERROR("fastcgi connect %s failed", route.name.c_str());
+         reply_error(req, 502, res);
+         return;
+      }
+      best = spare;
+   }
+
+   if ( best == -1 )
+   {
+      route.waiting.push_back(req);
+      return;
+   }
+
+   fcgi_conn& conn = route.conns[best];
+   do
+   {
+      req->id = conn.next_id;
+      conn.next_id = (conn.next_id % 65535) + 1;
+   } while ( conn.requests.count(req->id) );
+
+   req->conn = best;
+   conn.requests[req->id] = req;
+   encode_request(conn, req);
+
+   if ( !conn.connecting )
+   {
+      if ( !flush_backend(conn) )
+      {
+         close_conn(req->route, best, res);
+         return;
+      }
+      watch(conn.fd, conn.out.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT), false);
+   }
+}
+
+bool fastcgi_client::open_conn(int r, int c)
+{
+   fcgi_route& route = m_routes[r];
+   fcgi_conn& conn = route.conns[c];
+
+   int fd = socket(route.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if ( fd < 0 )
+      return false;
+
+   conn.connecting = false;
+   if ( connect(fd, (struct sockaddr*)&route.addr, route.addr_len) < 0 )
+   {
+      if ( errno != EINPROGRESS )
+      {
+         close(fd);
+         return false;
+      }
+      conn.connecting = true;
+   }
+
+   conn.fd = fd;
+   conn.mpx = false;
+   conn.probed = false;
+   conn.out.clear();
+   conn.out_off = 0;
+   conn.in.clear();
+
+   /*询问应用服务器是否支持多路复用*/
+   std::string values;
+   append_pair(values, "FCGI_MPXS_CONNS", "");
+   append_record(conn.out, FCGI_GET_VALUES, 0, values.data(), values.size());
+
+   fd_owner owner = { OWNER_BACKEND, r, c, NULL };
+   m_owners[fd] = owner;
+   watch(fd, EPOLLIN | EPOLLOUT, true);
+   return true;
+}
+
+/*连接断开，上面还没有结束的请求全部返回 502*/
+void fastcgi_client::close_conn(int r, int c, proxy_result& res)
+{
+   fcgi_conn& conn = m_routes[r].conns[c];
+   if ( conn.fd == -1 )
+      return;
+
+   LOG_INFO("fastcgi connection to %s closed", m_routes[r].name.c_str());
+
+   epoll_ctl(m_epollfd, EPOLL_CTL_DEL, conn.fd, 0);
+   m_owners.erase(conn.fd);
+   close(conn.fd);
+   conn.fd = -1;
+   conn.connecting = false;
+   conn.out.clear();
+   conn.out_off = 0;
+   conn.in.clear();
+
+   std::unordered_map<int, fcgi_request*> requests;
+   requests.swap(conn.requests);
+   for (auto& it : requests)
+   {
+      fcgi_request* req = it.second;
+      req->conn = -1;
+      if ( req->client_fd == -1 )
+         delete req;
+      else
+         reply_error(req, 502, res);
+   }
+
+   drain(r, res);
+}
+
+void fastcgi_client::drain(int r, proxy_result& res)
+{
+   std::deque<fcgi_request*> waiting;
+   waiting.swap(m_routes[r].waiting);
+   while ( !waiting.empty() )
+   {
+      fcgi_request* req = waiting.front();
+      waiting.pop_front();
+      assign(req, res);
+   }
+}
+
+/*记录头 8 字节，内容按 8 字节对齐补齐*/
+void fastcgi_client::append_record(std::string& out, int type, int id, const char* data, size_t len)
+{
+   unsigned char padding = (8 - (len % 8)) % 8;
+   unsigned char header[FCGI_HEADER_LEN] =
+   {
+      (unsigned char)FCGI_VERSION_1, (unsigned char)type,
+      (unsigned char)((id >> 8) & 0xff), (unsigned char)(id & 0xff),
+      (unsigned char)((len >> 8) & 0xff), (unsigned char)(len & 0xff),
+      padding, 0
+   };
+   out.append((const char*)header, FCGI_HEADER_LEN);
+   out.append(data, len);
+   out.append(padding, '\0');
+}
+
+/*名字和值的长度小于 128 用 1 字节，否则用 4 字节并置最高位*/
+void fastcgi_client::append_pair(std::string& out, const std::string& name, const std::string& value)
+{
+   const std::string* parts[2] = { &name, &value };
+   for (const std::string* part : parts)
+   {
+      size_t len = part->size();
+      if ( len < 128 )
+      {
+         out += (char)len;
+      }
+      else
+      {
+         out += (char)(((len >> 24) & 0x7f) | 0x80);
+         out += (char)((len >> 16) & 0xff);
+         out += (char)((len >> 8) & 0xff);
+         out += (char)(len & 0xff);
+      }
+   }
+   out += name;
+   out += value;
+}
+
+void fastcgi_client::encode_request(fcgi_conn& conn, fcgi_request* req)
+{
+   const unsigned char begin[8] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+   append_record(conn.out, FCGI_BEGIN_REQUEST, req->id, (const char*)begin, sizeof(begin));
+
+   std::string params;
+   for (auto& it : req->params)
+   {
+      append_pair(params, it.first, it.second);
+   }
+   for (size_t off = 0; off < params.size(); off += FCGI_MAX_CONTENT)
+   {
+      append_record(conn.out, FCGI_PARAMS, req->id, params.data() + off,
+                    std::min(params.size() - off, (size_t)FCGI_MAX_CONTENT));
+   }
+   append_record(conn.out, FCGI_PARAMS, req->id, NULL, 0);
+
+   for (size_t off = 0; off < req->body.size(); off += FCGI_MAX_CONTENT)
+   {
+      append_record(conn.out, FCGI_STDIN, req->id, req->body.data() + off,
+                    std::min(req->body.size() - off, (size_t)FCGI_MAX_CONTENT));
+   }
+   append_record(conn.out, FCGI_STDIN, req->id, NULL, 0);
+
+   /*参数已经编码，释放内存*/
+   param_list().swap(req->params);
+   std::string().swap(req->body);
+}
+
+bool fastcgi_client::flush_backend(fcgi_conn& conn)
+{
+   while ( conn.out_off < conn.out.size() )
+   {
+      int ret = send(conn.fd, conn.out.data() + conn.out_off, conn.out.size() - conn.out_off, MSG_NOSIGNAL);
+      if ( ret < 0 )
+      {
+         if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            return true;
+         return false;
+      }
+      conn.out_off += ret;
+   }
+   conn.out.clear();
+   conn.out_off = 0;
+   return true;
+}
+
+void fastcgi_client::handle_event(int fd, uint32_t events, proxy_result& res)
+{
+   auto it = m_owners.find(fd);
+   if ( it == m_owners.end() )
+      return;
+
+   fd_owner owner = it->second;
+   if ( owner.type == OWNER_BACKEND )
+      on_backend(owner.route, owner.conn, events, res);
+   else
+      on_client(owner.request, events, res);
+}
+
+void fastcgi_client::on_backend(int r, int c, uint32_t events, proxy_result& res)
+{
+   fcgi_conn& conn = m_routes[r].conns[c];
+
+   if ( conn.connecting )
+   {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if ( err != 0 )
+      {
+         LOG_ERROR("fastcgi connect %s failed: %d", m_routes[r].name.c_str(), err);
+         close_conn(r, c, res);
+         return;
+      }
+      conn.connecting = false;
+   }
+
+   if ( !flush_backend(conn) )
+   {
+      close_conn(r, c, res);
+      return;
+   }
+
+   if ( events & (EPOLLIN | EPOLLHUP | EPOLLERR) )
+   {
+      bool closed = false;
+      char buf[16384];
+      while ( true )
+      {
+         int ret = recv(conn.fd, buf, sizeof(buf), 0);
+         if ( ret > 0 )
+         {
+            conn.in.append(buf, ret);
+            continue;
+         }
+         if ( ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+            break;
+         closed = true;
+         break;
+      }
+
+      parse_records(r, c, res);
+      if ( closed )
+      {
+         close_conn(r, c, res);
+         return;
+      }
+   }
+
+   if ( conn.fd != -1 )
+      watch(conn.fd, conn.out.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT), false);
+}
+
+void fastcgi_client::parse_records(int r, int c, proxy_result& res)
+{
+   fcgi_conn& conn = m_routes[r].conns[c];
+   size_t off = 0;
+   bool freed = false;
+
+   while ( conn.in.size() - off >= (size_t)FCGI_HEADER_LEN )
+   {
+      const unsigned char* h = (const unsigned char*)conn.in.data() + off;
+      int    type = h[1];
+      int    id = (h[2] << 8) | h[3];
+      size_t len = (h[4] << 8) | h[5];
+      size_t total = FCGI_HEADER_LEN + len + h[6];
+      if ( conn.in.size() - off < total )
+         break;
+
+      const char* content = conn.in.data() + off + FCGI_HEADER_LEN;
+      off += total;
+
+      switch ( type )
+      {
+         case FCGI_STDOUT:
+         {
+            auto it = conn.requests.find(id);
+            if ( it == conn.requests.end() || it->second->client_fd == -1 )
+               break;
+            fcgi_request* req = it->second;
+            if ( req->stdout_buf.size() + len <= (size_t)MAX_RESPONSE_SIZE )
+            {
+               req->stdout_buf.append(content, len);
+               break;
+            }
+            //输出超过上限，不能发送截断的响应，放弃这个请求并返回 502
+            LOG_ERROR("fastcgi %s response exceeds %d bytes", m_routes[r].name.c_str(), (int)MAX_RESPONSE_SIZE);
+            std::string().swap(req->stdout_buf);
+            reply_error(req, 502, res);
+            break;
+         }
+         case FCGI_STDERR:
+         {
+            if ( len > 0 )
+            {
+               std::string msg(content, len);
+               LOG_ERROR("fastcgi %s stderr: %s", m_routes[r].name.c_str(), msg.c_str());
+            }
+            break;
+         }
+         case FCGI_END_REQUEST:
+         {
+            auto it = conn.requests.find(id);
+            if ( it == conn.requests.end() )
+               break;
+            fcgi_request* req = it->second;
+            conn.requests.erase(it);
+            req->conn = -1;
+            freed = true;
+            complete(req, res);
+            break;
+         }
+         case FCGI_GET_VALUES_RESULT:
+         {
+            parse_values(conn, content, len);
+            freed = true;
+            break;
+         }
+         default:
+            break;
+      }
+   }
+
+   conn.in.erase(0, off);
+
+   /*有请求结束或者得知支持多路复用，排队的请求可以继续*/
+   if ( freed && !m_routes[r].waiting.empty() )
+      drain(r, res);
+}
+
+void fastcgi_client::parse_values(fcgi_conn& conn, const char* data, size_t len)
+{
+   const unsigned char* p = (const unsigned char*)data;
+   const unsigned char* end = p + len;
+
+   conn.probed = true;
+   while ( p < end )
+   {
+      size_t lens[2];
+      for (int i = 0; i < 2; ++i)
+      {
+         if ( p >= end )
+            return;
+         if ( *p & 0x80 )
+         {
+            if ( end - p < 4 )
+               return;
+            lens[i] = ((p[0] & 0x7f) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            p += 4;
+         }
+         else
+         {
+            lens[i] = *p++;
+         }
+      }
+      if ( (size_t)(end - p) < lens[0] + lens[1] )
+         return;
+
+      std::string name((const char*)p, lens[0]);
+      std::string value((const char*)p + lens[0], lens[1]);
+      p += lens[0] + lens[1];
+
+      if ( name == "FCGI_MPXS_CONNS" )
+         conn.mpx = (value == "1");
+   }
+}
+
+/*
+   CGI 输出由若干头部、空行和响应体组成，Status 头决定状态码
+   转换成带 Content-Length 的 HTTP 响应，这样客户端连接可以保持
+*/
+void fastcgi_client::complete(fcgi_request* req, proxy_result& res)
+{
+   if ( req->client_fd == -1 )
+   {
+      delete req;
+      return;
+   }
+
+   const std::string& data = req->stdout_buf;
+   size_t head_end = data.find("\r\n\r\n");
+   size_t body_off = head_end + 4;
+   if ( head_end == std::string::npos )
+   {
+      head_end = data.find("\n\n");
+      body_off = head_end + 2;
+   }
+   if ( head_end == std::string::npos )
+   {
+      reply_error(req, 502, res);
+      return;
+   }
+
+   std::string status = "200 OK";
+   std::string headers;
+   bool has_location = false, has_status = false;
+
+   size_t pos = 0;
+   while ( pos < head_end )
+   {
+      size_t eol = data.find('\n', pos);
+      if ( eol == std::string::npos || eol > head_end )
+         eol = head_end;
+      size_t len = eol - pos;
+      if ( len > 0 && data[pos + len - 1] == '\r' )
+         --len;
+
+      std::string line = data.substr(pos, len);
+      pos = eol + 1;
+      if ( line.empty() )
+         continue;
+
+      if ( strncasecmp(line.c_str(), "Status:", 7) == 0 )
+      {
+         size_t v = line.find_first_not_of(" \t", 7);
+         if ( v != std::string::npos )
+         {
+            status = line.substr(v);
+            has_status = true;
+         }
+         continue;
+      }
+      if ( strncasecmp(line.c_str(), "Content-Length:", 15) == 0 ||
+           strncasecmp(line.c_str(), "Connection:", 11) == 0 )
+         continue;
+      if ( strncasecmp(line.c_str(), "Location:", 9) == 0 )
+         has_location = true;
+
+      headers += line;
+      headers += "\r\n";
+   }
+   if ( has_location && !has_status )
+      status = "302 Found";
+
+   size_t body_len = data.size() - body_off;
+   char num[20];
+
+   req->out.reserve(status.size() + headers.size() + body_len + 128);
+   req->out = "HTTP/1.1 ";
+   req->out += status;
+   req->out += "\r\n";
+   req->out += headers;
+   req->out += "Content-Length:";
+   req->out.append(num, format_uint(num, body_len));
+   req->out += req->keep_alive ? "\r\nConnection:keep-alive\r\n" : "\r\nConnection:close\r\n";
+   req->out.append(http_date::get(), http_date::DATE_LEN);
+   req->out += "\r\n";
+   req->out.append(data, body_off, body_len);
+   std::string().swap(req->stdout_buf);
+
+   req->replied = true;
+   req->out_off = 0;
+   flush_client(req, res);
+}
+
+/*
+   还没有结束的请求提前返回错误页面
+   如果请求还在应用服务器上，就发送 FCGI_ABORT_REQUEST，原请求留着等 FCGI_END_REQUEST，
+   另外新建一个请求对象负责给客户端写响应
+*/
+void fastcgi_client::reply_error(fcgi_request* req, int status, proxy_result& res)
+{
+   fcgi_request* reply = req;
+
+   if ( req->conn != -1 )
+   {
+      reply = new fcgi_request;
+      reply->client_fd = req->client_fd;
+      reply->route = req->route;
+      reply->conn = -1;
+      reply->id = 0;
+      abort_request(req);
+
+      fd_owner owner = { OWNER_CLIENT, reply->route, -1, reply };
+      m_owners[reply->client_fd] = owner;
+   }
+   else
+   {
+      std::deque<fcgi_request*>& waiting = m_routes[req->route].waiting;
+      waiting.erase(std::remove(waiting.begin(), waiting.end(), req), waiting.end());
+   }
+
+   const status_block* block = find_status_block(status);
+   const char* body = (status == 504) ? "application timed out\n" : "application unavailable\n";
+   char num[20];
+
+   reply->keep_alive = false;
+   reply->replied = true;
+   reply->deadline = time(NULL) + FCGI_TIMEOUT;
+   reply->out.assign(block->close, block->close_len);
+   reply->out += "Content-Length:";
+   reply->out.append(num, format_uint(num, strlen(body)));
+   reply->out += "\r\n";
+   reply->out.append(http_date::get(), http_date::DATE_LEN);
+   reply->out += "\r\n";
+   reply->out += body;
+   reply->out_off = 0;
+   flush_client(reply, res);
+}
+
+/*
+   应用应该很快回复 FCGI_END_REQUEST，不回复的话请求一直占着连接（不支持多路复用时就是整个连接），
+   所以只等 ABORT_TIMEOUT，之后由 tick 关闭连接
+*/
+void fastcgi_client::abort_request(fcgi_request* req)
+{
+   fcgi_conn& conn = m_routes[req->route].conns[req->conn];
+   append_record(conn.out, FCGI_ABORT_REQUEST, req->id, NULL, 0);
+   if ( !conn.connecting && flush_backend(conn) )
+      watch(conn.fd, conn.out.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT), false);
+
+   req->client_fd = -1;
+   req->deadline = time(NULL) + ABORT_TIMEOUT;
+}
+
+void fastcgi_client::flush_client(fcgi_request* req, proxy_result& res)
+{
+   while ( req->out_off < req->out.size() )
+   {
+      int ret = send(req->client_fd, req->out.data() + req->out_off,
+                     req->out.size() - req->out_off, MSG_NOSIGNAL);
+      if ( ret < 0 )
+      {
+         if ( errno == EAGAIN || errno == EWOULDBLOCK )
+         {
+            watch(req->client_fd, EPOLLOUT, false);
+            return;
+         }
+         finish(req, false, res);
+         return;
+      }
+      req->out_off += ret;
+   }
+   finish(req, true, res);
+}
+
+void fastcgi_client::finish(fcgi_request* req, bool ok, proxy_result& res)
+{
+   m_owners.erase(req->client_fd);
+   if ( ok && req->keep_alive )
+      res.keep_alive.push_back(req->client_fd);
+   else
+      res.closed.push_back(req->client_fd);
+   delete req;
+}
+
+void fastcgi_client::on_client(fcgi_request* req, uint32_t events, proxy_result& res)
+{
+   if ( events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP) )
+   {
+      /*客户端断开，请求如果还在应用服务器上，通知应用放弃*/
+      if ( !req->replied && req->conn != -1 )
+      {
+         m_owners.erase(req->client_fd);
+         res.closed.push_back(req->client_fd);
+         abort_request(req);
+         return;
+      }
+
+      if ( !req->replied )
+      {
+         std::deque<fcgi_request*>& waiting = m_routes[req->route].waiting;
+         waiting.erase(std::remove(waiting.begin(), waiting.end(), req), waiting.end());
+      }
+      finish(req, false, res);
+      return;
+   }
+
+   if ( (events & EPOLLOUT) && req->replied )
+   {
+      watch(req->client_fd, 0, false);
+      flush_client(req, res);
+   }
+}
+
+void fastcgi_client::tick(proxy_result& res)
+{
+   time_t cur = time(NULL);
+
+   std::vector<fcgi_request*> expired;
+   for (auto& it : m_owners)
+   {
+      if ( it.second.type == OWNER_CLIENT && it.second.request->deadline <= cur )
+         expired.push_back(it.second.request);
+   }
+
+   for (fcgi_request* req : expired)
+   {
+      LOG_ERROR("fastcgi request of fd %d timed out", req->client_fd);
+      if ( req->replied )
+         finish(req, false, res);
+      else
+         reply_error(req, 504, res);
+   }
+
+   /*放弃的请求不在 m_owners 中，应用一直不结束它时关闭连接，连接上其它的请求返回 502*/
+   for (int r = 0; r < (int)m_routes.size(); ++r)
+   {
+      for (int c = 0; c < (int)m_routes[r].conns.size(); ++c)
+      {
+         for (auto& it : m_routes[r].conns[c].requests)
+         {
+            if ( it.second->client_fd == -1 && it.second->deadline <= cur )
+            {
+               LOG_ERROR("fastcgi %s did not end aborted request %d, close connection",
+                         m_routes[r].name.c_str(), it.first);
+               close_conn(r, c, res);
+               break;
+            }
+         }
+      }
+   }
+}
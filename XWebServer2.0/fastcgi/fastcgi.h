@@ -0,0 +1,190 @@
+/*
+   FastCGI 客户端（全局只允许一个实例）
+   1、按 URL 前缀把请求交给本地的 FastCGI 应用服务器，地址可以是 unix:/路径 或 IP:端口
+   2、和应用服务器之间保持长连接（FCGI_KEEP_CONN），连接建立后用 FCGI_GET_VALUES 询问
+      是否支持多路复用，支持的话一个连接上同时跑多个请求，用 request id 区分
+   3、工作线程只负责整理 CGI 参数，记录的编码、解析都在事件循环中以非阻塞方式完成，
+      应用服务器处理请求期间不占用线程池的线程
+   配置文件每行一个路由，# 开头为注释：
+      URL前缀  unix:/路径|IP:端口  脚本根目录  [最大连接数]
+*/
+
+#ifndef FASTCGI_H
+#define FASTCGI_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <unordered_map>
+
+#include "../thread_safe_queue/thread_safe_queue.h"
+#include "../proxy/proxy.h"
+#include "../log/log.h"
+
+class fastcgi_client
+{
+public:
+   static const int MAX_CONNS          = 4;           //每个应用服务器默认的最大连接数
+   static const int MAX_MPX_REQUESTS   = 64;          //多路复用时一个连接上最多同时处理的请求
+   static const int MAX_RESPONSE_SIZE  = 8 << 20;     //应用返回的最大字节数
+   static const int FCGI_TIMEOUT       = 30;          //单个请求的超时时间（秒）
+   static const int ABORT_TIMEOUT      = 5;           //发送 FCGI_ABORT_REQUEST 后等应用结束请求的时间（秒）
+
+   /*FastCGI 记录类型*/
+   enum RECORD_TYPE
+   {
+      FCGI_BEGIN_REQUEST      = 1,
+      FCGI_ABORT_REQUEST      = 2,
+      FCGI_END_REQUEST        = 3,
+      FCGI_PARAMS             = 4,
+      FCGI_STDIN              = 5,
+      FCGI_STDOUT             = 6,
+      FCGI_STDERR             = 7,
+      FCGI_DATA               = 8,
+      FCGI_GET_VALUES         = 9,
+      FCGI_GET_VALUES_RESULT  = 10,
+      FCGI_UNKNOWN_TYPE       = 11
+   };
+
+   typedef std::vector<std::pair<std::string, std::string>> param_list;
+
+private:
+   /*应用服务器上的一个请求*/
+   struct fcgi_request
+   {
+      int               client_fd;     //-1 表示客户端已经断开，只等待应用结束
+      int               route;
+      int               conn;
+      int               id;
+      bool              keep_alive;
+      time_t            deadline;      //client_fd 为 -1 时是等应用结束的期限，过期后关闭应用连接
+      param_list        params;
+      std::string       body;
+      std::string       stdout_buf;    //应用的输出
+      std::string       out;           //写给客户端的 HTTP 响应
+      size_t            out_off;
+      bool              replied;       //响应已经开始写给客户端
+   };
+
+   /*到应用服务器的一个连接*/
+   struct fcgi_conn
+   {
+      int               fd;
+      bool              connecting;
+      bool              mpx;           //是否支持多路复用
+      bool              probed;        //是否收到 FCGI_GET_VALUES_RESULT
+      std::string       out;           //待发送的记录
+      size_t            out_off;
+      std::string       in;            //还没有解析完的记录
+      std::unordered_map<int, fcgi_request*>
+                        requests;      //request id -> 请求
+      int               next_id;
+   };
+
+   /*路由*/
+   struct fcgi_route
+   {
+      std::string       prefix;
+      std::string       script_root;
+      sockaddr_storage  addr;
+      socklen_t         addr_len;
+      std::string       name;
+      int               max_conns;
+      std::vector<fcgi_conn>
+                        conns;
+      std::deque<fcgi_request*>
+                        waiting;       //所有连接都忙时排队
+   };
+
+   enum OWNER
+   {
+      OWNER_BACKEND = 0,               //到应用服务器的连接
+      OWNER_CLIENT                     //等待应用响应的客户端
+   };
+
+   struct fd_owner
+   {
+      OWNER             type;
+      int               route;
+      int               conn;
+      fcgi_request*     request;
+   };
+
+   std::vector<fcgi_route>    m_routes;
+   std::unordered_map<int, fd_owner>
+                              m_owners;
+   thread_safe_queue<fcgi_request*>
+                              m_jobs;
+   int                        m_eventfd;
+   int                        m_epollfd;
+   int                        m_close_log;
+
+private:
+   fastcgi_client();
+   ~fastcgi_client();
+
+   void              watch(int fd, uint32_t events, bool add);
+
+   /*把请求分配到一个连接上，没有空闲的连接就排队*/
+   void              assign(fcgi_request* req, proxy_result& res);
+   bool              open_conn(int route, int conn);
+   void              close_conn(int route, int conn, proxy_result& res);
+
+   /*编码记录*/
+   static void       append_record(std::string& out, int type, int id, const char* data, size_t len);
+   static void       append_pair(std::string& out, const std::string& name, const std::string& value);
+   void              encode_request(fcgi_conn& conn, fcgi_request* req);
+
+   void              on_backend(int route, int conn, uint32_t events, proxy_result& res);
+   void              on_client(fcgi_request* req, uint32_t events, proxy_result& res);
+   bool              flush_backend(fcgi_conn& conn);
+   void              parse_records(int route, int conn, proxy_result& res);
+   void              parse_values(fcgi_conn& conn, const char* data, size_t len);
+
+   /*应用处理结束，把 CGI 输出转成 HTTP 响应*/
+   void              complete(fcgi_request* req, proxy_result& res);
+   void              reply_error(fcgi_request* req, int status, proxy_result& res);
+
+   /*通知应用放弃还在处理的请求，请求不再属于客户端，留在连接上等 FCGI_END_REQUEST*/
+   void              abort_request(fcgi_request* req);
+   void              flush_client(fcgi_request* req, proxy_result& res);
+   void              finish(fcgi_request* req, bool ok, proxy_result& res);
+
+   /*连接空出位置后处理排队的请求*/
+   void              drain(int route, proxy_result& res);
+
+public:
+   static fastcgi_client*
+                     get_instance();
+
+   /*加载路由配置，失败返回 false*/
+   bool              load(const char* file_name);
+
+   /*创建 eventfd，返回值需要由事件循环注册到 epoll 中*/
+   int               init(int epollfd, int close_log);
+
+   /*返回匹配的路由编号，没有返回 -1*/
+   int               match(const char* url) const;
+
+   const std::string&
+                     script_root(int route) const { return m_routes[route].script_root; }
+
+   /*工作线程调用，把整理好的 CGI 参数和请求体交给事件循环*/
+   void              submit(int client_fd, int route, bool keep_alive,
+                            param_list params, std::string body);
+
+   /*以下函数只能在事件循环所在的线程调用*/
+   bool              owns(int fd) const { return m_owners.find(fd) != m_owners.end(); }
+   void              dispatch(proxy_result& res);
+   void              handle_event(int fd, uint32_t events, proxy_result& res);
+
+   /*定时器触发时调用：超时处理，应用在 ABORT_TIMEOUT 内没有结束放弃的请求时关闭这个连接*/
+   void              tick(proxy_result& res);
+};
+
+#endif
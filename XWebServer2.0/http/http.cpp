@@ -1,21 +1,20 @@
 #include "http.h"
+#include "../pool/thread_pool.h"
 
 #include <mysql/mysql.h>
 #include <fstream>
+#include <atomic>
 
 //定义http响应的一些状态信息
-const char *ok_200_title = "OK";
-const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
-const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
-const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
-const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_503_form = "The server is starting up, please try again later.\n";
 
 int http::m_user_count = 0;
 int http::m_epollfd = -1;
+thread_pool<http>* http::m_pool = NULL;
 
 /*对文件描述符设置非阻塞*/
 int setnonblocking(int fd)
@@ -103,25 +102,99 @@ void http::close_conn(bool real_close)
       removefd(m_epollfd, m_sockfd);
       m_sockfd = -1;
       m_user_count--;
+
+      //还在等待的数据库结果到达时直接丢弃，不再把已经关闭的连接交给线程池
+      m_park_id = 0;
+      m_db_stage = DB_NONE;
    }
 }
 
 void http::process()
 {
-   HTTP_CODE read_ret = process_read();
+   HTTP_CODE read_ret = m_db_stage != DB_NONE ? resume_request() : process_read();
+   /*
+      等待数据库或者转到了数据库通道，结果到达后请求由别的线程继续，
+      期间请求仍算在线程池中，这里不能再访问连接的状态
+   */
+   if ( read_ret == DB_PENDING )
+      return;
+   /*
+      处理期间连接超时或者客户端断开，事件循环没有关闭连接，交给这里关闭，结果不再发送
+      finish_work 之后事件循环就可以关闭这个 fd，fd 还可能马上分给新连接，
+      所以要在响应写进缓冲区、转发的内容准备好之后，交给 epoll 或者转发模块之前才调用
+   */
    if ( read_ret == NO_REQUEST )
    {
+      if ( !finish_work() )
+      {
+         close_conn();
+         return;
+      }
       modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
       return;
    }
+   /*转发请求，之后这个连接由事件循环中的 reverse_proxy 接管*/
+   if ( read_ret == PROXY_REQUEST )
+   {
+      std::string request = build_proxy_request();
+      if ( !finish_work() )
+      {
+         close_conn();
+         return;
+      }
+      reverse_proxy::get_instance()->submit(m_sockfd, m_proxy_route, m_linger, std::move(request));
+      return;
+   }
+   /*交给 FastCGI 应用，之后这个连接由事件循环中的 fastcgi_client 接管*/
+   if ( read_ret == FASTCGI_REQUEST )
+   {
+      fastcgi_client::param_list params = build_fcgi_params();
+      std::string body = m_content_length > 0 ? std::string(m_string, m_content_length) : std::string();
+      if ( !finish_work() )
+      {
+         close_conn();
+         return;
+      }
+      fastcgi_client::get_instance()->submit(m_sockfd, m_fcgi_route, m_linger, std::move(params),
+                                             std::move(body));
+      return;
+   }
    bool write_ret = process_write(read_ret);
-   if ( !write_ret )
+   if ( !finish_work() || !write_ret )
    {
       close_conn();
+      return;
    }
    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
 }
 
+void http::start_work(time_t expire)
+{
+   m_cancelled = false;
+   if ( expire > 0 )
+      m_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(expire - time(NULL));
+   else
+      m_deadline = std::chrono::steady_clock::time_point::max();
+   m_work_state = WORK_BUSY;
+}
+
+/*和 finish_work 用同一个状态比较交换，只有一方会关闭连接*/
+bool http::cancel()
+{
+   m_cancelled = true;
+   int state = WORK_BUSY;
+   return !m_work_state.compare_exchange_strong(state, WORK_CANCELLED);
+}
+
+bool http::finish_work()
+{
+   int state = WORK_BUSY;
+   if ( m_work_state.compare_exchange_strong(state, WORK_IDLE) )
+      return true;
+   m_work_state = WORK_IDLE;
+   return false;
+}
+
 /*
    循环读取客户数据，直到无数据可读或对方关闭连接
    非阻塞ET工作模式下，需要一次性将数据读完
@@ -202,7 +275,7 @@ bool http::write()
       if ( bytes_have_send >= m_iv[0].iov_len )
       {
          m_iv[0].iov_len = 0;
-         m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
+         m_iv[1].iov_base = (m_file_address ? m_file_address : &m_body[0]) + (bytes_have_send - m_write_idx);
          m_iv[1].iov_len = bytes_to_send;
       }
       else
@@ -217,6 +290,12 @@ bool http::write()
          /*没有待发送的数据了就重置socket为 EPOLL_IN*/
          modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
 
+         /*SSE 连接发送完响应头后保持打开，由事件循环交给 sse_hub*/
+         if ( m_sse )
+         {
+            return true;
+         }
+
          /*如果是长连接，则再初始化一次*/
          if ( m_linger )
          {
@@ -231,44 +310,12 @@ bool http::write()
    }
 }
 
-/*初始化 mysql 连接，并将数据库中的信息放到 map 中*/
-void http::initmysql_result(connection_pool* connPool)
-{
-   // //先从连接池中取一个连接
-   MYSQL* mysql = NULL;
-   connectionRAII mysqlcon(&mysql, connPool);
-
-   //在user表中检索username，passwd数据，浏览器端输入
-   if ( mysql_query(mysql, "SELECT username,passwd FROM user") )
-   {
-      LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-   }
-
-   //从表中检索完整的结果集
-   MYSQL_RES* result = mysql_store_result(mysql);
-
-   //返回结果集中的列数
-   int num_fields = mysql_num_fields(result);
-
-   //返回所有字段结构的数组
-   MYSQL_FIELD* fields = mysql_fetch_fields(result);
-
-   //从结果集中获取下一行，将对应的用户名和密码，存入map中
-   while ( MYSQL_ROW row = mysql_fetch_row(result) )
-   {
-      std::string temp1(row[0]);
-      std::string temp2(row[1]);
-      m_users[temp1] = temp2;
-   }
-}
-
 /*
    初始化新接受的连接
    check_state默认为分析请求行状态
 */
 void http::init()
 {
-   mysql = NULL;
    bytes_to_send = 0;
    bytes_have_send = 0;
    m_check_state = CHECK_STATE_REQUESTLINE;
@@ -278,15 +325,26 @@ void http::init()
    m_version = 0;
    m_content_length = 0;
    m_host = 0;
+   m_vhost = NULL;
+   m_proxy_route = -1;
+   m_fcgi_route = -1;
+   m_headers_start = 0;
    m_start_line = 0;
    m_checked_idx = 0;
    m_read_idx = 0;
    m_write_idx = 0;
    cgi = 0;
+   m_sse = false;
+   m_db_stage = DB_NONE;
+   m_in_db_lane = false;
+   m_park_id = 0;
+   m_session[0] = '\0';
+   m_set_cookie.clear();
 
    memset(m_read_buf,  '\0', READ_BUFFER_SIZE);
    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
    memset(m_real_file, '\0', FILENAME_LEN);
+   memset(m_sse_channel, '\0', sse_hub::CHANNEL_LEN);
 }
 
 /*
@@ -373,8 +431,13 @@ http::HTTP_CODE http::parse_request_line(char* text)
     if ( !m_url || m_url[0] != '/' )
       return BAD_REQUEST;
 
+    //在改写 url 之前确定是否需要转发给上游
+    m_proxy_route = reverse_proxy::get_instance()->match(m_url);
+    if ( m_proxy_route == -1 )
+      m_fcgi_route = fastcgi_client::get_instance()->match(m_url);
+
     //当url为/时，显示判断界面
-    if ( strlen(m_url) == 1 )
+    if ( m_proxy_route == -1 && m_fcgi_route == -1 && strlen(m_url) == 1 )
       strcat(m_url, "judge.html");
 
     m_check_state = CHECK_STATE_HEADER;
@@ -387,6 +450,11 @@ http::HTTP_CODE http::parse_headers(char* text)
 {
    if( text[0] == '\0' )
    {
+      /*头部解析完毕，按 Host 选择虚拟主机并检查请求体大小*/
+      m_vhost = vhost_table::get_instance()->find(m_host);
+      if( m_content_length < 0 || m_content_length > m_vhost->max_content_length )
+         return BAD_REQUEST;
+
       if( m_content_length != 0 )
       {
          m_check_state = CHECK_STATE_CONTENT;
@@ -409,6 +477,25 @@ http::HTTP_CODE http::parse_headers(char* text)
       text += strspn(text, " \t");
       m_content_length = atol(text);
    }
+   else if( strncasecmp(text, "Cookie:", 7) == 0 )
+   {
+      /*只关心 sid，其它 Cookie 忽略*/
+      text += 7;
+      while ( *text != '\0' )
+      {
+         text += strspn(text, " \t;");
+         if ( strncmp(text, "sid=", 4) == 0 )
+         {
+            if ( strcspn(text + 4, "; \t") == session_table::ID_LEN )
+            {
+               memcpy(m_session, text + 4, session_table::ID_LEN);
+               m_session[session_table::ID_LEN] = '\0';
+            }
+            break;
+         }
+         text += strcspn(text, ";");
+      }
+   }
    else if( strncasecmp(text, "Host:", 5) == 0 )
    {
       text += 5;
@@ -457,6 +544,7 @@ http::HTTP_CODE http::process_read()
                   ret = parse_request_line(text);
                   if ( ret == BAD_REQUEST )
                      return BAD_REQUEST;
+                  m_headers_start = m_start_line;
                   break;
             }
             case CHECK_STATE_HEADER:
@@ -488,18 +576,37 @@ http::HTTP_CODE http::process_read()
 /*处理请求*/
 http::HTTP_CODE http::do_request()
 {
-   strcpy(m_real_file, doc_root);
-   int len = strlen(doc_root);
-   const char* p = strrchr(m_url, '/');
-   char* m_url_real = (char*)malloc(sizeof(char) * 200);
+   if ( m_proxy_route != -1 )
+      return PROXY_REQUEST;
+   if ( m_fcgi_route != -1 )
+      return FASTCGI_REQUEST;
+
+   /*Server-Sent Events 订阅，连接交给事件循环中的 sse_hub 维护*/
+   if ( m_method == GET && strncmp(m_url, "/events/", 8) == 0 )
+   {
+      if ( m_url[8] == '\0' || strlen(m_url + 8) >= sse_hub::CHANNEL_LEN )
+         return BAD_REQUEST;
+      strcpy(m_sse_channel, m_url + 8);
+      m_sse = true;
+      return SSE_REQUEST;
+   }
+
+   /*发布事件只是放进队列，真正的下发在事件循环中完成*/
+   if ( m_method == POST && strncmp(m_url, "/publish/", 9) == 0 )
+   {
+      if ( m_url[9] == '\0' || m_content_length == 0 )
+         return BAD_REQUEST;
+      sse_hub::get_instance()->publish(m_url + 9, m_string);
+      return PUBLISH_REQUEST;
+   }
+
+   if ( m_method == GET && strcmp(m_url, "/metrics") == 0 )
+      return METRICS_REQUEST;
 
    //处理登录和注册
+   const char* p = strrchr(m_url, '/');
    if ( cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3') )
    {
-      strcpy(m_url_real, "/");
-      strcat(m_url_real, m_url + 2);
-      strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-
       //将用户名和密码提取出来
       //user=123&password=123
       char name[100], password[100];
@@ -513,76 +620,313 @@ http::HTTP_CODE http::do_request()
          password[j] = m_string[i];
       password[j] = '\0';
 
-      if ( *(p + 1) == '3' )
+      //已经以同一个用户名登录过的只查一次会话表，不再校验密码，会话属于别的用户时照常校验
+      std::string session_user;
+      if ( *(p + 1) == '2' && m_session[0] != '\0' &&
+           session_table::get_instance()->find(m_session, &session_user) && session_user == name )
       {
-         //如果是注册，先检测数据库中是否有重名的
-         //没有重名的，进行增加数据
-         char* sql_insert = (char*)malloc(sizeof(char) * 200);
-         strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-         strcat(sql_insert, "'");
-         strcat(sql_insert, name);
-         strcat(sql_insert, "', '");
-         strcat(sql_insert, password);
-         strcat(sql_insert, "')");
-
-         if ( m_users.find(name) == m_users.end() )
-         {
-            std::unique_lock<std::mutex> lk(m_mutex);
-            int res = mysql_query(mysql, sql_insert);
-            m_users.insert(std::pair<std::string, std::string>(name, password));
-            lk.unlock();
-
-            if ( !res )
-               strcpy(m_url, "/log.html");
-            else
-               strcpy(m_url, "/registerError.html");
-         }
-         else
-            strcpy(m_url, "/registerError.html");
+         strcpy(m_url, "/welcome.html");
+         return map_file();
       }
-      //如果是登录，直接判断
-      //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-      else if ( *(p + 1) == '2' ) 
+
+      //连接池还没有达到最小连接数或者用户缓存还没加载完
+      if ( !startup::get_instance()->ready(startup::STAGE_DB) )
+         return SERVICE_UNAVAILABLE;
+
+      m_db_name = name;
+      m_db_passwd = password;
+      return do_db_route();
+   }
+
+   return map_file();
+}
+
+/*
+   只有登录和注册会访问数据库，连接在第一次用到时才取，同一个请求内的多次存储调用复用，返回时归还，
+   其它路由不取连接
+*/
+http::HTTP_CODE http::do_db_route()
+{
+   connection_scope db_scope(m_deadline, &m_cancelled);
+
+   //在数据库通道中排队时已经超过截止时间，不再访问数据库
+   if ( connection_scope::expired() )
+      return SERVICE_UNAVAILABLE;
+
+   const char* p = strrchr(m_url, '/');
+   if ( *(p + 1) == '3' )
+      return do_register();
+   return do_login();
+}
+
+/*已经在数据库通道中，或者没有数据库通道时返回 false，由当前线程直接处理*/
+bool http::defer_to_db_lane()
+{
+   if ( m_in_db_lane || !m_pool->has_db_lane() )
+      return false;
+
+   m_db_stage = DB_LANE;
+
+   /*
+      排队和处理期间只等 EPOLLHUP 和 EPOLLERR（不需要注册，总会报告），连接真的断开时取消请求；
+      不监听 EPOLLRDHUP，发完请求就 shutdown(SHUT_WR) 的客户端还在等响应，半关闭不算断开
+   */
+   epoll_event event;
+   event.data.fd = m_sockfd;
+   event.events = EPOLLONESHOT;
+   epoll_ctl(m_epollfd, EPOLL_CTL_MOD, m_sockfd, &event);
+
+   m_pool->append_db(this);
+   return true;
+}
+
+/*
+   如果是登录，先查缓存，缓存中没有再到数据库查
+   启用非阻塞数据库时挂起请求，不占用工作线程等待查询结果，
+   否则转到数据库通道，缓存命中的登录仍在工作线程中完成
+*/
+http::HTTP_CODE http::do_login()
+{
+   user_cache* cache = user_cache::get_instance();
+   std::string passwd;
+
+   //在数据库通道中说明刚才缓存没有命中，不再重复查找
+   bool found = !m_in_db_lane && cache->find(m_db_name, passwd);
+
+   if ( !found && async_sql::get_instance()->enabled() )
+   {
+      async_sql::get_instance()->query("SELECT passwd FROM user WHERE username=?",
+                                       { m_db_name }, park(DB_LOGIN));
+      return DB_PENDING;
+   }
+
+   if ( !found && defer_to_db_lane() )
+      return DB_PENDING;
+
+   if ( !found )
+   {
+      int ret = cache->lookup_db(m_db_name, passwd);
+      //查询失败（包括超过截止时间被取消）不当作密码错误
+      if ( ret < 0 )
+         return SERVICE_UNAVAILABLE;
+      found = ret == 1;
+   }
+   if ( found && passwd == m_db_passwd )
+   {
+      start_session();
+      strcpy(m_url, "/welcome.html");
+   }
+   else
+      strcpy(m_url, "/logError.html");
+   return map_file();
+}
+
+/*
+   如果是注册，先检测数据库中是否有重名的，没有重名的，进行增加数据
+   布隆过滤器判断一定不存在的用户名直接写库，可能重名的先到数据库确认
+*/
+http::HTTP_CODE http::do_register()
+{
+   user_cache* cache = user_cache::get_instance();
+
+   if ( async_sql::get_instance()->enabled() )
+   {
+      if ( !cache->may_exist(m_db_name) )
+         return submit_register();
+
+      async_sql::get_instance()->query("SELECT 1 FROM user WHERE username=? LIMIT 1",
+                                       { m_db_name }, park(DB_CHECK_NAME));
+      return DB_PENDING;
+   }
+
+   //确认重名和等待写入线程都可能阻塞，交给数据库通道
+   if ( defer_to_db_lane() )
+      return DB_PENDING;
+
+   int exists = cache->may_exist(m_db_name) ? cache->exists_in_db(m_db_name) : 0;
+   if ( exists < 0 )
+      return SERVICE_UNAVAILABLE;
+   bool duplicate = exists != 0;
+
+   //先在缓存中占住用户名，写数据库失败再撤销，并发注册同名用户时只有一个能成功
+   if ( !duplicate && cache->insert(m_db_name, m_db_passwd) )
+   {
+      //交给写入线程，和同一时间窗口内的其它注册一起提交，出错或者等到超时返回 503，不当成重名
+      int ret = register_writer::get_instance()->submit(m_db_name, m_db_passwd);
+      if ( ret == 0 )
+         strcpy(m_url, "/log.html");
+      else
       {
-         if ( m_users.find(name) != m_users.end() && m_users[name] == password )
+         cache->erase(m_db_name);
+         if ( ret < 0 )
+            return SERVICE_UNAVAILABLE;
+         strcpy(m_url, "/registerError.html");
+      }
+   }
+   else
+      strcpy(m_url, "/registerError.html");
+   return map_file();
+}
+
+/*
+   确认用户名不存在后非阻塞地写入
+   启用了写入线程时仍然合并提交，写入线程的回调经 post 回到事件循环，否则直接执行 INSERT
+*/
+http::HTTP_CODE http::submit_register()
+{
+   if ( !user_cache::get_instance()->insert(m_db_name, m_db_passwd) )
+   {
+      strcpy(m_url, "/registerError.html");
+      return map_file();
+   }
+
+   sql_callback resume = park(DB_REGISTER);
+   if ( register_writer::get_instance()->enabled() )
+   {
+      register_writer::get_instance()->submit_async(m_db_name, m_db_passwd, [resume](int ret)
+      {
+         async_sql::get_instance()->post([resume, ret]()
+         {
+            sql_result res = { (unsigned int)ret, false, "" };
+            resume(res);
+         });
+      });
+   }
+   else
+   {
+      async_sql::get_instance()->query("INSERT INTO user(username, passwd) VALUES(?, ?)",
+                                       { m_db_name, m_db_passwd }, resume);
+   }
+   return DB_PENDING;
+}
+
+void http::start_session()
+{
+   char id[session_table::ID_LEN + 1];
+   session_table* table = session_table::get_instance();
+   if ( !table->create(m_db_name, id) )
+   {
+      LOG_ERROR("create session for %s failed", m_db_name.c_str());
+      return;
+   }
+   m_set_cookie = "Set-Cookie:sid=";
+   m_set_cookie.append(id, session_table::ID_LEN);
+   m_set_cookie += "; Path=/; Max-Age=" + std::to_string(table->ttl()) + "; HttpOnly\r\n";
+}
+
+/*
+   回调只在事件循环中执行，和 init 在同一个线程，
+   连接在等待期间被关闭时 m_park_id 已经清零，之后再挂起也会得到新的 id
+*/
+sql_callback http::park(DB_STAGE stage)
+{
+   static std::atomic<unsigned int> next_id(0);
+   unsigned int id;
+   do
+   {
+      id = ++next_id;
+   } while ( id == 0 );
+
+   m_db_stage = stage;
+   m_park_id = id;
+   return [this, id](sql_result& res)
+   {
+      if ( m_park_id != id )
+         return;
+      m_park_id = 0;
+      m_db_result = res;
+      m_pool->append(this);
+   };
+}
+
+http::HTTP_CODE http::resume_request()
+{
+   DB_STAGE stage = m_db_stage;
+   m_db_stage = DB_NONE;
+
+   //在数据库通道的线程中继续处理登录或注册
+   if ( stage == DB_LANE )
+   {
+      m_in_db_lane = true;
+      HTTP_CODE ret = do_db_route();
+      m_in_db_lane = false;
+      return ret;
+   }
+
+   const sql_result& res = m_db_result;
+   user_cache* cache = user_cache::get_instance();
+
+   if ( res.err != 0 && !(stage == DB_REGISTER && res.err == 1) )
+      LOG_ERROR("async sql of fd %d failed: %u", m_sockfd, res.err);
+
+   switch ( stage )
+   {
+      case DB_LOGIN:
+      {
+         if ( res.err != 0 )
+            return SERVICE_UNAVAILABLE;
+
+         //查到的用户放进缓存，下次登录不再访问数据库
+         bool found = res.has_row;
+         if ( found )
+            cache->insert(m_db_name, res.value);
+         if ( found && res.value == m_db_passwd )
          {
+            start_session();
             strcpy(m_url, "/welcome.html");
          }
          else
-         {
             strcpy(m_url, "/logError.html");
+         break;
+      }
+      case DB_CHECK_NAME:
+      {
+         if ( res.err != 0 )
+            return SERVICE_UNAVAILABLE;
+         if ( !res.has_row )
+            return submit_register();
+         strcpy(m_url, "/registerError.html");
+         break;
+      }
+      case DB_REGISTER:
+      {
+         if ( res.err == 0 )
+            strcpy(m_url, "/log.html");
+         else
+         {
+            cache->erase(m_db_name);
+            strcpy(m_url, "/registerError.html");
          }
+         break;
       }
+      default:
+         return INTERNAL_ERROR;
    }
+   return map_file();
+}
+
+http::HTTP_CODE http::map_file()
+{
+   const char* root = m_vhost ? m_vhost->root.c_str() : doc_root;
+   strncpy(m_real_file, root, FILENAME_LEN - 1);
+   int len = strlen(m_real_file);
+   const char* p = strrchr(m_url, '/');
 
    /*处理其他情况*/
+   const char* page = NULL;
    if ( *(p + 1) == '0' )
-   {
-      strcpy(m_url_real, "/register.html");
-      strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-   }
+      page = "/register.html";
    else if ( *(p + 1) == '1' )
-   {
-      strcpy(m_url_real, "/log.html");
-      strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-   }
+      page = "/log.html";
    else if ( *(p + 1) == '5' )
-   {
-      strcpy(m_url_real, "/picture.html");
-      strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-   }
+      page = "/picture.html";
    else if ( *(p + 1) == '6' )
-   {
-      strcpy(m_url_real, "/video.html");
-      strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-   }
+      page = "/video.html";
    else if ( *(p + 1) == '7' )
-   {
-      strcpy(m_url_real, "/fans.html");
-      strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-   }
+      page = "/fans.html";
    else
-      strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+      page = m_url;
+   strncpy(m_real_file + len, page, FILENAME_LEN - len - 1);
 
    /*对文件进行判断*/
    if ( stat(m_real_file, &m_file_stat) < 0 )
@@ -599,73 +943,147 @@ http::HTTP_CODE http::do_request()
    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
    close(fd);
-   free(m_url_real);
 
    return FILE_REQUEST;
 }
-void http::unmap()
+
+/*
+   请求行和请求头被解析时把 \r\n 换成了 \0\0，这里逐行拼回去
+   Connection 相关的头部是逐跳的，由代理自己决定
+*/
+std::string http::build_proxy_request()
 {
-   if( m_file_address )
+   std::string req;
+   req.reserve(m_read_idx + 64);
+   req += (m_method == POST) ? "POST " : "GET ";
+   req += m_url;
+   req += " HTTP/1.1\r\n";
+
+   for (char* p = m_read_buf + m_headers_start; p < m_read_buf + m_read_idx && *p != '\0'; )
    {
-      munmap(m_file_address, m_file_stat.st_size);
-      m_file_address = 0;
+      int len = strlen(p);
+      if ( strncasecmp(p, "Connection:", 11) != 0 && strncasecmp(p, "Keep-Alive:", 11) != 0 &&
+           strncasecmp(p, "Proxy-Connection:", 17) != 0 )
+      {
+         req.append(p, len);
+         req += "\r\n";
+      }
+      p += len + 2;
    }
+
+   req += "Connection:keep-alive\r\nX-Forwarded-For:";
+   req += inet_ntoa(m_address.sin_addr);
+   req += "\r\n\r\n";
+
+   if ( m_content_length > 0 )
+      req.append(m_string, m_content_length);
+
+   return req;
 }
 
-bool http::add_response(const char* format, ...)
+/*
+   按 CGI/1.1 的约定整理参数，请求头转成 HTTP_ 开头的变量
+   Proxy 头不转发，避免应用把它当成 HTTP_PROXY 环境变量使用
+*/
+fastcgi_client::param_list http::build_fcgi_params()
 {
-   if( m_write_idx >= WRITE_BUFFER_SIZE )
-      return false;
-   va_list arg_list;
-   va_start(arg_list, format);
-   int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-   if ( len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx) )
+   fastcgi_client::param_list params;
+   const std::string& script_root = fastcgi_client::get_instance()->script_root(m_fcgi_route);
+
+   const char* query = strchr(m_url, '?');
+   std::string path = query ? std::string(m_url, query - m_url) : std::string(m_url);
+   char num[20];
+
+   params.emplace_back("GATEWAY_INTERFACE", "CGI/1.1");
+   params.emplace_back("SERVER_SOFTWARE", "XWebServer");
+   params.emplace_back("SERVER_PROTOCOL", "HTTP/1.1");
+   params.emplace_back("REQUEST_METHOD", m_method == POST ? "POST" : "GET");
+   params.emplace_back("REQUEST_URI", m_url);
+   params.emplace_back("SCRIPT_NAME", path);
+   params.emplace_back("SCRIPT_FILENAME", script_root + path);
+   params.emplace_back("DOCUMENT_ROOT", script_root);
+   params.emplace_back("QUERY_STRING", query ? query + 1 : "");
+   params.emplace_back("CONTENT_LENGTH", std::string(num, format_uint(num, m_content_length)));
+   params.emplace_back("REMOTE_ADDR", inet_ntoa(m_address.sin_addr));
+   params.emplace_back("REMOTE_PORT", std::string(num, format_uint(num, ntohs(m_address.sin_port))));
+
+   for (char* p = m_read_buf + m_headers_start; p < m_read_buf + m_read_idx && *p != '\0'; )
    {
-      va_end(arg_list);
-      return false;
-   }
-   m_write_idx += len;
-   va_end(arg_list);
+      int len = strlen(p);
+      char* colon = strchr(p, ':');
+      if ( colon )
+      {
+         std::string name(p, colon - p);
+         char* value = colon + 1;
+         value += strspn(value, " \t");
 
-   LOG_INFO("request:%s", m_write_buf);
+         for (size_t i = 0; i < name.size(); ++i)
+            name[i] = (name[i] == '-') ? '_' : toupper(name[i]);
 
-   return true;
-}
+         if ( name == "CONTENT_TYPE" )
+            params.emplace_back(name, value);
+         else if ( name != "CONTENT_LENGTH" && name != "PROXY" )
+            params.emplace_back("HTTP_" + name, value);
+      }
+      p += len + 2;
+   }
 
-bool http::add_status_line(int status, const char* title)
-{
-   return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+   return params;
 }
 
-bool http::add_headers(int content_len)
+void http::reset_conn()
 {
-   return add_content_length(content_len) && add_linger() &&
-         add_blank_line();
+   init();
+   modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
 }
 
-bool http::add_content_length(int content_len)
+void http::unmap()
 {
-   return add_response("Content-Length:%d\r\n", content_len);
+   if( m_file_address )
+   {
+      munmap(m_file_address, m_file_stat.st_size);
+      m_file_address = 0;
+   }
 }
 
-bool http::add_content_type()
+bool http::append(const char* data, int len)
 {
-   return add_response("Content-Type:%s\r\n", "text/html");
+   if ( len > WRITE_BUFFER_SIZE - 1 - m_write_idx )
+      return false;
+   memcpy(m_write_buf + m_write_idx, data, len);
+   m_write_idx += len;
+   return true;
 }
 
-bool http::add_linger()
+/*
+   状态行、Connection 头直接拷贝预先序列化好的模板，
+   只有 Content-Length 需要现场格式化，content_len < 0 表示不发送 Content-Length
+*/
+bool http::add_head(int status, long content_len, const char* extra_headers)
 {
-   return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
-}
+   const status_block* block = find_status_block(status);
+   if ( !block )
+      return false;
 
-bool http::add_blank_line()
-{
-   return add_response("%s", "\r\n");
+   bool ok = m_linger ? append(block->keep_alive, block->keep_alive_len)
+                      : append(block->close, block->close_len);
+
+   if ( ok && content_len >= 0 )
+   {
+      char num[20];
+      ok = append("Content-Length:", 15) && append(num, format_uint(num, content_len)) &&
+           append("\r\n", 2);
+   }
+
+   if ( ok && extra_headers[0] != '\0' )
+      ok = append(extra_headers, strlen(extra_headers));
+
+   return ok && append(http_date::get(), http_date::DATE_LEN) && append("\r\n", 2);
 }
 
 bool http::add_content(const char* content)
 {
-   return add_response("%s", content);
+   return append(content, strlen(content));
 }
 
 bool http::process_write(HTTP_CODE ret)
@@ -674,49 +1092,87 @@ bool http::process_write(HTTP_CODE ret)
    {
       case INTERNAL_ERROR:
       {
-         add_status_line(500, error_500_title);
-         add_headers(strlen(error_500_form));
-         if( !add_content(error_500_form) )
+         if( !add_head(500, strlen(error_500_form)) || !add_content(error_500_form) )
             return false;
          break;
       }
       case BAD_REQUEST:
+      case NO_RESOURCE:
       {
-         add_status_line(404, error_404_title);
-         add_headers(strlen(error_404_form));
-         if( !add_content(error_404_form) )
+         if( !add_head(404, strlen(error_404_form)) || !add_content(error_404_form) )
             return false;
          break;
       }
       case FORBIDDEN_REQUEST:
       {
-         add_status_line(403, error_403_title);
-         add_headers(strlen(error_403_form));
-         if( !add_content(error_403_form) )
+         if( !add_head(403, strlen(error_403_form)) || !add_content(error_403_form) )
             return false;
          break;
       }
+      case SERVICE_UNAVAILABLE:
+      {
+         if( !add_head(503, strlen(error_503_form), "Retry-After:1\r\n") || !add_content(error_503_form) )
+            return false;
+         break;
+      }
+      case SSE_REQUEST:
+      {
+         m_linger = true;
+         if ( !add_head(200, -1, "Content-Type:text/event-stream\r\nCache-Control:no-cache\r\n") )
+            return false;
+         break;
+      }
+      case PUBLISH_REQUEST:
+      {
+         if ( !add_head(204, -1) )
+            return false;
+         break;
+      }
+      case METRICS_REQUEST:
+      {
+         m_body.clear();
+         user_cache::get_instance()->report(m_body);
+         register_writer::get_instance()->report(m_body);
+         lookup_batcher::report(m_body);
+         connection_pool::GetInstance()->report(m_body);
+         m_pool->report(m_body);
+         db_router::get_instance()->report(m_body);
+         session_table::get_instance()->report(m_body);
+         startup::get_instance()->report(m_body);
+         query_cache::get_instance()->report(m_body);
+         if ( !add_head(200, m_body.size(), "Content-Type:text/plain; version=0.0.4\r\n") )
+            return false;
+         m_iv[0].iov_base = m_write_buf;
+         m_iv[0].iov_len = m_write_idx;
+         m_iv[1].iov_base = &m_body[0];
+         m_iv[1].iov_len = m_body.size();
+         m_iv_count = 2;
+         bytes_to_send = m_write_idx + m_body.size();
+         LOG_INFO("response:200 %s", m_url);
+         return true;
+      }
       case FILE_REQUEST:
       {
-         add_status_line(200, ok_200_title);
          if( m_file_stat.st_size != 0 )
          {
-            add_headers(m_file_stat.st_size);
+            if ( !add_head(200, m_file_stat.st_size, m_set_cookie.c_str()) )
+               return false;
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
             m_iv[1].iov_base = m_file_address;
             m_iv[1].iov_len = m_file_stat.st_size;
             m_iv_count = 2;
             bytes_to_send = m_write_idx + m_file_stat.st_size;
+            LOG_INFO("response:200 %s", m_real_file);
             return true;
          }
          else
          {
             const char* ok_string = "<html><body></body></html>";
-            add_headers(strlen(ok_string));
-            if ( !add_content(ok_string) )
+            if ( !add_head(200, strlen(ok_string), m_set_cookie.c_str()) || !add_content(ok_string) )
                return false;
          }
+         break;
       }
       default:
          return false;
@@ -725,5 +1181,6 @@ bool http::process_write(HTTP_CODE ret)
    m_iv[0].iov_len = m_write_idx;
    m_iv_count = 1;
    bytes_to_send = m_write_idx;
+   LOG_INFO("response:%d bytes", m_write_idx);
    return true;
 }
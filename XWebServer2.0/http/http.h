@@ -22,9 +22,27 @@
 #include <sys/uio.h>
 #include <map>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 
 #include "../pool/sqlconn_pool.h"
 #include "../log/log.h"
+#include "../sse/sse.h"
+#include "response.h"
+#include "../vhost/vhost.h"
+#include "../proxy/proxy.h"
+#include "../fastcgi/fastcgi.h"
+#include "../user/user_cache.h"
+#include "../user/register_writer.h"
+#include "../user/lookup_batcher.h"
+#include "../user/session_table.h"
+#include "../pool/async_sql.h"
+#include "../pool/query_cache.h"
+#include "../pool/db_router.h"
+#include "../startup/startup.h"
+
+template <typename T>
+class thread_pool;
 
 class http
 {
@@ -62,7 +80,24 @@ public:
       FORBIDDEN_REQUEST,
       FILE_REQUEST,
       INTERNAL_ERROR,
-      CLOSED_CONNECTION
+      CLOSED_CONNECTION,
+      SSE_REQUEST,
+      PUBLISH_REQUEST,
+      PROXY_REQUEST,
+      FASTCGI_REQUEST,
+      METRICS_REQUEST,
+      DB_PENDING,
+      SERVICE_UNAVAILABLE
+   };
+
+   /*等待非阻塞数据库查询结果时所处的阶段*/
+   enum DB_STAGE
+   {
+      DB_NONE = 0,
+      DB_LOGIN,                        //查询密码
+      DB_CHECK_NAME,                   //注册前确认用户名是否存在
+      DB_REGISTER,                     //写入新用户
+      DB_LANE                          //等待数据库通道的线程处理
    };
 
 
@@ -109,7 +144,7 @@ private:
 
    /*
       请求文件的路径
-      m_url 有如下8种情况
+      m_url 有如下10种情况
       1、/
       GET请求，跳转到judge.html，即欢迎访问页面   
 
@@ -121,13 +156,16 @@ private:
 
       4、/2CGISQL.cgi
       POST请求，进行登录校验
-      验证成功跳转到welcome.html，即资源请求成功页面
+      验证成功跳转到welcome.html，即资源请求成功页面，同时下发会话 Cookie
       验证失败跳转到logError.html，即登录失败页面
+      带着有效会话 Cookie 的请求不再校验密码，直接跳转到welcome.html
+      数据库阶段没有就绪时返回503
 
       5、/3CGISQL.cgi
       POST请求，进行注册校验
       注册成功跳转到log.html，即登录页面
       注册失败跳转到registerError.html，即注册失败页面
+      数据库阶段没有就绪时返回503
 
       6、/5
       POST请求，跳转到picture.html，即图片请求页面
@@ -137,6 +175,15 @@ private:
 
       8、/7
       POST请求，跳转到fans.html，即关注页面
+
+      9、/events/频道名
+      GET请求，建立 Server-Sent Events 长连接，订阅该频道
+
+      10、/publish/频道名
+      POST请求，请求体作为一条事件发布到该频道，返回204
+
+      11、/metrics
+      GET请求，以 Prometheus 文本格式返回运行统计
    */
    char*          m_url;
 
@@ -156,6 +203,9 @@ private:
    char*          m_file_address;
    struct stat    m_file_stat;
    struct iovec   m_iv[2];
+
+   /*动态生成的响应体，和文件一样放在 m_iv[1] 发送*/
+   std::string    m_body;
    int            m_iv_count;
 
    /*是否启用POST*/
@@ -173,9 +223,17 @@ private:
    /*网站根目录*/
    char*          doc_root;
 
-   /*数据库用户信息*/
-   std::map<std::string, std::string> 
-                  m_users;
+   /*根据 Host 头选中的虚拟主机*/
+   const vhost*   m_vhost;
+
+   /*匹配到的反向代理路由，-1 表示不转发*/
+   int            m_proxy_route;
+
+   /*匹配到的 FastCGI 路由，-1 表示不交给应用服务器*/
+   int            m_fcgi_route;
+
+   /*请求头在读缓冲区中的起始位置，转发时按原样拼回去*/
+   long           m_headers_start;
 
    /*选择 LT 模式还是 ET 模式*/
    int            m_TRIGMode;
@@ -192,8 +250,44 @@ private:
    /*数据库名字*/
    char           sql_name[100];
 
-   /*互斥锁*/
-   std::mutex     m_mutex;
+   /*是否是 Server-Sent Events 长连接，以及订阅的频道*/
+   bool           m_sse;
+   char           m_sse_channel[sse_hub::CHANNEL_LEN];
+
+   /*
+      请求挂起等待数据库时的状态，结果到达后重新交给线程池从 resume_request 继续
+      m_park_id 每次挂起都不同，连接关闭时清零，过期的结果直接丢弃
+   */
+   DB_STAGE       m_db_stage;
+   bool           m_in_db_lane;     //正在数据库通道的线程中处理
+   unsigned int   m_park_id;
+
+   /*
+      请求的截止时间，由交给线程池时连接定时器的到期时间得到，数据库操作不会超过它
+      请求在线程池中（包括挂起等待数据库）时事件循环不关闭连接，只置 m_cancelled，
+      由处理这个请求的线程在结束时关闭，避免描述符被新的连接复用时这个对象还在使用
+   */
+   enum WORK_STATE
+   {
+      WORK_IDLE = 0,
+      WORK_BUSY,
+      WORK_CANCELLED
+   };
+   std::chrono::steady_clock::time_point
+                  m_deadline;
+   std::atomic<bool>
+                  m_cancelled;
+   std::atomic<int>
+                  m_work_state;
+   std::string    m_db_name;
+   std::string    m_db_passwd;
+   sql_result     m_db_result;
+
+   /*请求带来的会话 ID（Cookie 中的 sid），没有时为空串*/
+   char           m_session[session_table::ID_LEN + 1];
+
+   /*登录成功后要下发的 Set-Cookie 头，带 \r\n*/
+   std::string    m_set_cookie;
 
 public:
    /*epoll 标识符*/
@@ -202,11 +296,12 @@ public:
    /*用户数量*/
    static int     m_user_count;
 
-   /*数据库连接*/
-   MYSQL*         mysql;
+   /*数据库结果到达后把挂起的请求交还给线程池*/
+   static thread_pool<http>*
+                  m_pool;
 
 public:
-   http() {}
+   http() : m_cancelled(false), m_work_state(WORK_IDLE) {}
    ~http() {}
 
 public:
@@ -230,17 +325,37 @@ public:
 
    void           process();
 
+   /*事件循环把请求交给线程池之前调用，expire 是连接定时器的到期时间，0 表示没有定时器*/
+   void           start_work(time_t expire);
+
+   /*
+      连接超时或者客户端断开，事件循环要关闭连接时调用，
+      请求还在线程池中时只做取消标记并返回 false，由处理这个请求的线程关闭连接
+   */
+   bool           cancel();
+
    bool           read();
 
    bool           write();
 
    sockaddr_in*   get_address(){ return &m_address; }
 
-   void           initmysql_result(connection_pool* connPool);
+   bool           is_sse() const { return m_sse; }
+
+   /*响应是否已经全部发送*/
+   bool           write_done() const { return bytes_to_send <= 0; }
+
+   /*反向代理结束后，长连接重新开始接收请求*/
+   void           reset_conn();
+
+   const char*    sse_channel() const { return m_sse_channel; }
 
 private:
    void           init();
 
+   /*请求离开线程池，处理期间被取消时返回 false，调用方关闭连接*/
+   bool           finish_work();
+
    /*以下函数分别是解析对应的字段*/
    LINE_STATUS    parse_line();
    HTTP_CODE      parse_request_line(char* text);
@@ -253,22 +368,46 @@ private:
    /*处理请求*/
    HTTP_CODE      do_request();
 
-   void           unmap();
+   /*根据 m_url 找到要发送的文件并映射到内存*/
+   HTTP_CODE      map_file();
 
-   /*构造响应*/
-   bool           add_response(const char* format, ...);
+   /*登录和注册的入口，在请求范围的连接租用中调用 do_login 或 do_register*/
+   HTTP_CODE      do_db_route();
+
+   /*
+      把请求转到数据库通道，成功时返回 true，请求之后从 resume_request 继续
+      排队和查询期间只监听对端关闭，客户端断开时请求被取消
+   */
+   bool           defer_to_db_lane();
+
+   /*登录和注册，启用非阻塞数据库或者转到数据库通道时返回 DB_PENDING*/
+   HTTP_CODE      do_login();
+   HTTP_CODE      do_register();
+   HTTP_CODE      submit_register();
 
-   bool           add_status_line(int status, const char* title);
+   /*登录成功，创建会话并准备 Set-Cookie 头*/
+   void           start_session();
 
-   bool           add_headers(int content_length);
+   /*挂起请求，返回的回调在事件循环中执行*/
+   sql_callback   park(DB_STAGE stage);
 
-   bool           add_content_length(int content_length);
+   /*数据库结果到达后继续处理挂起的请求*/
+   HTTP_CODE      resume_request();
 
-   bool           add_content_type();
+   /*把请求序列化成转发给上游的格式*/
+   std::string    build_proxy_request();
 
-   bool           add_linger();
+   /*整理交给 FastCGI 应用的 CGI 参数*/
+   fastcgi_client::param_list
+                  build_fcgi_params();
+
+   void           unmap();
+
+   /*构造响应*/
+   bool           append(const char* data, int len);
 
-    bool           add_blank_line();
+   /*使用预先序列化的状态行模板，extra_headers 需要自带 \r\n*/
+   bool           add_head(int status, long content_length, const char* extra_headers = "");
 
    bool           add_content(const char* content);
 
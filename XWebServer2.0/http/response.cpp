@@ -0,0 +1,52 @@
+#include "response.h"
+
+#define STATUS_LINE(code, title)    "HTTP/1.1 " #code " " title "\r\n"
+#define STATUS_ENTRY(code, title) \
+   { code, \
+     STATUS_LINE(code, title) "Connection:keep-alive\r\n", \
+     sizeof(STATUS_LINE(code, title) "Connection:keep-alive\r\n") - 1, \
+     STATUS_LINE(code, title) "Connection:close\r\n", \
+     sizeof(STATUS_LINE(code, title) "Connection:close\r\n") - 1 }
+
+static const status_block status_blocks[] =
+{
+   STATUS_ENTRY(200, "OK"),
+   STATUS_ENTRY(204, "No Content"),
+   STATUS_ENTRY(304, "Not Modified"),
+   STATUS_ENTRY(400, "Bad Request"),
+   STATUS_ENTRY(403, "Forbidden"),
+   STATUS_ENTRY(404, "Not Found"),
+   STATUS_ENTRY(500, "Internal Error"),
+   STATUS_ENTRY(502, "Bad Gateway"),
+   STATUS_ENTRY(503, "Service Unavailable"),
+   STATUS_ENTRY(504, "Gateway Timeout"),
+};
+
+const status_block* find_status_block(int status)
+{
+   for (const status_block& block : status_blocks)
+   {
+      if ( block.status == status )
+         return &block;
+   }
+   return NULL;
+}
+
+char              http_date::m_slots[DATE_SLOTS][DATE_LEN + 1];
+std::atomic<int>  http_date::m_cur(0);
+time_t            http_date::m_last = 0;
+
+void http_date::refresh()
+{
+   time_t now = time(NULL);
+   if ( now == m_last )
+      return;
+   m_last = now;
+
+   struct tm gmt;
+   gmtime_r(&now, &gmt);
+
+   int next = (m_cur.load(std::memory_order_relaxed) + 1) % DATE_SLOTS;
+   strftime(m_slots[next], DATE_LEN + 1, "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &gmt);
+   m_cur.store(next, std::memory_order_release);
+}
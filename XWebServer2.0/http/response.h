@@ -0,0 +1,67 @@
+/*
+   预先序列化的响应头
+   1、常用状态码的状态行和 Connection 头在编译期就拼好，长连接和短连接各一份
+   2、Date 头每秒由定时器刷新一次，构造响应时直接拷贝
+   3、Content-Length 用手写的整数转换，不经过 vsnprintf
+*/
+
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <atomic>
+#include <string.h>
+#include <time.h>
+
+/*状态行 + Connection 头*/
+struct status_block
+{
+   int            status;
+   const char*    keep_alive;
+   int            keep_alive_len;
+   const char*    close;
+   int            close_len;
+};
+
+/*找不到对应的状态码返回 NULL*/
+const status_block* find_status_block(int status);
+
+/*
+   Date 头缓存
+   定时器在主线程里写，工作线程只读；使用多个槽位轮换，
+   读者拿到的槽位至少要过 DATE_SLOTS - 1 秒才会被改写
+*/
+class http_date
+{
+public:
+   static const int DATE_LEN   = 37;          //"Date: Mon, 19 Oct 2026 08:00:00 GMT\r\n"
+   static const int DATE_SLOTS = 4;
+
+private:
+   static char             m_slots[DATE_SLOTS][DATE_LEN + 1];
+   static std::atomic<int> m_cur;
+   static time_t           m_last;
+
+public:
+   /*时间变化了才重新格式化*/
+   static void             refresh();
+
+   static const char*      get() { return m_slots[m_cur.load(std::memory_order_acquire)]; }
+};
+
+/*把无符号整数写到 buf 中，返回写入的长度，buf 至少 20 字节*/
+inline int format_uint(char* buf, unsigned long value)
+{
+   char tmp[20];
+   int  n = 0;
+   do
+   {
+      tmp[n++] = '0' + value % 10;
+      value /= 10;
+   } while ( value );
+
+   for (int i = 0; i < n; ++i)
+      buf[i] = tmp[n - 1 - i];
+   return n;
+}
+
+#endif
@@ -5,7 +5,7 @@
 #include <utility>
 #include "log.h"
 
-Log::Log() : m_count(0), m_is_async(false), m_stop(false)
+Log::Log() : m_count(0), m_fp(NULL), m_buf(NULL), m_log_queue(NULL), m_dropped(0), m_is_async(false)
 {
 
 }
@@ -15,7 +15,7 @@ Log::~Log()
    /*日志类被销毁时，需要等待异步写完成才能销毁*/
    if( async_write.joinable() )
    {
-      m_stop = true;
+      m_log_queue->close();
       async_write.join();
    }
 
@@ -43,7 +43,7 @@ bool Log::init(const char* file_name, int close_log, int log_buf_size,
    if ( is_async )
    {
       m_is_async = is_async;
-      m_log_queue = new thread_safe_queue<std::string>();
+      m_log_queue = new mpmc_ring<std::string>(QUEUE_SIZE);
 
       //flush_log_thread为回调函数,这里表示创建线程异步写日志
       async_write = std::move(std::thread(flush_log_thread));
@@ -163,18 +163,23 @@ void Log::write_log(int level, const char *format, ...)
 
    lk.unlock();
 
-   /*如果设置了异步标志，则直接将任务放进队列中*/
-   if ( m_is_async )
-   {
-      m_log_queue->push(log_str);
-   }
-   /*否则就在本线程将日志处理*/
-   else
+   /*同步写直接写文件*/
+   if ( !m_is_async )
    {
       lk.lock();
       fputs(log_str.c_str(), m_fp);
       lk.unlock();
    }
+   /*
+      异步写放进队列，队列满了稍等写入线程，仍然放不进去就丢弃并计数，
+      不在本线程直接写，否则会排在队列中更早的日志前面
+   */
+   else if ( !m_log_queue->try_push(std::move(log_str)) &&
+             !m_log_queue->push_until(std::move(log_str), 
+                                      std::chrono::steady_clock::now() + std::chrono::milliseconds((int)PUSH_WAIT_MS)) )
+   {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+   }
 
    va_end(valst);
 }
@@ -4,17 +4,24 @@
 /*
    日志类（全局只允许一个实例）
    利用线程安全的队列将日志写入文件中
-   支持同步写和异步写
+   支持同步写和异步写，异步写的队列是有界的环形队列，满了以后最多等 PUSH_WAIT_MS，
+   仍然放不进去就丢弃这一行并计数，写入线程在下一行之前写一条丢弃了多少行的说明，文件中的顺序不会乱
 */
 
 #include <stdio.h>
 #include <string>
 #include <stdarg.h>
 #include <thread>
-#include "../thread_safe_queue/thread_safe_queue.h"
+#include <mutex>
+#include <atomic>
+#include "../thread_safe_queue/mpmc_ring.h"
 
 class Log
 {
+public:
+   static const int QUEUE_SIZE = 8192;          //异步写日志的队列容量
+   static const int PUSH_WAIT_MS = 10;          //队列满时最多等待的时间
+
 private:
    char        dir_name[128];             //路径名
    char        log_name[128];             //log文件名
@@ -26,10 +33,11 @@ private:
    char*       m_buf;                     //日志缓冲区
    std::mutex  m_mutex;                   //互斥锁
 
-   thread_safe_queue<std::string>*        
+   mpmc_ring<std::string>*
                m_log_queue;               //阻塞队列
    std::thread async_write;               //开启异步操作后的线程
-   bool        m_stop;                    //是否关闭异步写线程
+   std::atomic<unsigned long>
+               m_dropped;                 //队列满丢弃的行数，由写入线程写出后清零
 
    bool        m_is_async;                //是否开启异步写日志操作
    int         m_close_log;               //是否关闭日志
@@ -63,33 +71,31 @@ private:
    Log();
    virtual ~Log();
 
+   /*有丢弃的行时写一条说明，调用时持有 m_mutex*/
+   void write_dropped()
+   {
+      unsigned long dropped = m_dropped.exchange(0);
+      if ( dropped > 0 )
+         fprintf(m_fp, "[warn]: log queue full, %lu lines dropped\n", dropped);
+   }
+
    /*异步写操作*/
    void async_write_log()
    {
       std::string single_log;
       /*
-         从阻塞队列中取出一个日志string，写入文件
-         如果日志实例还存在并且队列里还有任务要写，就全部写完再关闭线程
+         从阻塞队列中取出一个日志string，写入文件，队列空时阻塞等待
+         日志实例销毁时关闭队列，队列里剩下的日志全部写完再退出线程
       */
-      while ( !m_stop || !m_log_queue->empty() )
+      while ( m_log_queue->wait_and_pop(single_log) )
       {
-         /*
-            这里的判断非常重要，如果没有这个判断可能会导致死锁
-            死锁原因：
-               如果m_stop进了，同时调用了m_log_queue->wait_and_pop(single_log);
-               这个时候外面的 write 没办法获得锁向队列添加任务，导致死锁
-         */
-         if( !m_log_queue->empty() )
-            m_log_queue->wait_and_pop(single_log);
-         else 
-            continue;
-
-         {
-            std::lock_guard<std::mutex> lk(m_mutex);
-            fputs(single_log.c_str(), m_fp);
-         }
-
+         std::lock_guard<std::mutex> lk(m_mutex);
+         write_dropped();
+         fputs(single_log.c_str(), m_fp);
       }
+
+      std::lock_guard<std::mutex> lk(m_mutex);
+      write_dropped();
    }
 
 };
@@ -7,6 +7,9 @@ int main(int argc, char *argv[])
    std::string passwd = "root";
    std::string databasename = "X_server";
 
+   //从这里开始计算启动耗时
+   startup::get_instance();
+
    //命令行解析
    Config config;
    config.parse_arg(argc, argv);
@@ -16,27 +19,54 @@ int main(int argc, char *argv[])
    //初始化
    server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                config.OPT_LINGER, config.TRIGMode, config.sql_num, config.thread_num, 
-               config.close_log);
-   
+               config.close_log, config.vhost_file, config.proxy_file,
+               config.fcgi_file, config.reg_window, config.reg_batch, config.sql_local,
+               config.sql_min, config.user_store, config.session_ttl,
+               config.snapshot_interval, config.query_cache_mb, config.replicas,
+               config.lookup_window);
+
 
    //日志
-   server.set_log();
+   {
+      startup_stage stage("log");
+      server.set_log();
+   }
    printf("5...\n");
 
-   //数据库
-   server.set_sqlpool();
+   //虚拟主机、反向代理、FastCGI 只读取各自的配置文件，和数据库、线程池互不依赖，放在另一个线程中同时初始化
+   std::thread config_thread([&server]
+   {
+      startup_stage stage("config");
+      server.set_vhost();
+      server.set_proxy();
+      server.set_fastcgi();
+   });
+
+   //数据库，连接在后台建立，用户缓存就绪之前登录和注册返回 503
+   {
+      startup_stage stage("sqlpool");
+      server.set_sqlpool();
+   }
    printf("4...\n");
 
    //线程池
-   server.set_threadpool();
+   {
+      startup_stage stage("threadpool");
+      server.set_threadpool();
+   }
    printf("3...\n");
 
    //触发模式
    server.set_trigmode();
    printf("2...\n");
 
-   //监听
-   server.eventListen();
+   //监听，静态资源需要的配置加载完就开始接受连接
+   config_thread.join();
+   {
+      startup_stage stage("listen");
+      server.eventListen();
+   }
+   startup::get_instance()->set_ready(startup::STAGE_STATIC);
    printf("start server...\n");
 
    //运行
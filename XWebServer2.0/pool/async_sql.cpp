@@ -0,0 +1,448 @@
+#include "async_sql.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/*连接断开的错误码，出现时关闭连接，由定时器重连*/
+static const unsigned int ERR_SERVER_GONE = 2006;
+static const unsigned int ERR_SERVER_LOST = 2013;
+
+async_sql::async_sql() : m_jobs(JOB_QUEUE_SIZE), m_eventfd(-1), m_epollfd(-1), m_close_log(0), m_port(0)
+{
+
+}
+
+async_sql::~async_sql()
+{
+   for (int i = 0; i < (int)m_conns.size(); ++i)
+   {
+      if ( m_conns[i].mysql )
+         mysql_close(m_conns[i].mysql);
+   }
+   if ( m_eventfd != -1 )
+   {
+      close(m_eventfd);
+   }
+}
+
+async_sql* async_sql::get_instance()
+{
+   static async_sql sql;
+   return &sql;
+}
+
+int async_sql::init(int epollfd, std::string url, std::string user, std::string passwd,
+                    std::string dbname, int port, int conn_num, int close_log)
+{
+   m_epollfd = epollfd;
+   m_close_log = close_log;
+   m_url = url;
+   m_user = user;
+   m_passwd = passwd;
+   m_dbname = dbname;
+   m_port = port;
+   m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+#ifdef ASYNC_SQL
+   m_conns.resize(conn_num);
+   for (int i = 0; i < conn_num; ++i)
+   {
+      m_conns[i].mysql = NULL;
+      m_conns[i].fd = -1;
+      m_conns[i].state = CONN_DEAD;
+      connect(i);
+   }
+#else
+   (void)conn_num;
+#endif
+   return m_eventfd;
+}
+
+void async_sql::notify()
+{
+   uint64_t one = 1;
+   ::write(m_eventfd, &one, sizeof(one));
+}
+
+void async_sql::query(std::string sql, std::vector<std::string> params, sql_callback callback)
+{
+   sql_job job;
+   job.sql = std::move(sql);
+   job.params = std::move(params);
+   job.callback = std::move(callback);
+   job.deadline = time(NULL) + SQL_TIMEOUT;
+   if ( m_jobs.try_push(std::move(job)) )
+   {
+      notify();
+      return;
+   }
+
+   /*事件循环积压太多，不再排队，和数据库不可用时一样让请求失败*/
+   sql_callback cb = std::move(job.callback);
+   post([cb]()
+   {
+      sql_result res = { ERR_SERVER_GONE, false, "" };
+      cb(res);
+   });
+}
+
+void async_sql::post(std::function<void()> task)
+{
+   m_tasks.push(std::move(task));
+   notify();
+}
+
+void async_sql::dispatch()
+{
+   uint64_t cnt = 0;
+   ::read(m_eventfd, &cnt, sizeof(cnt));
+
+   std::function<void()> task;
+   while ( m_tasks.try_pop(task) )
+      task();
+
+   sql_job job;
+   while ( m_jobs.try_pop(job) )
+   {
+      if ( m_conns.empty() )
+      {
+         sql_result res = { ERR_SERVER_GONE, false, "" };
+         job.callback(res);
+         continue;
+      }
+      m_pending.push_back(std::move(job));
+   }
+   schedule();
+}
+
+#ifdef ASYNC_SQL
+
+void async_sql::watch(int i, int status)
+{
+   async_conn& c = m_conns[i];
+   int fd = mysql_get_socket(c.mysql);
+
+   epoll_event event;
+   event.data.fd = fd;
+   event.events = 0;
+   if ( status & MYSQL_WAIT_READ )
+      event.events |= EPOLLIN;
+   if ( status & MYSQL_WAIT_WRITE )
+      event.events |= EPOLLOUT;
+   if ( status & MYSQL_WAIT_EXCEPT )
+      event.events |= EPOLLPRI;
+
+   if ( fd == c.fd )
+   {
+      epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event);
+      return;
+   }
+
+   if ( c.fd != -1 )
+   {
+      epoll_ctl(m_epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+      m_owners.erase(c.fd);
+   }
+   c.fd = fd;
+   m_owners[fd] = i;
+   epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void async_sql::connect(int i)
+{
+   async_conn& c = m_conns[i];
+   c.mysql = mysql_init(NULL);
+   if ( c.mysql == NULL )
+   {
+      LOG_ERROR("async mysql init failed");
+      return;
+   }
+   mysql_options(c.mysql, MYSQL_OPT_NONBLOCK, 0);
+
+   c.state = CONN_CONNECTING;
+   c.deadline = time(NULL) + SQL_TIMEOUT;
+
+   MYSQL* ret = NULL;
+   int status = mysql_real_connect_start(&ret, c.mysql, m_url.c_str(), m_user.c_str(), m_passwd.c_str(),
+                                         m_dbname.c_str(), m_port, NULL, 0);
+   if ( status )
+   {
+      watch(i, status);
+      return;
+   }
+
+   if ( ret == NULL )
+   {
+      LOG_ERROR("async mysql connect failed: %s", mysql_error(c.mysql));
+      close_conn(i);
+      return;
+   }
+   c.state = CONN_IDLE;
+   watch(i, 0);
+}
+
+void async_sql::close_conn(int i)
+{
+   async_conn& c = m_conns[i];
+   if ( c.fd != -1 )
+   {
+      epoll_ctl(m_epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+      m_owners.erase(c.fd);
+      c.fd = -1;
+   }
+   if ( c.mysql )
+   {
+      mysql_close(c.mysql);
+      c.mysql = NULL;
+   }
+
+   bool busy = c.state == CONN_QUERYING || c.state == CONN_STORING;
+   c.state = CONN_DEAD;
+   if ( busy )
+   {
+      sql_job job = std::move(c.job);
+      c.job = sql_job();
+      sql_result res = { ERR_SERVER_LOST, false, "" };
+      job.callback(res);
+   }
+}
+
+void async_sql::schedule()
+{
+   for (int i = 0; i < (int)m_conns.size() && !m_pending.empty(); ++i)
+   {
+      if ( m_conns[i].state != CONN_IDLE )
+         continue;
+
+      m_conns[i].job = std::move(m_pending.front());
+      m_pending.pop_front();
+      start_query(i);
+   }
+}
+
+void async_sql::start_query(int i)
+{
+   async_conn& c = m_conns[i];
+   c.state = CONN_QUERYING;
+   c.deadline = c.job.deadline;
+   bind_params(i);
+
+   int err = 0;
+   int status = mysql_real_query_start(&err, c.mysql, c.job.sql.data(), c.job.sql.size());
+   if ( status )
+   {
+      watch(i, status);
+      return;
+   }
+   query_done(i, err);
+}
+
+void async_sql::bind_params(int i)
+{
+   async_conn& c = m_conns[i];
+   if ( c.job.params.empty() )
+      return;
+
+   std::string sql;
+   std::vector<char> escaped;
+   size_t next = 0;
+   for (char ch : c.job.sql)
+   {
+      if ( ch != '?' || next >= c.job.params.size() )
+      {
+         sql += ch;
+         continue;
+      }
+
+      const std::string& param = c.job.params[next++];
+      escaped.resize(param.size() * 2 + 1);
+      unsigned long len = mysql_real_escape_string(c.mysql, escaped.data(), param.data(), param.size());
+      sql += '\'';
+      sql.append(escaped.data(), len);
+      sql += '\'';
+   }
+   c.job.sql = std::move(sql);
+   c.job.params.clear();
+}
+
+/*查询语句发送完成，有结果集的话继续非阻塞地读取*/
+void async_sql::query_done(int i, int err)
+{
+   async_conn& c = m_conns[i];
+   if ( err )
+   {
+      finish(i, mysql_errno(c.mysql), NULL);
+      return;
+   }
+   if ( mysql_field_count(c.mysql) == 0 )
+   {
+      finish(i, 0, NULL);
+      return;
+   }
+
+   c.state = CONN_STORING;
+   MYSQL_RES* res = NULL;
+   int status = mysql_store_result_start(&res, c.mysql);
+   if ( status )
+   {
+      watch(i, status);
+      return;
+   }
+   finish(i, res ? 0 : mysql_errno(c.mysql), res);
+}
+
+void async_sql::step(int i, int status)
+{
+   async_conn& c = m_conns[i];
+   switch ( c.state )
+   {
+      case CONN_CONNECTING:
+      {
+         MYSQL* ret = NULL;
+         status = mysql_real_connect_cont(&ret, c.mysql, status);
+         if ( status )
+         {
+            watch(i, status);
+            return;
+         }
+         if ( ret == NULL )
+         {
+            LOG_ERROR("async mysql connect failed: %s", mysql_error(c.mysql));
+            close_conn(i);
+            return;
+         }
+         c.state = CONN_IDLE;
+         watch(i, 0);
+         schedule();
+         return;
+      }
+      case CONN_QUERYING:
+      {
+         int err = 0;
+         status = mysql_real_query_cont(&err, c.mysql, status);
+         if ( status )
+         {
+            watch(i, status);
+            return;
+         }
+         query_done(i, err);
+         return;
+      }
+      case CONN_STORING:
+      {
+         MYSQL_RES* res = NULL;
+         status = mysql_store_result_cont(&res, c.mysql, status);
+         if ( status )
+         {
+            watch(i, status);
+            return;
+         }
+         finish(i, res ? 0 : mysql_errno(c.mysql), res);
+         return;
+      }
+      default:
+         /*空闲的连接上有事件，说明数据库关闭了连接*/
+         LOG_ERROR("async mysql connection closed by server");
+         close_conn(i);
+         return;
+   }
+}
+
+void async_sql::finish(int i, unsigned int err, MYSQL_RES* res)
+{
+   async_conn& c = m_conns[i];
+
+   sql_result result = { err, false, "" };
+   if ( res )
+   {
+      MYSQL_ROW row = mysql_fetch_row(res);
+      if ( row )
+      {
+         unsigned long* lengths = mysql_fetch_lengths(res);
+         result.has_row = true;
+         if ( row[0] )
+            result.value.assign(row[0], lengths[0]);
+      }
+      mysql_free_result(res);
+   }
+
+   sql_job job = std::move(c.job);
+   c.job = sql_job();
+   c.state = CONN_IDLE;
+   if ( err == ERR_SERVER_GONE || err == ERR_SERVER_LOST )
+   {
+      LOG_ERROR("async mysql query failed: %s", mysql_error(c.mysql));
+      close_conn(i);
+   }
+   else
+   {
+      watch(i, 0);
+   }
+
+   job.callback(result);
+   schedule();
+}
+
+void async_sql::handle_event(int fd, uint32_t events)
+{
+   auto it = m_owners.find(fd);
+   if ( it == m_owners.end() )
+      return;
+
+   /*出错时按可读可写继续，由客户端库读出具体的错误*/
+   int status = 0;
+   if ( events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP) )
+      status |= MYSQL_WAIT_READ;
+   if ( events & (EPOLLOUT | EPOLLERR | EPOLLHUP) )
+      status |= MYSQL_WAIT_WRITE;
+   if ( events & EPOLLPRI )
+      status |= MYSQL_WAIT_EXCEPT;
+   step(it->second, status);
+}
+
+void async_sql::tick()
+{
+   time_t cur = time(NULL);
+
+   for (int i = 0; i < (int)m_conns.size(); ++i)
+   {
+      async_conn& c = m_conns[i];
+      if ( c.state == CONN_DEAD )
+      {
+         connect(i);
+      }
+      else if ( c.state != CONN_IDLE && c.deadline <= cur )
+      {
+         LOG_ERROR("async mysql connection %d timed out", i);
+         close_conn(i);
+      }
+   }
+
+   /*没有可用连接时排队的查询也会超时*/
+   while ( !m_pending.empty() && m_pending.front().deadline <= cur )
+   {
+      sql_job job = std::move(m_pending.front());
+      m_pending.pop_front();
+      sql_result res = { ERR_SERVER_LOST, false, "" };
+      job.callback(res);
+   }
+   schedule();
+}
+
+#else
+
+void async_sql::watch(int, int) {}
+void async_sql::connect(int) {}
+void async_sql::close_conn(int) {}
+void async_sql::schedule() {}
+void async_sql::start_query(int) {}
+void async_sql::bind_params(int) {}
+void async_sql::step(int, int) {}
+void async_sql::query_done(int, int) {}
+void async_sql::finish(int, unsigned int, MYSQL_RES*) {}
+void async_sql::handle_event(int, uint32_t) {}
+void async_sql::tick() {}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+   事件循环驱动的非阻塞数据库访问（全局只允许一个实例）
+   1、使用 MariaDB Connector/C 的非阻塞接口（*_start / *_cont），编译时需要定义 ASYNC_SQL，
+      make ASYNC_SQL=1 打开；没有定义时 enabled() 返回 false，请求仍然在工作线程中同步访问数据库
+   2、事件循环持有若干个非阻塞连接，连接的 socket 注册在 epoll 中，一次查询分成多步，
+      每一步等待的读写事件就绪后再继续，少量线程就可以同时进行大量查询
+   3、工作线程提交 SQL 后不再等待，请求挂起，结果到达后在事件循环中调用回调，
+      由回调把请求重新交给线程池
+   4、post 可以让其它线程把一个函数交给事件循环执行
+   5、提交的查询放在有界的环形队列中，队列满时查询直接以 2006（server gone）失败，
+      回调仍然在事件循环中执行
+*/
+
+#ifndef ASYNC_SQL_H
+#define ASYNC_SQL_H
+
+#include <mysql/mysql.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+#include "../thread_safe_queue/thread_safe_queue.h"
+#include "../thread_safe_queue/mpmc_ring.h"
+#include "../log/log.h"
+
+/*查询结果，只保留第一行第一列，够登录和注册使用*/
+struct sql_result
+{
+   unsigned int      err;           //0 表示成功，否则为 MySQL 错误码
+   bool              has_row;
+   std::string       value;
+};
+
+typedef std::function<void(sql_result&)> sql_callback;
+
+class async_sql
+{
+public:
+   /*单个查询的超时时间（秒），加上定时器的间隔仍小于连接的空闲超时，挂起的请求总能先得到结果*/
+   static const int SQL_TIMEOUT        = 5;
+
+   /*还没有被事件循环取走的查询的上限*/
+   static const int JOB_QUEUE_SIZE     = 4096;
+
+private:
+   enum CONN_STATE
+   {
+      CONN_DEAD = 0,                   //断开，定时器触发时重连
+      CONN_CONNECTING,
+      CONN_IDLE,
+      CONN_QUERYING,
+      CONN_STORING
+   };
+
+   struct sql_job
+   {
+      std::string       sql;
+      std::vector<std::string>
+                        params;
+      sql_callback      callback;
+      time_t            deadline;
+   };
+
+   struct async_conn
+   {
+      MYSQL*            mysql;
+      int               fd;
+      CONN_STATE        state;
+      sql_job           job;
+      time_t            deadline;
+   };
+
+   std::vector<async_conn>    m_conns;
+   std::unordered_map<int, int>
+                              m_owners;      //socket -> 连接下标
+   std::deque<sql_job>        m_pending;     //等待空闲连接的查询
+   mpmc_ring<sql_job>         m_jobs;
+   thread_safe_queue<std::function<void()>>
+                              m_tasks;
+   int                        m_eventfd;
+   int                        m_epollfd;
+   int                        m_close_log;
+
+   std::string                m_url;
+   std::string                m_user;
+   std::string                m_passwd;
+   std::string                m_dbname;
+   int                        m_port;
+
+private:
+   async_sql();
+   ~async_sql();
+
+   void              notify();
+
+   /*按 MySQL 等待的事件（MYSQL_WAIT_*）注册 epoll，重连后 socket 会变化*/
+   void              watch(int i, int status);
+   void              connect(int i);
+
+   /*关闭连接，正在进行的查询以 CR_SERVER_LOST 结束*/
+   void              close_conn(int i);
+
+   /*把排队的查询分配给空闲的连接*/
+   void              schedule();
+   void              start_query(int i);
+
+   /*把查询中的占位符替换成转义后的参数*/
+   void              bind_params(int i);
+
+   /*按连接当前的状态继续执行，status 为就绪的事件*/
+   void              step(int i, int status);
+   void              query_done(int i, int err);
+   void              finish(int i, unsigned int err, MYSQL_RES* res);
+
+public:
+   static async_sql* get_instance();
+
+   /*
+      建立 conn_num 个非阻塞连接，返回 eventfd，需要由事件循环注册到 epoll 中
+      没有定义 ASYNC_SQL 时不建立连接，只有 post 可用
+   */
+   int               init(int epollfd, std::string url, std::string user, std::string passwd,
+                          std::string dbname, int port, int conn_num, int close_log);
+
+   bool              enabled() const { return !m_conns.empty(); }
+
+   /*
+      工作线程调用，回调在事件循环所在的线程执行
+      sql 中的 ? 依次替换为 params 中的值，值在执行它的连接上用 mysql_real_escape_string 转义
+      后放在单引号中，遵循连接的字符集和 NO_BACKSLASH_ESCAPES
+   */
+   void              query(std::string sql, std::vector<std::string> params, sql_callback callback);
+   void              post(std::function<void()> task);
+
+   /*以下函数只能在事件循环所在的线程调用*/
+   bool              owns(int fd) const { return m_owners.find(fd) != m_owners.end(); }
+   void              dispatch();
+   void              handle_event(int fd, uint32_t events);
+
+   /*定时器触发时调用：超时处理和重连*/
+   void              tick();
+};
+
+#endif
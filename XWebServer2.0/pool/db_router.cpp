@@ -0,0 +1,308 @@
+#include "db_router.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+db_router::db_router() :
+   m_primary(NULL),
+   m_write_count(0),
+   m_stop(false),
+   m_close_log(0),
+   m_primary_reads(0),
+   m_ryw_reads(0)
+{
+
+}
+
+db_router::~db_router()
+{
+   destroy();
+}
+
+db_router* db_router::get_instance()
+{
+   static db_router router;
+   return &router;
+}
+
+void db_router::init(connection_pool* primary, const std::string& replicas,
+                     std::string user, std::string passwd, std::string db_name,
+                     int max_conn, int min_conn, int close_log)
+{
+   m_primary = primary;
+   m_close_log = close_log;
+
+   size_t begin = 0;
+   while ( begin < replicas.size() )
+   {
+      size_t end = replicas.find(',', begin);
+      if ( end == std::string::npos )
+         end = replicas.size();
+      std::string addr = replicas.substr(begin, end - begin);
+      begin = end + 1;
+      if ( addr.empty() )
+         continue;
+
+      size_t colon = addr.rfind(':');
+      std::string host = colon == std::string::npos ? addr : addr.substr(0, colon);
+      int port = colon == std::string::npos ? 3306 : atoi(addr.c_str() + colon + 1);
+
+      replica* r = new replica;
+      r->name = host + ":" + std::to_string(port);
+      r->pool = new connection_pool;
+      r->up = false;
+      r->lag = -1;
+      r->latency_us = 0;
+      r->reads = 0;
+      r->pool->init(host, user, passwd, db_name, port, max_conn, close_log, 0, min_conn);
+      m_replicas.push_back(r);
+      LOG_INFO("read replica %s", r->name.c_str());
+   }
+
+   if ( !m_replicas.empty() )
+      m_monitor = std::thread(&db_router::monitor, this);
+}
+
+void db_router::destroy()
+{
+   {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_stop = true;
+   }
+   m_cond.notify_all();
+   if ( m_monitor.joinable() )
+      m_monitor.join();
+
+   for (replica* r : m_replicas)
+   {
+      delete r->pool;
+      delete r;
+   }
+   m_replicas.clear();
+}
+
+db_router::write_shard& db_router::get_shard(const std::string& key)
+{
+   return m_writes[std::hash<std::string>()(key) % SHARD_NUM];
+}
+
+time_t db_router::written_at(const std::string& key)
+{
+   if ( key.empty() || m_write_count.load(std::memory_order_relaxed) == 0 )
+      return 0;
+
+   write_shard& s = get_shard(key);
+   std::lock_guard<std::mutex> lk(s.mutex);
+   auto it = s.writes.find(key);
+   return it == s.writes.end() ? 0 : it->second;
+}
+
+void db_router::wrote(const std::string& key)
+{
+   if ( m_replicas.empty() || key.empty() )
+      return;
+
+   write_shard& s = get_shard(key);
+   std::lock_guard<std::mutex> lk(s.mutex);
+   if ( s.writes.insert_or_assign(key, time(NULL)).second )
+      m_write_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+   复制延迟按秒计，写入之后经过的时间不超过延迟时从库可能还没有这次写入，
+   同一秒内的写入在延迟为 0 的从库上也不读，只读主库
+*/
+connection_pool* db_router::reader(const std::string& key)
+{
+   if ( m_replicas.empty() )
+      return m_primary;
+
+   time_t written = written_at(key);
+   time_t now = time(NULL);
+
+   replica* best = NULL;
+   double best_score = 0;
+   bool skipped = false;
+   for (replica* r : m_replicas)
+   {
+      int lag = r->lag.load(std::memory_order_relaxed);
+      if ( !r->up.load(std::memory_order_relaxed) || lag < 0 || lag > MAX_LAG )
+         continue;
+
+      if ( written != 0 && now - written <= lag )
+      {
+         skipped = true;
+         continue;
+      }
+
+      double score = (double)(r->latency_us.load(std::memory_order_relaxed) + 1) *
+                     (r->pool->GetUsedConn() + 1);
+      if ( best == NULL || score < best_score )
+      {
+         best = r;
+         best_score = score;
+      }
+   }
+
+   if ( best == NULL )
+   {
+      m_primary_reads.fetch_add(1, std::memory_order_relaxed);
+      if ( skipped )
+         m_ryw_reads.fetch_add(1, std::memory_order_relaxed);
+      return m_primary;
+   }
+
+   best->reads.fetch_add(1, std::memory_order_relaxed);
+   return best->pool;
+}
+
+/*
+   先试 MySQL 8.0.22 之后的 SHOW REPLICA STATUS，再试旧的 SHOW SLAVE STATUS，
+   结果为空说明这个实例没有配置复制（比如测试时用的独立实例），按没有延迟处理，
+   复制线程停止时延迟列为 NULL，按未知处理
+*/
+static int query_lag(MYSQL* mysql)
+{
+   if ( mysql_query(mysql, "SHOW REPLICA STATUS") && mysql_query(mysql, "SHOW SLAVE STATUS") )
+      return -1;
+
+   MYSQL_RES* result = mysql_store_result(mysql);
+   if ( result == NULL )
+      return -1;
+
+   int lag = 0;
+   MYSQL_ROW row = mysql_fetch_row(result);
+   if ( row != NULL )
+   {
+      lag = -1;
+      unsigned int num = mysql_num_fields(result);
+      MYSQL_FIELD* fields = mysql_fetch_fields(result);
+      for (unsigned int i = 0; i < num; ++i)
+      {
+         if ( strcmp(fields[i].name, "Seconds_Behind_Source") == 0 ||
+              strcmp(fields[i].name, "Seconds_Behind_Master") == 0 )
+         {
+            if ( row[i] != NULL )
+               lag = atoi(row[i]);
+            break;
+         }
+      }
+   }
+   mysql_free_result(result);
+   return lag;
+}
+
+void db_router::check(replica* r)
+{
+   MYSQL* mysql = r->pool->GetConnection(CHECK_WAIT_MS);
+   if ( mysql == NULL )
+   {
+      r->up = false;
+      return;
+   }
+
+   auto start = std::chrono::steady_clock::now();
+   bool alive = mysql_ping(mysql) == 0;
+   long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+   if ( !alive )
+   {
+      LOG_ERROR("replica %s ping error:%s", r->name.c_str(), mysql_error(mysql));
+      r->pool->ReleaseConnection(mysql);
+      r->up = false;
+      return;
+   }
+
+   //滑动平均，新的一次占 1/4，第一次直接使用
+   long old = r->latency_us.load(std::memory_order_relaxed);
+   r->latency_us = old == 0 ? us : (old * 3 + us) / 4;
+
+   int lag = query_lag(mysql);
+   r->pool->ReleaseConnection(mysql);
+   if ( lag < 0 )
+   {
+      LOG_ERROR("replica %s lag unknown", r->name.c_str());
+   }
+   else if ( lag > MAX_LAG )
+   {
+      LOG_ERROR("replica %s lags %d seconds", r->name.c_str(), lag);
+   }
+
+   r->lag = lag;
+   r->up = true;
+}
+
+void db_router::prune()
+{
+   time_t expire = time(NULL) - MAX_LAG;
+   for (int i = 0; i < SHARD_NUM; ++i)
+   {
+      std::lock_guard<std::mutex> lk(m_writes[i].mutex);
+      auto& writes = m_writes[i].writes;
+      for (auto it = writes.begin(); it != writes.end(); )
+      {
+         if ( it->second < expire )
+         {
+            it = writes.erase(it);
+            m_write_count.fetch_sub(1, std::memory_order_relaxed);
+         }
+         else
+         {
+            ++it;
+         }
+      }
+   }
+}
+
+/*后台线程，每隔 CHECK_INTERVAL 秒检查所有从库并清理过期的写入记录*/
+void db_router::monitor()
+{
+   std::unique_lock<std::mutex> lk(m_mutex);
+   while ( !m_stop )
+   {
+      lk.unlock();
+      for (replica* r : m_replicas)
+      {
+         check(r);
+      }
+      prune();
+      lk.lock();
+
+      m_cond.wait_for(lk, std::chrono::seconds((int)CHECK_INTERVAL), [this] { return m_stop; });
+   }
+}
+
+void db_router::report(std::string& out)
+{
+   char buf[512];
+   int len = snprintf(buf, sizeof(buf),
+                      "db_router_replicas %lu\n"
+                      "db_router_primary_reads %lu\n"
+                      "db_router_read_your_writes %lu\n"
+                      "db_router_recent_writes %d\n",
+                      (unsigned long)m_replicas.size(),
+                      m_primary_reads.load(std::memory_order_relaxed),
+                      m_ryw_reads.load(std::memory_order_relaxed),
+                      m_write_count.load(std::memory_order_relaxed));
+   out.append(buf, len);
+
+   for (replica* r : m_replicas)
+   {
+      const char* name = r->name.c_str();
+      len = snprintf(buf, sizeof(buf),
+                     "db_replica_up{replica=\"%s\"} %d\n"
+                     "db_replica_lag_seconds{replica=\"%s\"} %d\n"
+                     "db_replica_latency_seconds{replica=\"%s\"} %.6f\n"
+                     "db_replica_in_use{replica=\"%s\"} %d\n"
+                     "db_replica_reads{replica=\"%s\"} %lu\n",
+                     name, r->up.load() ? 1 : 0,
+                     name, r->lag.load(),
+                     name, r->latency_us.load() / 1e6,
+                     name, r->pool->GetUsedConn(),
+                     name, r->reads.load(std::memory_order_relaxed));
+      out.append(buf, len);
+   }
+}
@@ -0,0 +1,111 @@
+/*
+   读写分离（全局只允许一个实例），写入走主库的连接池，读取分散到多个从库的连接池
+   1、每个从库有自己的 connection_pool，后台线程定时 ping 每个从库并查询复制延迟，
+      连不上、延迟未知或者超过 MAX_LAG 的从库不参与读取
+   2、读取时在可用的从库中选预期延迟最小的：ping 延迟的滑动平均乘以（正在使用的连接数 + 1），
+      延迟最低的从库忙起来后请求自然分到其它从库
+   3、读己之写：写入后记下键（比如用户名）和写入时间，写入之后经过的时间不超过某个从库的复制延迟时，
+      这个从库可能还没有这次写入，读这个键时不选它；没有合适的从库时读主库
+   没有配置从库时读写都走主库
+*/
+
+#ifndef DB_ROUTER_H
+#define DB_ROUTER_H
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+
+#include "sqlconn_pool.h"
+
+class db_router
+{
+public:
+   static const int MAX_LAG         = 5;        //从库允许的最大复制延迟（秒）
+   static const int CHECK_INTERVAL  = 1;        //检查从库的间隔（秒）
+   static const int CHECK_WAIT_MS   = 200;      //检查时取连接最多等待的时间（毫秒）
+   static const int SHARD_NUM       = 16;
+
+private:
+   struct replica
+   {
+      std::string                   name;       //主机:端口
+      connection_pool*              pool;
+      std::atomic<bool>             up;
+      std::atomic<int>              lag;        //复制延迟（秒），-1 表示未知
+      std::atomic<long>             latency_us; //ping 延迟的滑动平均（微秒）
+      std::atomic<unsigned long>    reads;
+   };
+
+   /*最近写入的键，超过 MAX_LAG 秒的由后台线程清理*/
+   struct write_shard
+   {
+      std::mutex                             mutex;
+      std::unordered_map<std::string, time_t> writes;
+   };
+
+   connection_pool*        m_primary;
+   std::vector<replica*>   m_replicas;
+   write_shard             m_writes[SHARD_NUM];
+   std::atomic<int>        m_write_count;       //所有分片中的键数，为 0 时读取不用加锁
+
+   std::thread             m_monitor;
+   bool                    m_stop;
+   std::mutex              m_mutex;
+   std::condition_variable m_cond;
+
+   int                     m_close_log;
+
+   /*统计信息*/
+   std::atomic<unsigned long>    m_primary_reads;
+   std::atomic<unsigned long>    m_ryw_reads;   //因为读己之写而没有读从库的次数
+
+private:
+   db_router();
+   ~db_router();
+
+   write_shard&            get_shard(const std::string& key);
+
+   /*key 最近一次写入的时间，没有记录时返回 0*/
+   time_t                  written_at(const std::string& key);
+
+   /*ping 一个从库并查询复制延迟*/
+   void                    check(replica* r);
+
+   void                    monitor();
+
+   /*清理超过 MAX_LAG 秒的写入记录*/
+   void                    prune();
+
+public:
+   static db_router*       get_instance();
+
+   /*
+      primary 是已经初始化的主库连接池，replicas 是逗号分隔的 主机:端口 列表，
+      每个从库用和主库相同的账号建立 max_conn 个以内的连接
+   */
+   void                    init(connection_pool* primary, const std::string& replicas,
+                                std::string user, std::string passwd, std::string db_name,
+                                int max_conn, int min_conn, int close_log);
+
+   /*停止后台线程，销毁从库的连接池*/
+   void                    destroy();
+
+   connection_pool*        primary() { return m_primary; }
+
+   /*读取 key 时使用的连接池，key 为空表示不需要读己之写*/
+   connection_pool*        reader(const std::string& key = "");
+
+   /*写入 key 成功后调用，之后一段时间内读取 key 时避开还没追上的从库*/
+   void                    wrote(const std::string& key);
+
+   /*以 Prometheus 文本格式追加统计*/
+   void                    report(std::string& out);
+};
+
+#endif
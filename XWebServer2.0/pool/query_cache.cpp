@@ -0,0 +1,247 @@
+#include "query_cache.h"
+
+#include <stdio.h>
+
+query_cache::query_cache() :
+   m_shard_budget(0),
+   m_hits(0),
+   m_misses(0),
+   m_collapsed(0),
+   m_evictions(0),
+   m_invalidations(0)
+{
+
+}
+
+query_cache* query_cache::get_instance()
+{
+   static query_cache cache;
+   return &cache;
+}
+
+void query_cache::init(size_t budget)
+{
+   m_shard_budget = budget / SHARD_NUM;
+   if ( budget != 0 && m_shard_budget == 0 )
+      m_shard_budget = 1;
+}
+
+query_cache::shard& query_cache::get_shard(const std::string& key)
+{
+   return m_shards[std::hash<std::string>()(key) % SHARD_NUM];
+}
+
+std::string query_cache::make_key(const char* stmt, std::initializer_list<std::string> params)
+{
+   std::string key(stmt);
+   for (const std::string& p : params)
+   {
+      key += '\0';
+      key += std::to_string(p.size());
+      key += ':';
+      key += p;
+   }
+   return key;
+}
+
+/*字符串本身加上 std::string 和 vector 的大致开销*/
+size_t query_cache::result_bytes(const result& res)
+{
+   size_t bytes = sizeof(result);
+   for (auto& row : res)
+   {
+      bytes += sizeof(row);
+      for (auto& field : row)
+      {
+         bytes += sizeof(field) + field.size();
+      }
+   }
+   return bytes;
+}
+
+void query_cache::erase(shard& s, std::list<entry>::iterator it)
+{
+   s.bytes -= it->bytes;
+   s.index.erase(it->key);
+   s.lru.erase(it);
+}
+
+void query_cache::evict(shard& s)
+{
+   while ( s.bytes > m_shard_budget && !s.lru.empty() )
+   {
+      erase(s, std::prev(s.lru.end()));
+      m_evictions.fetch_add(1, std::memory_order_relaxed);
+   }
+}
+
+query_cache::result_ptr query_cache::get(const std::string& key, const char* tag, const loader& load,
+                                         std::chrono::steady_clock::time_point deadline)
+{
+   if ( !enabled() )
+   {
+      std::unique_ptr<result> res(new result);
+      if ( load(*res) < 0 )
+         return NULL;
+      return result_ptr(res.release());
+   }
+
+   shard& s = get_shard(key);
+   std::unique_lock<std::mutex> lk(s.mutex);
+
+   while ( true )
+   {
+      auto it = s.index.find(key);
+      if ( it != s.index.end() )
+      {
+         if ( it->second->expire > time(NULL) )
+         {
+            s.lru.splice(s.lru.begin(), s.lru, it->second);
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second->value;
+         }
+         erase(s, it->second);
+      }
+
+      /*没有线程在查同一个键，由这个线程去查*/
+      auto f = s.flights.find(key);
+      if ( f == s.flights.end() )
+         break;
+
+      /*等它的结果，最多等到自己的截止时间*/
+      std::shared_ptr<flight> fl = f->second;
+      m_collapsed.fetch_add(1, std::memory_order_relaxed);
+      auto done = [&fl] { return fl->done; };
+      if ( deadline == std::chrono::steady_clock::time_point::max() )
+         fl->cond.wait(lk, done);
+      else if ( !fl->cond.wait_until(lk, deadline, done) )
+         return NULL;
+
+      /*它的请求超时或被取消了，失败和这个请求无关，重新查缓存或者自己去查*/
+      if ( !fl->aborted )
+         return fl->value;
+   }
+
+   std::shared_ptr<flight> fl = std::make_shared<flight>();
+   fl->tag = tag;
+   s.flights.emplace(key, fl);
+   m_misses.fetch_add(1, std::memory_order_relaxed);
+   lk.unlock();
+
+   /*load 抛出异常时同样结束这次查询，等待的线程得到空结果，否则它们永远等不到 done*/
+   struct flight_guard
+   {
+      shard&                     s;
+      const std::string&         key;
+      std::shared_ptr<flight>&   fl;
+      bool                       armed;
+
+      ~flight_guard()
+      {
+         if ( !armed )
+            return;
+         std::lock_guard<std::mutex> lk(s.mutex);
+         s.flights.erase(key);
+         fl->done = true;
+         fl->cond.notify_all();
+      }
+   } guard = { s, key, fl, true };
+
+   std::unique_ptr<result> res(new result);
+   int ttl = load(*res);
+   result_ptr value;
+   if ( ttl >= 0 )
+      value.reset(res.release());
+
+   lk.lock();
+   guard.armed = false;
+   s.flights.erase(key);
+   if ( ttl > 0 && !fl->stale )
+   {
+      entry e = { key, tag, value, time(NULL) + ttl, key.size() * 2 + result_bytes(*value) };
+      s.lru.push_front(e);
+      s.index[key] = s.lru.begin();
+      s.bytes += e.bytes;
+      evict(s);
+   }
+
+   fl->value = value;
+   fl->aborted = ttl == LOAD_ABORTED;
+   fl->done = true;
+   fl->cond.notify_all();
+   return value;
+}
+
+void query_cache::invalidate(const std::string& key)
+{
+   if ( !enabled() )
+      return;
+
+   shard& s = get_shard(key);
+   std::lock_guard<std::mutex> lk(s.mutex);
+
+   auto it = s.index.find(key);
+   if ( it != s.index.end() )
+      erase(s, it->second);
+
+   auto f = s.flights.find(key);
+   if ( f != s.flights.end() )
+      f->second->stale = true;
+
+   m_invalidations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void query_cache::invalidate_tag(const std::string& tag)
+{
+   if ( !enabled() )
+      return;
+
+   for (int i = 0; i < SHARD_NUM; ++i)
+   {
+      shard& s = m_shards[i];
+      std::lock_guard<std::mutex> lk(s.mutex);
+      for (auto it = s.lru.begin(); it != s.lru.end(); )
+      {
+         auto next = std::next(it);
+         if ( it->tag == tag )
+            erase(s, it);
+         it = next;
+      }
+      for (auto& f : s.flights)
+      {
+         if ( f.second->tag == tag )
+            f.second->stale = true;
+      }
+   }
+   m_invalidations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void query_cache::report(std::string& out)
+{
+   size_t entries = 0, bytes = 0;
+   for (int i = 0; i < SHARD_NUM; ++i)
+   {
+      std::lock_guard<std::mutex> lk(m_shards[i].mutex);
+      entries += m_shards[i].index.size();
+      bytes += m_shards[i].bytes;
+   }
+
+   char buf[512];
+   int len = snprintf(buf, sizeof(buf),
+                      "query_cache_entries %lu\n"
+                      "query_cache_bytes %lu\n"
+                      "query_cache_budget_bytes %lu\n"
+                      "query_cache_hits %lu\n"
+                      "query_cache_misses %lu\n"
+                      "query_cache_collapsed %lu\n"
+                      "query_cache_evictions %lu\n"
+                      "query_cache_invalidations %lu\n",
+                      (unsigned long)entries, (unsigned long)bytes,
+                      (unsigned long)(m_shard_budget * SHARD_NUM),
+                      m_hits.load(std::memory_order_relaxed),
+                      m_misses.load(std::memory_order_relaxed),
+                      m_collapsed.load(std::memory_order_relaxed),
+                      m_evictions.load(std::memory_order_relaxed),
+                      m_invalidations.load(std::memory_order_relaxed));
+   out.append(buf, len);
+}
@@ -0,0 +1,131 @@
+/*
+   查询结果缓存（全局只允许一个实例），放在连接池前面，读多写少的查询先查这里
+   1、以语句加参数作为键，每一项有自己的有效期，由查询函数按结果决定（比如不存在的结果缓存得短一些）
+   2、按键哈希分片，每个分片一把锁、一条 LRU 链表，占用的内存超过预算时从最久没用的开始淘汰
+   3、同一个键同时没有命中时只有第一个线程查数据库，其它线程等它的结果，不会一起压到数据库上；
+      第一个线程的请求超时或被取消导致查询失败时，结果不交给其它线程，由它们重新查询
+   4、写路径（比如注册）调用 invalidate 删除受影响的项；查询进行中被失效的，结果照常返回但不缓存
+   预算为 0 时不启用，get 直接调用查询函数
+*/
+
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <initializer_list>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+class query_cache
+{
+public:
+   static const int SHARD_NUM = 16;
+
+   /*查询结果：若干行，每行若干列*/
+   typedef std::vector<std::vector<std::string>> result;
+   typedef std::shared_ptr<const result> result_ptr;
+
+   /*
+      查询函数，把结果写进 res
+      返回值大于 0 表示缓存的秒数，0 表示结果不缓存，小于 0 表示查询出错，
+      LOAD_ABORTED 表示是发起查询的请求自己超时或被取消了，数据库本身没有问题
+   */
+   typedef std::function<int(result& res)> loader;
+   static const int LOAD_ABORTED = -2;
+
+private:
+   struct entry
+   {
+      std::string    key;
+      std::string    tag;
+      result_ptr     value;
+      time_t         expire;
+      size_t         bytes;
+   };
+
+   /*正在查询的键，等待者在所在分片的锁上等待*/
+   struct flight
+   {
+      std::string             tag;
+      std::condition_variable cond;
+      bool                    done = false;
+      bool                    stale = false;    //查询期间被失效
+      bool                    aborted = false;  //查询函数返回 LOAD_ABORTED，等待者需要重新查询
+      result_ptr              value;
+   };
+
+   struct shard
+   {
+      std::mutex              mutex;
+      std::list<entry>        lru;              //最近使用的在前
+      std::unordered_map<std::string, std::list<entry>::iterator>
+                              index;
+      std::unordered_map<std::string, std::shared_ptr<flight>>
+                              flights;
+      size_t                  bytes = 0;
+   };
+
+   shard                m_shards[SHARD_NUM];
+   size_t               m_shard_budget;         //每个分片的内存预算（字节）
+
+   std::atomic<unsigned long>
+                        m_hits;
+   std::atomic<unsigned long>
+                        m_misses;
+   std::atomic<unsigned long>
+                        m_collapsed;            //等待其它线程结果的次数
+   std::atomic<unsigned long>
+                        m_evictions;
+   std::atomic<unsigned long>
+                        m_invalidations;
+
+private:
+   query_cache();
+   ~query_cache() {}
+
+   shard&               get_shard(const std::string& key);
+
+   /*调用时持有分片的锁*/
+   void                 erase(shard& s, std::list<entry>::iterator it);
+   void                 evict(shard& s);
+
+   static size_t        result_bytes(const result& res);
+
+public:
+   static query_cache*  get_instance();
+
+   /*budget 是总的内存预算（字节），0 表示不启用*/
+   void                 init(size_t budget);
+
+   bool                 enabled() const { return m_shard_budget != 0; }
+
+   /*由语句和参数拼成键，参数带长度前缀，不同的参数组合不会拼出同一个键*/
+   static std::string   make_key(const char* stmt, std::initializer_list<std::string> params);
+
+   /*
+      先查缓存，没有命中时调用 load，tag 一般是语句涉及的表，用于 invalidate_tag
+      查询出错时返回空指针，等待其它线程的结果超过 deadline 时也返回空指针
+   */
+   result_ptr           get(const std::string& key, const char* tag, const loader& load,
+                            std::chrono::steady_clock::time_point deadline = 
+                               std::chrono::steady_clock::time_point::max());
+
+   /*删除一个键，写路径在写入成功后调用*/
+   void                 invalidate(const std::string& key);
+
+   /*删除同一个 tag 下的全部项，需要遍历所有分片，只用于影响范围不好确定的写入*/
+   void                 invalidate_tag(const std::string& tag);
+
+   /*以 Prometheus 文本格式追加统计*/
+   void                 report(std::string& out);
+};
+
+#endif
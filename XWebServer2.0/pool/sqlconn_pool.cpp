@@ -1,7 +1,35 @@
 #include "sqlconn_pool.h"
 
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
 
-connection_pool::connection_pool() : m_MaxConn(0), m_CurConn(0), m_FreeConn(0)
+
+thread_local connection_pool::local_conns connection_pool::t_local;
+thread_local connection_pool::scope_state connection_pool::t_scope;
+
+connection_pool::connection_pool() : 
+	m_MaxConn(0), 
+	m_MinConn(0), 
+	m_TotalConn(0), 
+	m_CurConn(0), 
+	m_FreeConn(0), 
+	m_LocalConn(0), 
+	m_RetryAt(0), 
+	m_Backoff(0), 
+	m_Stop(false), 
+	m_Waits(0), 
+	m_WaitTimeouts(0), 
+	m_WaitUs(0), 
+	m_WaitBuckets(), 
+	m_Created(0), 
+	m_Closed(0), 
+	m_PingFailures(0), 
+	m_ScopeReuses(0), 
+	m_DeadlineRejects(0), 
+	m_Kills(0), 
+	m_CallStop(false), 
+	m_KillConn(NULL)
 {
 	
 }
@@ -19,84 +47,574 @@ connection_pool* connection_pool::GetInstance()
 
 //构造初始化
 void connection_pool::init(std::string Url, std::string User, std::string PassWord, 
-						std::string DataBaseName, int Port, int MaxConn, int Close_Log)
+						std::string DataBaseName, int Port, int MaxConn, int Close_Log,
+						int LocalConn, int MinConn)
 {
    m_Url = Url;
    m_User = User;
    m_PassWord = PassWord;
    m_DatabaseName = DataBaseName;
-   m_Port = Port;
-   m_MaxConn = MaxConn;
+   m_Port = std::to_string(Port);
+   m_MaxConn = MaxConn > 0 ? MaxConn : 1;
+   m_MinConn = MinConn < m_MaxConn ? MinConn : m_MaxConn;
    m_close_log = Close_Log;
+   m_LocalConn = LocalConn;
+
+   /*
+   	每次握手都要等几个往返，MinConn 个连接同时建立，总时间接近一次握手，
+   	数据库暂时不可用时由后台线程补足
+   */
+	for (int i = 0; i < m_MinConn; ++i)
+	{
+		m_Fillers.emplace_back(&connection_pool::Fill, this);
+	}
+
+	m_Keeper = std::thread(&connection_pool::KeepAlive, this);
+	m_Watchdog = std::thread(&connection_pool::Watchdog, this);
+}
+
+void connection_pool::Fill()
+{
+	std::unique_lock<std::mutex> lk(m_Mutex);
+	if ( m_Stop || m_TotalConn >= m_MinConn )
+		return;
+
+	MYSQL* con = Grow(lk);
+	if ( con == NULL )
+	{
+		LOG_ERROR("MySQL Error, retry in %d seconds", m_Backoff);
+		return;
+	}
+	Put(con, time(NULL), false);
+	m_ReadyCond.notify_all();
+}
+
+bool connection_pool::WaitReady()
+{
+	std::unique_lock<std::mutex> lk(m_Mutex);
+	m_ReadyCond.wait(lk, [this] { return m_Stop || Ready(); });
+	return !m_Stop;
+}
+
+//新建一个带语句缓存的连接，断开后由 mysql_ping 自动重连
+MYSQL* connection_pool::NewConnection()
+{
+	pooled_conn* pc = new pooled_conn;
+	MYSQL* con = mysql_init(&pc->mysql);
+	if ( con == NULL )
+	{
+		delete pc;
+		return NULL;
+	}
+
+	sql_bool reconnect = 1;
+	mysql_options(con, MYSQL_OPT_RECONNECT, &reconnect);
+
+	if ( mysql_real_connect(con, m_Url.c_str(), m_User.c_str(), m_PassWord.c_str(), 
+								  m_DatabaseName.c_str(), atoi(m_Port.c_str()), NULL, 0) == NULL )
+	{
+		LOG_ERROR("connect error:%s", mysql_error(con));
+		mysql_close(con);
+		delete pc;
+		return NULL;
+	}
+
+	pc->stmts.init(con, m_close_log);
+	pc->local = false;
+	return con;
+}
+
+void connection_pool::CloseConnection(MYSQL* con)
+{
+	GetStmtCache(con)->invalidate();
+	mysql_close(con);
+	delete reinterpret_cast<pooled_conn*>(con);
+}
 
-   /*在连接池中放入 maxconn 个数据库连接*/
-	for (int i = 0; i < MaxConn; i++)
+
+//专属连接只被所属的线程使用，线程退出时关闭
+connection_pool::local_conns::~local_conns()
+{
+	for (MYSQL* con : free)
 	{
-      /*初始化一个连接*/
-		MYSQL* con = NULL;
-		con = mysql_init(con);
+		CloseConnection(con);
+	}
+}
 
+//专属连接建立失败不影响使用，这个线程只从共享的连接池中取
+void connection_pool::AttachThread()
+{
+	if ( m_LocalConn <= 0 || t_local.attached )
+		return;
+
+	t_local.attached = true;
+	for (int i = 0; i < m_LocalConn; ++i)
+	{
+		MYSQL* con = NewConnection();
 		if ( con == NULL )
 		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
+			LOG_ERROR("create thread local connection failed");
+			break;
 		}
+		reinterpret_cast<pooled_conn*>(con)->local = true;
+		t_local.free.push_back(con);
+	}
+}
 
-      /*与数据库连接*/
-		con = mysql_real_connect(con, Url.c_str(), User.c_str(), PassWord.c_str(), 
-                                 DataBaseName.c_str(), Port, NULL, 0);
+/*
+	当有请求时，先取线程的专属连接，不涉及锁和其它线程，
+	都在使用中时再从共享的连接池中取：有空闲连接直接取，没有就新建，
+	到达最大连接数后排队，等到有连接归还或者超时
+*/
+MYSQL* connection_pool::GetConnection(int timeout_ms)
+{
+	if ( !t_scope.active )
+		return Acquire(timeout_ms);
 
-		if ( con == NULL )
+	//请求已经超时或者被取消，结果没有人等待，不再访问数据库
+	if ( connection_scope::expired() )
+	{
+		m_DeadlineRejects.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	//请求范围内已经租用了这个连接池的连接，没有在使用时直接复用
+	scope_lease* lease = NULL;
+	for (scope_lease& l : t_scope.leases)
+	{
+		if ( l.pool == this )
+			lease = &l;
+	}
+	if ( lease != NULL && !lease->borrowed )
+	{
+		lease->borrowed = true;
+		m_ScopeReuses.fetch_add(1, std::memory_order_relaxed);
+		Watch(lease->conn);
+		return lease->conn;
+	}
+
+	//排队等待连接的时间不超过请求剩余的时间
+	if ( t_scope.deadline != std::chrono::steady_clock::time_point::max() )
+	{
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+							t_scope.deadline - std::chrono::steady_clock::now()).count() + 1;
+		timeout_ms = std::min(timeout_ms, (int)std::min(left, (long)WAIT_TIMEOUT_MS));
+	}
+
+	MYSQL* con = Acquire(timeout_ms);
+	if ( con == NULL )
+		return NULL;
+	if ( lease == NULL )
+		t_scope.leases.push_back({ this, con, true });
+	Watch(con);
+	return con;
+}
+
+MYSQL* connection_pool::Acquire(int timeout_ms)
+{
+	//专属连接只属于启用了专属连接的连接池（主库），从库的连接池不取
+	if ( m_LocalConn > 0 && !t_local.free.empty() )
+	{
+		MYSQL* con = t_local.free.back();
+		t_local.free.pop_back();
+		return con;
+	}
+
+	std::unique_lock<std::mutex> lk(m_Mutex);
+	if ( !m_Idle.empty() )
+	{
+		MYSQL* con = m_Idle.back().conn;
+		m_Idle.pop_back();
+		--m_FreeConn;
+		++m_CurConn;
+		return con;
+	}
+
+	MYSQL* con = Grow(lk);
+	if ( con != NULL )
+	{
+		++m_CurConn;
+		return con;
+	}
+
+	/*排队，归还的连接按顺序交给队头的等待者*/
+	auto start = std::chrono::steady_clock::now();
+	conn_waiter waiter;
+	m_Waiters.push_back(&waiter);
+	waiter.cond.wait_until(lk, start + std::chrono::milliseconds(timeout_ms), 
+								  [&waiter] { return waiter.conn != NULL; });
+
+	if ( waiter.conn == NULL )
+	{
+		for (auto it = m_Waiters.begin(); it != m_Waiters.end(); ++it)
 		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
+			if ( *it == &waiter )
+			{
+				m_Waiters.erase(it);
+				break;
+			}
 		}
+	}
+	else
+	{
+		++m_CurConn;
+	}
+	lk.unlock();
+
+	/*等待时间按 1ms、10ms、100ms、1s 分段统计*/
+	unsigned long us = std::chrono::duration_cast<std::chrono::microseconds>(
+								std::chrono::steady_clock::now() - start).count();
+	int bucket = 0;
+	for (unsigned long bound = 1000; bucket < WAIT_BUCKETS - 1 && us > bound; bound *= 10)
+		++bucket;
+	m_Waits.fetch_add(1, std::memory_order_relaxed);
+	m_WaitUs.fetch_add(us, std::memory_order_relaxed);
+	m_WaitBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
 
-		conn_Queue.push(con);
-		++m_FreeConn;
+	if ( waiter.conn == NULL )
+	{
+		m_WaitTimeouts.fetch_add(1, std::memory_order_relaxed);
+		LOG_ERROR("wait for connection timed out after %d ms", timeout_ms);
 	}
+	return waiter.conn;
 }
 
-
-//当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
-MYSQL* connection_pool::GetConnection()
+MYSQL* connection_pool::Grow(std::unique_lock<std::mutex>& lk)
 {
-	MYSQL* con = NULL;
-
-	if ( conn_Queue.empty() )
+	if ( m_TotalConn >= m_MaxConn || time(NULL) < m_RetryAt )
 		return NULL;
 
-	conn_Queue.wait_and_pop(con);
+	/*建连比较慢，先占住名额再在锁外建立*/
+	++m_TotalConn;
+	lk.unlock();
+	MYSQL* con = NewConnection();
+	lk.lock();
 
-	--m_FreeConn;
-	++m_CurConn;
+	if ( con == NULL )
+	{
+		--m_TotalConn;
+		m_Backoff = m_Backoff ? std::min(m_Backoff * 2, (int)MAX_BACKOFF) : 1;
+		m_RetryAt = time(NULL) + m_Backoff;
+		return NULL;
+	}
 
+	m_Backoff = 0;
+	m_RetryAt = 0;
+	m_Created.fetch_add(1, std::memory_order_relaxed);
 	return con;
 }
 
-//释放当前使用的连接
+void connection_pool::Put(MYSQL* con, time_t last_used, bool front)
+{
+	if ( !m_Waiters.empty() )
+	{
+		conn_waiter* waiter = m_Waiters.front();
+		m_Waiters.pop_front();
+		waiter->conn = con;
+		waiter->cond.notify_one();
+		return;
+	}
+
+	idle_conn idle = { con, last_used };
+	if ( front )
+		m_Idle.push_front(idle);
+	else
+		m_Idle.push_back(idle);
+	++m_FreeConn;
+}
+
+void connection_pool::Drop(MYSQL* con)
+{
+	CloseConnection(con);
+	m_Closed.fetch_add(1, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lk(m_Mutex);
+	--m_TotalConn;
+}
+
+//释放当前使用的连接，专属连接放回线程自己的列表
 bool connection_pool::ReleaseConnection(MYSQL* con)
 {
 	if ( con == NULL )
 		return false;
 
-   conn_Queue.push(con);
+	//租用的连接留到请求范围结束
+	if ( t_scope.active )
+	{
+		Unwatch(con);
+		for (scope_lease& l : t_scope.leases)
+		{
+			if ( l.conn == con )
+			{
+				l.borrowed = false;
+				return true;
+			}
+		}
+	}
 
-	++m_FreeConn;
+	if ( reinterpret_cast<pooled_conn*>(con)->local )
+	{
+		t_local.free.push_back(con);
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lk(m_Mutex);
 	--m_CurConn;
+	Put(con, time(NULL), false);
 
 	return true;
 }
 
-//销毁数据库连接池
+/*
+	后台线程，每隔 CHECK_INTERVAL 秒：
+	1、超过最小连接数时，关闭空闲超过 IDLE_TIMEOUT 的连接
+	2、在锁外 ping 一段时间没有用过的空闲连接，失败的关闭（ping 本身会尝试重连）
+	3、补足到最小连接数，失败后按 1、2、4...MAX_BACKOFF 秒退避
+*/
+void connection_pool::KeepAlive()
+{
+	std::unique_lock<std::mutex> lk(m_Mutex);
+	while ( !m_Stop )
+	{
+		m_StopCond.wait_for(lk, std::chrono::seconds((int)CHECK_INTERVAL));
+		if ( m_Stop )
+			break;
+
+		time_t cur = time(NULL);
+		std::vector<MYSQL*> expired, checking;
+		std::vector<time_t> checking_used;
+		int total = m_TotalConn;
+		for (auto it = m_Idle.begin(); it != m_Idle.end(); )
+		{
+			if ( it->last_used + IDLE_TIMEOUT <= cur && total > m_MinConn )
+			{
+				expired.push_back(it->conn);
+				--total;
+			}
+			else if ( it->last_used + CHECK_INTERVAL <= cur )
+			{
+				checking.push_back(it->conn);
+				checking_used.push_back(it->last_used);
+			}
+			else
+			{
+				++it;
+				continue;
+			}
+			it = m_Idle.erase(it);
+			--m_FreeConn;
+		}
+		lk.unlock();
+
+		for (MYSQL* con : expired)
+		{
+			Drop(con);
+		}
+
+		std::vector<bool> alive(checking.size());
+		for (size_t i = 0; i < checking.size(); ++i)
+		{
+			alive[i] = mysql_ping(checking[i]) == 0;
+			if ( !alive[i] )
+			{
+				LOG_ERROR("ping error:%s", mysql_error(checking[i]));
+				m_PingFailures.fetch_add(1, std::memory_order_relaxed);
+				Drop(checking[i]);
+			}
+		}
+
+		lk.lock();
+		for (size_t i = 0; i < checking.size(); ++i)
+		{
+			if ( alive[i] )
+				Put(checking[i], checking_used[i], true);
+		}
+
+		while ( !m_Stop && m_TotalConn < m_MinConn )
+		{
+			MYSQL* con = Grow(lk);
+			if ( con == NULL )
+			{
+				if ( m_TotalConn < m_MinConn )
+					LOG_ERROR("reconnect failed, retry in %d seconds", m_Backoff);
+				break;
+			}
+			Put(con, time(NULL), false);
+		}
+		m_ReadyCond.notify_all();
+	}
+}
+
+void connection_pool::Watch(MYSQL* con)
+{
+	if ( t_scope.cancelled == NULL && t_scope.deadline == std::chrono::steady_clock::time_point::max() )
+		return;
+
+	std::lock_guard<std::mutex> lk(m_CallMutex);
+	m_Calls.push_back({ con, mysql_thread_id(con), t_scope.deadline, t_scope.cancelled, false, false });
+	if ( m_Calls.size() == 1 )
+		m_CallCond.notify_one();
+}
+
+void connection_pool::WatchConnection(MYSQL* con)
+{
+	if ( t_scope.active )
+		Watch(con);
+}
+
+void connection_pool::UnwatchConnection(MYSQL* con)
+{
+	if ( t_scope.active )
+		Unwatch(con);
+}
+
+void connection_pool::Unwatch(MYSQL* con)
+{
+	std::unique_lock<std::mutex> lk(m_CallMutex);
+	while ( true )
+	{
+		size_t i = 0;
+		while ( i < m_Calls.size() && m_Calls[i].conn != con )
+			++i;
+		if ( i == m_Calls.size() )
+			return;
+
+		//KILL 还在执行，等它结束再归还连接，否则可能取消掉下一个请求的语句
+		if ( m_Calls[i].killing )
+		{
+			m_KillDone.wait(lk);
+			continue;
+		}
+
+		m_Calls[i] = m_Calls.back();
+		m_Calls.pop_back();
+		return;
+	}
+}
+
+/*
+	有请求范围内的连接在使用时每隔 WATCH_INTERVAL_MS 检查一次，
+	超过截止时间或者请求被取消的，对这个连接在服务端的 id 执行 KILL QUERY，
+	语句以 ER_QUERY_INTERRUPTED 返回，连接本身还能继续使用
+	KILL 和建立 KILL 用的连接都要和数据库往返，在锁外进行，数据库慢的时候其它线程取还连接不用等它
+*/
+void connection_pool::Watchdog()
+{
+	struct kill_target
+	{
+		MYSQL* 				conn;
+		unsigned long 		thread_id;
+		bool 					killed;
+	};
+	std::vector<kill_target> targets;
+
+	std::unique_lock<std::mutex> lk(m_CallMutex);
+	while ( !m_CallStop )
+	{
+		if ( m_Calls.empty() )
+		{
+			m_CallCond.wait(lk, [this] { return m_CallStop || !m_Calls.empty(); });
+			continue;
+		}
+		m_CallCond.wait_for(lk, std::chrono::milliseconds((int)WATCH_INTERVAL_MS));
+
+		auto now = std::chrono::steady_clock::now();
+		targets.clear();
+		for (running_call& call : m_Calls)
+		{
+			if ( call.killed || call.killing || (now < call.deadline && !(call.cancelled && *call.cancelled)) )
+				continue;
+			call.killing = true;
+			targets.push_back({ call.conn, call.thread_id, false });
+		}
+		if ( targets.empty() )
+			continue;
+
+		lk.unlock();
+		if ( m_KillConn == NULL )
+			m_KillConn = NewConnection();
+
+		//数据库连不上时放弃这一批，正在执行的语句由各自的连接报错返回；KILL 出错的下一轮再试
+		bool give_up = m_KillConn == NULL;
+		for (kill_target& t : targets)
+		{
+			t.killed = give_up || (m_KillConn != NULL && Kill(t.thread_id));
+		}
+		lk.lock();
+
+		for (running_call& call : m_Calls)
+		{
+			if ( !call.killing )
+				continue;
+			for (const kill_target& t : targets)
+			{
+				if ( t.conn == call.conn )
+				{
+					call.killing = false;
+					call.killed = t.killed;
+					break;
+				}
+			}
+		}
+		m_KillDone.notify_all();
+	}
+
+	if ( m_KillConn != NULL )
+	{
+		CloseConnection(m_KillConn);
+		m_KillConn = NULL;
+	}
+}
+
+bool connection_pool::Kill(unsigned long thread_id)
+{
+	char sql[64];
+	snprintf(sql, sizeof(sql), "KILL QUERY %lu", thread_id);
+	if ( mysql_query(m_KillConn, sql) && mysql_errno(m_KillConn) != ER_NO_SUCH_THREAD )
+	{
+		LOG_ERROR("kill query %lu error:%s", thread_id, mysql_error(m_KillConn));
+		CloseConnection(m_KillConn);
+		m_KillConn = NULL;
+		return false;
+	}
+
+	m_Kills.fetch_add(1, std::memory_order_relaxed);
+	LOG_INFO("killed query %lu of an expired or cancelled request", thread_id);
+	return true;
+}
+
+//销毁数据库连接池，只关闭空闲的连接
 void connection_pool::DestroyPool()
 {
+	{
+		std::lock_guard<std::mutex> lk(m_Mutex);
+		m_Stop = true;
+	}
+	m_StopCond.notify_all();
+	m_ReadyCond.notify_all();
+	if ( m_Keeper.joinable() )
+		m_Keeper.join();
 
-   while( !conn_Queue.empty() )
-   {
-      MYSQL* con = *(conn_Queue.wait_and_pop());
-      mysql_close(con);
-   }
+	{
+		std::lock_guard<std::mutex> lk(m_CallMutex);
+		m_CallStop = true;
+	}
+	m_CallCond.notify_all();
+	if ( m_Watchdog.joinable() )
+		m_Watchdog.join();
+	for (std::thread& t : m_Fillers)
+	{
+		t.join();
+	}
+	m_Fillers.clear();
+
+	std::lock_guard<std::mutex> lk(m_Mutex);
+	for (idle_conn& idle : m_Idle)
+	{
+		CloseConnection(idle.conn);
+	}
+	m_TotalConn -= m_Idle.size();
+	m_Idle.clear();
 
    m_CurConn = 0;
    m_FreeConn = 0;
@@ -108,6 +626,51 @@ int connection_pool::GetFreeConn()
 	return m_FreeConn;
 }
 
+void connection_pool::report(std::string& out) const
+{
+	static const char* bounds[WAIT_BUCKETS] = { "0.001", "0.01", "0.1", "1", "+Inf" };
+
+	char buf[1024];
+	int len = snprintf(buf, sizeof(buf),
+							 "db_pool_connections %d\n"
+							 "db_pool_in_use %d\n"
+							 "db_pool_idle %d\n"
+							 "db_pool_max %d\n"
+							 "db_pool_min %d\n"
+							 "db_pool_created %lu\n"
+							 "db_pool_closed %lu\n"
+							 "db_pool_ping_failures %lu\n"
+							 "db_pool_wait_timeouts %lu\n"
+							 "db_pool_scope_reuses %lu\n"
+							 "db_pool_deadline_rejects %lu\n"
+							 "db_pool_queries_killed %lu\n",
+							 m_CurConn.load() + m_FreeConn.load(), m_CurConn.load(), m_FreeConn.load(),
+							 m_MaxConn, m_MinConn,
+							 m_Created.load(std::memory_order_relaxed),
+							 m_Closed.load(std::memory_order_relaxed),
+							 m_PingFailures.load(std::memory_order_relaxed),
+							 m_WaitTimeouts.load(std::memory_order_relaxed),
+							 m_ScopeReuses.load(std::memory_order_relaxed),
+							 m_DeadlineRejects.load(std::memory_order_relaxed),
+							 m_Kills.load(std::memory_order_relaxed));
+	out.append(buf, len);
+
+	/*等待时间按 Prometheus 直方图输出，区间是累计的*/
+	unsigned long count = 0;
+	for (int i = 0; i < WAIT_BUCKETS; ++i)
+	{
+		count += m_WaitBuckets[i].load(std::memory_order_relaxed);
+		len = snprintf(buf, sizeof(buf), "db_pool_wait_seconds_bucket{le=\"%s\"} %lu\n", bounds[i], count);
+		out.append(buf, len);
+	}
+	len = snprintf(buf, sizeof(buf),
+						"db_pool_wait_seconds_sum %.6f\n"
+						"db_pool_wait_seconds_count %lu\n",
+						m_WaitUs.load(std::memory_order_relaxed) / 1e6,
+						m_Waits.load(std::memory_order_relaxed));
+	out.append(buf, len);
+}
+
 connectionRAII::connectionRAII(MYSQL** SQL, connection_pool* connPool)
 {
 	*SQL = connPool->GetConnection();
@@ -119,3 +682,62 @@ connectionRAII::~connectionRAII()
 {
 	poolRAII->ReleaseConnection(conRAII);
 }
+
+connection_scope::connection_scope(std::chrono::steady_clock::time_point deadline,
+											  const std::atomic<bool>* cancelled)
+{
+	connection_pool::t_scope.active = true;
+	connection_pool::t_scope.deadline = deadline;
+	connection_pool::t_scope.cancelled = cancelled;
+}
+
+connection_scope::~connection_scope()
+{
+	connection_pool::t_scope.active = false;
+	for (connection_pool::scope_lease& l : connection_pool::t_scope.leases)
+	{
+		if ( l.borrowed )
+			l.pool->Unwatch(l.conn);
+		l.pool->ReleaseConnection(l.conn);
+	}
+	connection_pool::t_scope.leases.clear();
+	connection_pool::t_scope.cancelled = NULL;
+}
+
+bool connection_scope::expired()
+{
+	const connection_pool::scope_state& scope = connection_pool::t_scope;
+	if ( !scope.active )
+		return false;
+	if ( scope.cancelled != NULL && *scope.cancelled )
+		return true;
+	return scope.deadline != std::chrono::steady_clock::time_point::max() &&
+			 std::chrono::steady_clock::now() >= scope.deadline;
+}
+
+std::chrono::steady_clock::time_point connection_scope::deadline()
+{
+	const connection_pool::scope_state& scope = connection_pool::t_scope;
+	return scope.active ? scope.deadline : std::chrono::steady_clock::time_point::max();
+}
+
+void connection_scope::release()
+{
+	if ( !connection_pool::t_scope.active )
+		return;
+
+	std::vector<connection_pool::scope_lease>& leases = connection_pool::t_scope.leases;
+	for (auto it = leases.begin(); it != leases.end(); )
+	{
+		if ( it->borrowed )
+		{
+			++it;
+			continue;
+		}
+
+		connection_pool::t_scope.active = false;
+		it->pool->ReleaseConnection(it->conn);
+		connection_pool::t_scope.active = true;
+		it = leases.erase(it);
+	}
+}
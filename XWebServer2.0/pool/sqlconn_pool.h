@@ -2,8 +2,19 @@
 /*
 	数据库连接池
 	1、利用线程安全的队列管理连接池
-	2、单例模式
+	2、主库的连接池是单例，从库的连接池由 db_router 各自创建
 	3、RAII手法管理每一个使用的连接
+	4、每个连接带有自己的预处理语句缓存
+	5、可以给每个工作线程分配专属连接，放在线程局部存储中，取用和归还不加锁，
+	   专属连接都在使用中时再到共享的连接池中取
+	6、共享的连接池在最小和最大连接数之间伸缩：不够时按需新建，长时间空闲的连接关闭，
+	   后台线程定时 ping 空闲连接，断开的连接关闭后补足到最小连接数，建连失败时退避重试
+	7、连接都在使用中时按先来后到排队等待，超过等待时间返回 NULL，/metrics 输出等待时间的分布
+	8、初始的最小连接数由多个线程同时建立，init 不等待，需要时用 WaitReady 等到达到最小连接数
+	9、需要数据库的请求在 connection_scope 中处理，第一次用到数据库时才取连接，
+	   同一个请求内的多次存储调用复用这个连接，请求结束时归还，不访问数据库的请求不占用连接
+	10、请求范围带有截止时间和取消标记，等待连接的时间不超过剩余时间，已经超时或取消的请求不再取连接，
+	   正在执行的语句超过截止时间或者请求被取消时，由监视线程用单独的连接 KILL QUERY
 */
 
 #ifndef SQLCONN_POOL_
@@ -11,21 +22,178 @@
 
 #include <mysql/mysql.h>
 #include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
-#include "../thread_safe_queue/thread_safe_queue.h"
 #include "../log/log.h"
+#include "stmt_cache.h"
+
+/*
+	连接池中的一个连接，MYSQL 由 mysql_init 在这里原地初始化
+	MYSQL 是第一个成员，拿到 MYSQL* 就能直接找到同一个连接的语句缓存
+*/
+struct pooled_conn
+{
+	MYSQL 			mysql;
+	stmt_cache 		stmts;
+	bool 				local;											//是否是某个线程的专属连接
+};
 
 class connection_pool
 {
-private:
+public:
+	static const int 	WAIT_TIMEOUT_MS 	= 3000;					//取连接时最多等待的时间（毫秒）
+	static const int 	CHECK_INTERVAL 	= 10;						//空闲连接的检查间隔（秒）
+	static const int 	IDLE_TIMEOUT 		= 60;						//超过最小连接数的部分空闲多久后关闭（秒）
+	static const int 	MAX_BACKOFF 		= 30;						//建连失败后最长的重试间隔（秒）
+	static const int 	WAIT_BUCKETS 		= 5;						//等待时间分布的区间数
+	static const int 	WATCH_INTERVAL_MS = 50;						//检查正在执行的语句的间隔（毫秒）
+
+public:
 	connection_pool();
 	~connection_pool();
 
+private:
+	/*空闲连接，最近归还的在队尾，取的时候也从队尾取，冷的连接留在队头等待关闭*/
+	struct idle_conn
+	{
+		MYSQL* 			conn;
+		time_t 			last_used;
+	};
+
+	/*排队等待连接的线程，归还的连接直接交给队头的等待者*/
+	struct conn_waiter
+	{
+		std::condition_variable 	cond;
+		MYSQL* 						conn = NULL;
+	};
+
 	int 				m_MaxConn;  									//最大连接数
-	int 				m_CurConn;  									//当前已使用的连接数
-	int 				m_FreeConn; 									//当前空闲的连接数
-	thread_safe_queue<MYSQL*> 	
-						conn_Queue;										//连接池
+	int 				m_MinConn;										//最小连接数
+	int 				m_TotalConn;									//共享连接池中已建立（包括正在建立）的连接数
+	std::atomic<int> 	m_CurConn;  									//当前已使用的连接数
+	std::atomic<int> 	m_FreeConn; 									//当前空闲的连接数
+	std::mutex 			m_Mutex;
+	std::deque<idle_conn> 
+						m_Idle;											//连接池
+	std::deque<conn_waiter*> 
+						m_Waiters;
+	int 				m_LocalConn;									//每个线程的专属连接数，0 表示不使用
+
+	time_t 			m_RetryAt;										//建连失败后，这个时间之前不再新建连接
+	int 				m_Backoff;										//当前的重试间隔（秒）
+
+	std::thread 		m_Keeper;										//检查空闲连接的后台线程
+	std::vector<std::thread> 
+						m_Fillers;										//同时建立初始连接的线程
+	bool 				m_Stop;
+	std::condition_variable 
+						m_StopCond;
+	std::condition_variable 
+						m_ReadyCond;									//连接数可能达到了最小连接数
+
+	/*统计信息*/
+	std::atomic<unsigned long> 	m_Waits;						//需要排队的次数
+	std::atomic<unsigned long> 	m_WaitTimeouts;
+	std::atomic<unsigned long> 	m_WaitUs;						//排队的总时间（微秒）
+	std::atomic<unsigned long> 	m_WaitBuckets[WAIT_BUCKETS];
+	std::atomic<unsigned long> 	m_Created;
+	std::atomic<unsigned long> 	m_Closed;
+	std::atomic<unsigned long> 	m_PingFailures;
+	std::atomic<unsigned long> 	m_ScopeReuses;					//请求范围内复用连接的次数
+	std::atomic<unsigned long> 	m_DeadlineRejects;			//请求已经超时或取消，没有取连接的次数
+	std::atomic<unsigned long> 	m_Kills;							//KILL QUERY 的次数
+
+	/*请求范围内正在使用的连接，连接归还之前一直在这里，监视线程据此取消语句*/
+	struct running_call
+	{
+		MYSQL* 						conn;
+		unsigned long 				thread_id;						//服务端的连接 id
+		std::chrono::steady_clock::time_point 
+										deadline;
+		const std::atomic<bool>* 
+										cancelled;
+		bool 							killed;
+		bool 							killing;						//监视线程正在锁外 KILL 这个调用
+	};
+	std::mutex 			m_CallMutex;
+	std::vector<running_call> 
+						m_Calls;
+	std::condition_variable 
+						m_CallCond;
+	std::condition_variable 
+						m_KillDone;										//一批 KILL 执行完，Unwatch 在上面等待
+	bool 				m_CallStop;
+	std::thread 		m_Watchdog;
+	MYSQL* 			m_KillConn;										//发送 KILL QUERY 的连接，第一次需要时建立，只由监视线程使用
+
+	/*线程的专属连接，线程退出时关闭*/
+	struct local_conns
+	{
+		std::vector<MYSQL*> 	free;
+		bool 					attached = false;
+		~local_conns();
+	};
+	static thread_local local_conns 	t_local;
+
+	/*线程当前所在的请求范围，每个连接池最多租用一个连接*/
+	struct scope_lease
+	{
+		connection_pool* 	pool;
+		MYSQL* 				conn;
+		bool 					borrowed;										//正在被某次调用使用
+	};
+	struct scope_state
+	{
+		bool 					active = false;
+		std::chrono::steady_clock::time_point 
+								deadline;
+		const std::atomic<bool>* 
+								cancelled = NULL;
+		std::vector<scope_lease> 
+								leases;
+	};
+	static thread_local scope_state 	t_scope;
+
+	/*不经过请求范围取连接*/
+	MYSQL* 			Acquire(int timeout_ms);
+
+	friend class connection_scope;
+
+	/*占一个名额新建连接，到达最大连接数或者还在退避期间返回 NULL，调用时持有 lk*/
+	MYSQL* 			Grow(std::unique_lock<std::mutex>& lk);
+
+	/*把连接交给队头的等待者，没有等待者时放回空闲队列，调用时持有锁*/
+	void 				Put(MYSQL* conn, time_t last_used, bool front);
+
+	/*关闭一个共享连接池中的连接，调用时不持有锁*/
+	void 				Drop(MYSQL* conn);
+
+	void 				KeepAlive();
+
+	/*登记和注销请求范围内正在使用的连接，没有截止时间和取消标记的范围不登记*/
+	void 				Watch(MYSQL* conn);
+	void 				Unwatch(MYSQL* conn);
+
+	/*监视线程，KILL 超过截止时间或者被取消的请求正在执行的语句*/
+	void 				Watchdog();
+
+	/*
+		在 m_KillConn 上 KILL QUERY，在锁外调用，不挡住其它线程取还连接，
+		被 KILL 的调用标记为 killing，它的 Unwatch 等 KILL 结束才返回，保证连接还没有归还给别的请求
+	*/
+	bool 				Kill(unsigned long thread_id);
+
+	/*建立一个初始连接*/
+	void 				Fill();
+
+	/*已经建立好的共享连接达到最小连接数，调用时持有锁*/
+	bool 				Ready() const { return m_CurConn + m_FreeConn >= m_MinConn; }
 	
 public:
 	std::string 	m_Url;			 								//主机地址
@@ -36,16 +204,41 @@ public:
 	int 				m_close_log;									//日志开关
 
 public:
-	MYSQL* 			GetConnection();				 				//获取数据库连接
+	MYSQL* 			GetConnection(int timeout_ms = WAIT_TIMEOUT_MS);	//获取数据库连接，超时返回 NULL
 	bool 				ReleaseConnection(MYSQL* conn); 			//释放连接
 	int 				GetFreeConn();					 				//获取连接
+	int 				GetUsedConn() const { return m_CurConn; }	//共享连接池中正在使用的连接数
+	void 				AttachThread();								//给调用线程建立专属连接，工作线程启动时调用
 	void 				DestroyPool();					 				//销毁所有连接
 
+	MYSQL* 			NewConnection();								//新建一个不放入池中的连接，失败返回 NULL
+	static void 	CloseConnection(MYSQL* conn);				//关闭 NewConnection 建立的连接
+
+	/*
+		在请求范围内登记不经过连接池取的连接（比如 NewConnection 建立的），
+		超过截止时间或者请求被取消时正在执行的语句同样被 KILL，不在请求范围内时什么都不做
+		UnwatchConnection 返回后不会再有 KILL 落到这个连接上
+	*/
+	void 				WatchConnection(MYSQL* conn);
+	void 				UnwatchConnection(MYSQL* conn);
+
 	static connection_pool* 
-						GetInstance();									//单例模式
+						GetInstance();									//主库的连接池
+
+	static stmt_cache* 
+						GetStmtCache(MYSQL* conn)					//连接对应的语句缓存
+						{ return &reinterpret_cast<pooled_conn*>(conn)->stmts; }
+
+	/*按 Prometheus 文本格式追加统计信息*/
+	void 				report(std::string& out) const;
 
+	/*同时建立 MinConn 个连接后立即返回，失败时不退出，由后台线程重试*/
 	void 				init(std::string Url, std::string User, std::string PassWord, 
-							  std::string DataBaseName, int Port, int MaxConn, int Close_Log); 
+							  std::string DataBaseName, int Port, int MaxConn, int Close_Log,
+							  int LocalConn = 0, int MinConn = 0); 
+
+	/*等到建立好的连接达到最小连接数，连接池销毁时返回 false*/
+	bool 				WaitReady();
 };
 
 
@@ -65,4 +258,28 @@ public:
 
 };
 
+/*
+	请求范围的连接租用，同一线程内不嵌套
+	作用域内 GetConnection 优先返回这个线程已经租用的连接，ReleaseConnection 只标记不再使用，
+	析构时把租用的连接都还给各自的连接池
+	deadline 之后或者 *cancelled 为 true 时，GetConnection 返回 NULL，正在执行的语句被 KILL
+*/
+class connection_scope
+{
+public:
+	connection_scope(std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(),
+						  const std::atomic<bool>* cancelled = NULL);
+	~connection_scope();
+
+	/*当前线程所在的请求已经超过截止时间或者被取消，不在请求范围内时返回 false*/
+	static bool 		expired();
+
+	/*当前线程所在的请求的截止时间，不在请求范围内或者没有截止时间时为 time_point::max()*/
+	static std::chrono::steady_clock::time_point 
+						deadline();
+
+	/*归还没有在使用的租用连接，等待其它线程（比如注册写入线程）之前调用，等待期间不占用连接*/
+	static void 		release();
+};
+
 #endif
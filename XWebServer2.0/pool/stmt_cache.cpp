@@ -0,0 +1,111 @@
+#include "stmt_cache.h"
+
+#include <string.h>
+
+#include "../log/log.h"
+
+static const char* STMT_SQL[STMT_NUM] =
+{
+	"SELECT passwd FROM user WHERE username=?",
+	"SELECT 1 FROM user WHERE username=? LIMIT 1",
+	"INSERT INTO user(username, passwd) VALUES(?, ?)"
+};
+
+stmt_cache::stmt_cache() : m_conn(NULL), m_thread_id(0), m_close_log(0)
+{
+	for (int i = 0; i < STMT_NUM; ++i)
+		m_stmts[i] = NULL;
+}
+
+stmt_cache::~stmt_cache()
+{
+	invalidate();
+}
+
+void stmt_cache::init(MYSQL* conn, int close_log)
+{
+	m_conn = conn;
+	m_close_log = close_log;
+	m_thread_id = mysql_thread_id(conn);
+}
+
+void stmt_cache::invalidate()
+{
+	for (int i = 0; i < STMT_NUM; ++i)
+	{
+		if ( m_stmts[i] )
+		{
+			mysql_stmt_close(m_stmts[i]);
+			m_stmts[i] = NULL;
+		}
+	}
+}
+
+bool stmt_cache::need_reprepare(unsigned int err)
+{
+	return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST || 
+			 err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE;
+}
+
+MYSQL_STMT* stmt_cache::get(STMT_ID id)
+{
+	/*连接被自动重连过，旧连接上的语句都已经失效*/
+	unsigned long thread_id = mysql_thread_id(m_conn);
+	if ( thread_id != m_thread_id )
+	{
+		invalidate();
+		m_thread_id = thread_id;
+	}
+
+	if ( m_stmts[id] )
+		return m_stmts[id];
+
+	MYSQL_STMT* stmt = mysql_stmt_init(m_conn);
+	if ( stmt == NULL )
+		return NULL;
+
+	if ( mysql_stmt_prepare(stmt, STMT_SQL[id], strlen(STMT_SQL[id])) )
+	{
+		LOG_ERROR("prepare error:%s", mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+
+	m_stmts[id] = stmt;
+	return stmt;
+}
+
+unsigned int stmt_cache::execute(STMT_ID id, MYSQL_BIND* params, bool retry)
+{
+	unsigned int err = 0;
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		MYSQL_STMT* stmt = get(id);
+		if ( stmt == NULL )
+		{
+			err = mysql_errno(m_conn);
+		}
+		else if ( mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt) )
+		{
+			err = mysql_stmt_errno(stmt);
+		}
+		else
+		{
+			return 0;
+		}
+
+		if ( !retry || (!need_reprepare(err) && stmt != NULL) )
+			break;
+
+		/*mysql_ping 会按 MYSQL_OPT_RECONNECT 重连，之后所有语句重新 prepare*/
+		invalidate();
+		if ( mysql_ping(m_conn) )
+			break;
+	}
+
+	if ( err == 0 )
+		err = CR_SERVER_GONE_ERROR;
+	if ( err != ER_DUP_ENTRY )
+		LOG_ERROR("execute statement %d error:%u", (int)id, err);
+	return err;
+}
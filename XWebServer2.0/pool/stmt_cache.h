@@ -0,0 +1,60 @@
+/*
+	预处理语句缓存
+	1、连接池中每个 MySQL 连接各自持有一份，语句在第一次使用时才 prepare
+	2、参数使用二进制协议绑定，不需要拼接、转义 SQL，也不会被注入
+	3、连接断开重连后服务器端的语句失效，检测到重连或语句失效时自动重新 prepare
+	同一时刻一个连接只会被一个线程使用，所以缓存本身不需要加锁
+*/
+
+#ifndef STMT_CACHE_H
+#define STMT_CACHE_H
+
+#include <mysql/mysql.h>
+#include <type_traits>
+
+/*MySQL 8 的头文件去掉了 my_bool，改用 bool，这里统一取 MYSQL_BIND::is_null 指向的类型*/
+typedef std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type sql_bool;
+
+enum STMT_ID
+{
+	STMT_LOGIN = 0,									//按用户名查密码
+	STMT_EXISTS,										//用户名是否存在
+	STMT_REGISTER,										//注册新用户
+	STMT_NUM
+};
+
+class stmt_cache
+{
+private:
+	MYSQL* 			m_conn;
+	MYSQL_STMT* 	m_stmts[STMT_NUM];
+	unsigned long 	m_thread_id;					//prepare 时的连接 id，重连后会变化
+	int 				m_close_log;
+
+private:
+	stmt_cache(const stmt_cache&) = delete;
+	stmt_cache& operator=(const stmt_cache&) = delete;
+
+	/*连接断开或者语句在服务器端失效，需要重新 prepare*/
+	static bool 	need_reprepare(unsigned int err);
+
+public:
+	stmt_cache();
+	~stmt_cache();
+
+	void 				init(MYSQL* conn, int close_log);
+
+	/*关闭所有语句，下次使用时重新 prepare，关闭连接之前也要先调用*/
+	void 				invalidate();
+
+	/*取出语句，还没有 prepare 时现在 prepare，失败返回 NULL*/
+	MYSQL_STMT* 	get(STMT_ID id);
+
+	/*
+		绑定参数并执行，成功返回 0，失败返回 MySQL 错误码
+		retry 为 true 时连接断开会重连、重新 prepare 后再试一次，事务中不能重试
+	*/
+	unsigned int 	execute(STMT_ID id, MYSQL_BIND* params, bool retry = true);
+};
+
+#endif
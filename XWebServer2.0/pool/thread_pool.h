@@ -6,93 +6,301 @@
 #include <vector>
 #include <utility>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <string>
+#include <stdio.h>
 
-#include "../thread_safe_queue/thread_safe_queue.h"
+#include "../thread_safe_queue/mpmc_ring.h"
 #include "sqlconn_pool.h"
 
 template <typename T>
 class thread_pool
 {
+public:
+    static const int MIN_SPIN = 16;                     //自适应自旋次数的下限
+    static const int MAX_SPIN = 2048;                   //自适应自旋次数的上限
+    static const int MAX_REQUESTS = 65536;              //每个队列的容量
+
 private:
-    /*线程数量*/
-    int                         m_thread_number;        
+    /*
+        一条工作队列和在上面取请求的线程
+        队列是有界的环形队列，放入和取出不分配内存，每个连接同时最多有一个请求在队列中，
+        容量不小于最大连接数时不会满
+        pending 在放入之前加一、取出之后减一，不会小于队列中的请求数，
+        自旋时只读它，不去抢队列的锁
+        取不到请求的线程先自旋，仍然没有就休眠，放入请求时有休眠的线程就发一个唤醒令牌，
+        每个请求最多唤醒一个线程
+    */
+    struct lane
+    {
+        const char*                 name;
+        mpmc_ring<T*>               queue;
+        std::atomic<int>            pending{0};
+        std::atomic<int>            parked{0};      //已经登记休眠的线程数
+        std::atomic<int>            wakeups{0};     //还没有被领取的唤醒令牌，持有 mutex 时修改
+        std::mutex                  mutex;
+        std::condition_variable     cond;
+        std::vector<std::thread>    threads;
+        int                         max_spin = 0;   //0 表示不自旋
 
-    /*线程池*/
-    std::vector<std::thread>    m_threads;       
+        /*统计信息*/
+        std::atomic<unsigned long>  spin_hits{0};   //自旋期间等到了请求的次数
+        std::atomic<unsigned long>  parks{0};       //休眠的次数
 
-    /*工作队列*/
-    thread_safe_queue<T*>       m_workqueue;
+        lane(const char* lane_name, int capacity) : name(lane_name), queue(capacity) {}
+    };
+
+    /*工作队列，处理所有请求*/
+    lane                        m_workers;
+
+    /*
+        数据库通道：需要访问数据库的请求转到这里由单独的线程处理，
+        它们阻塞在数据库上时不占用处理静态资源的工作线程，请求间隔长，不自旋
+    */
+    lane                        m_db;
 
     /*标志工作线程是否结束运行*/
-    bool m_stop;
+    std::atomic<bool>           m_stop;
 
     /*数据库*/
-    connection_pool*            m_connPool; 
+    connection_pool*            m_connPool;
 
 private:
 
-    /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
-    static  void run(thread_pool<T>* arg);
+    /*工作线程和数据库通道的线程运行的函数，不断从所在的队列中取出任务并执行之*/
+    static  void run(thread_pool<T>* arg, lane* l);
 
-public:
     /*
-        thread_number是线程池中线程的数量
-        max_requests是请求队列中最多允许的、等待处理的请求的数量
+        取一个请求，没有时先自旋再休眠，线程池销毁时返回 false
+        spin 是这个线程当前的自旋次数，自旋等到了请求就加倍，没有等到就减半
     */
-    thread_pool(connection_pool* connPool, int thread_number = 8);
+    bool take(lane& l, int& spin, T*& request);
+
+    void put(lane& l, T* request);
+
+    void stop(lane& l);
 
-    ~thread_pool()
+    static void report(const lane& l, std::string& out);
+
+    /*自旋等待时的让步指令，降低功耗并把执行资源让给同一个核上的超线程*/
+    static void cpu_relax()
     {
-        m_stop = true;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
     }
 
+public:
+    /*
+        thread_number是线程池中线程的数量
+        db_thread_number是数据库通道的线程数量，0 表示不单独处理
+        max_requests是每个队列的容量，队列满时 append 阻塞
+    */
+    thread_pool(connection_pool* connPool, int thread_number = 8, int db_thread_number = 0,
+                int max_requests = MAX_REQUESTS);
+
+    /*唤醒休眠的线程并等待所有线程退出，正在处理的请求先处理完*/
+    ~thread_pool();
+
     /*向线程池中添加任务*/
     void append(T* request);
 
+    /*把需要访问数据库的请求交给数据库通道*/
+    void append_db(T* request);
+
+    bool has_db_lane() const { return !m_db.threads.empty(); }
+
+    /*按 Prometheus 文本格式追加各个队列的统计信息*/
+    void report(std::string& out) const;
+
 };
 
 /*-----------------------------------实现---------------------------------------------*/
 
 template <typename T>
-thread_pool<T>::thread_pool(connection_pool* connPool, int thread_number) : 
-    m_thread_number(thread_number), 
-    m_threads(m_thread_number),
+thread_pool<T>::thread_pool(connection_pool* connPool, int thread_number, int db_thread_number,
+                            int max_requests) :
+    m_workers("worker", max_requests),
+    m_db("db", db_thread_number > 0 ? max_requests : 2),
     m_stop(false),
     m_connPool(connPool)
 {
     if ( thread_number <= 0 )
         throw std::exception();
 
+    /*只有一个核时自旋等不到别的线程放入请求，直接休眠*/
+    m_workers.max_spin = std::thread::hardware_concurrency() > 1 ? MAX_SPIN : 0;
+
     for (int i = 0; i < thread_number; ++i)
     {
-        m_threads[i] = std::move(std::thread(run, this));
-        m_threads[i].detach();
+        m_workers.threads.emplace_back(run, this, &m_workers);
+    }
+
+    for (int i = 0; i < db_thread_number; ++i)
+    {
+        m_db.threads.emplace_back(run, this, &m_db);
+    }
+}
+
+template <typename T>
+thread_pool<T>::~thread_pool()
+{
+    m_stop = true;
+    stop(m_workers);
+    stop(m_db);
+}
+
+template <typename T>
+void thread_pool<T>::stop(lane& l)
+{
+    {
+        std::lock_guard<std::mutex> lk(l.mutex);
+    }
+    l.cond.notify_all();
+    for (std::thread& t : l.threads)
+    {
+        t.join();
     }
 }
 
 template <typename T>
-void thread_pool<T>::run(thread_pool<T>* arg)
+void thread_pool<T>::run(thread_pool<T>* arg, lane* l)
 {
-    while ( !arg->m_stop ) 
+    /*
+        开启了专属连接时先给会访问数据库的线程建立好，之后取连接不需要加锁
+        有数据库通道时工作线程不访问数据库，不建立专属连接
+    */
+    if ( l == &arg->m_db || !arg->has_db_lane() )
+        arg->m_connPool->AttachThread();
+
+    int spin = l->max_spin;
+    T* request = NULL;
+    while ( arg->take(*l, spin, request) )
     {
-       T* request = NULL;
-       if( arg->m_workqueue.try_pop(request) == true)
-       {
-            /*
-                每次处理一个http请求之前，先初始化数据库信息，
-                该http请求结束后会自动归还数据库连接
-            */
-            connectionRAII mysqlcon(&request->mysql, arg->m_connPool);
-            request->initmysql_result(arg->m_connPool);
-            request->process();
-       }
+        /*
+            用户信息由全局的 user_cache 提供，缓存没有命中时
+            由存储后端自己取数据库连接，这里不再为每个请求占用一个连接
+        */
+        request->process();
+    }
+}
+
+template <typename T>
+bool thread_pool<T>::take(lane& l, int& spin, T*& request)
+{
+    while ( !m_stop )
+    {
+        if ( l.pending.load(std::memory_order_acquire) > 0 && l.queue.try_pop(request) )
+        {
+            l.pending.fetch_sub(1);
+            return true;
+        }
+
+        /*请求来得密时多转一会，省去休眠和唤醒的系统调用，来得疏时很快转入休眠*/
+        bool hit = false;
+        for (int i = 0; i < spin; ++i)
+        {
+            cpu_relax();
+            if ( l.pending.load(std::memory_order_relaxed) > 0 )
+            {
+                hit = true;
+                break;
+            }
+        }
+        if ( hit )
+        {
+            spin = std::min(spin * 2, l.max_spin);
+            l.spin_hits.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        spin = std::max(spin / 2, std::min((int)MIN_SPIN, l.max_spin));
+
+        /*休眠之前让出一次处理器，只有一个核时放入请求的线程可以接着放*/
+        std::this_thread::yield();
+        if ( l.pending.load(std::memory_order_relaxed) > 0 )
+            continue;
+
+        /*
+            先登记休眠再确认没有请求，put 先增加 pending 再看有没有休眠的线程，
+            两边都是顺序一致的原子操作，至少有一边能看到另一边，不会漏掉唤醒
+        */
+        std::unique_lock<std::mutex> lk(l.mutex);
+        l.parked.fetch_add(1);
+        if ( l.pending.load() == 0 && !m_stop )
+        {
+            l.parks.fetch_add(1, std::memory_order_relaxed);
+            l.cond.wait(lk, [&l, this] { return l.wakeups > 0 || m_stop; });
+            if ( l.wakeups > 0 )
+                --l.wakeups;
+        }
+        l.parked.fetch_sub(1);
+    }
+    return false;
+}
+
+template <typename T>
+void thread_pool<T>::put(lane& l, T* request)
+{
+    l.pending.fetch_add(1);
+    l.queue.push(request);
+
+    /*
+        已经发出的令牌够唤醒所有休眠的线程时不再加锁，
+        醒来的线程处理完会继续取，队列空了才再休眠
+    */
+    if ( l.parked.load() <= l.wakeups.load() )
+        return;
+
+    /*令牌数不超过休眠的线程数，一个请求只唤醒一个线程*/
+    std::lock_guard<std::mutex> lk(l.mutex);
+    if ( l.wakeups < l.parked.load() )
+    {
+        ++l.wakeups;
+        l.cond.notify_one();
     }
 }
 
 template <typename T>
 void thread_pool<T>::append(T* request)
 {
-    m_workqueue.push(request);
+    put(m_workers, request);
+}
+
+template <typename T>
+void thread_pool<T>::append_db(T* request)
+{
+    put(m_db, request);
+}
+
+template <typename T>
+void thread_pool<T>::report(const lane& l, std::string& out)
+{
+    char buf[512];
+    int len = snprintf(buf, sizeof(buf),
+                       "thread_pool_threads{lane=\"%s\"} %d\n"
+                       "thread_pool_queued{lane=\"%s\"} %d\n"
+                       "thread_pool_parked{lane=\"%s\"} %d\n"
+                       "thread_pool_parks{lane=\"%s\"} %lu\n"
+                       "thread_pool_spin_hits{lane=\"%s\"} %lu\n",
+                       l.name, (int)l.threads.size(),
+                       l.name, l.pending.load(std::memory_order_relaxed),
+                       l.name, l.parked.load(std::memory_order_relaxed),
+                       l.name, l.parks.load(std::memory_order_relaxed),
+                       l.name, l.spin_hits.load(std::memory_order_relaxed));
+    out.append(buf, len);
+}
+
+template <typename T>
+void thread_pool<T>::report(std::string& out) const
+{
+    report(m_workers, out);
+    if ( has_db_lane() )
+        report(m_db, out);
 }
 
 #endif
@@ -0,0 +1,907 @@
+#include "proxy.h"
+#include "../http/response.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+reverse_proxy::reverse_proxy() : m_eventfd(-1), m_epollfd(-1), m_close_log(0)
+{
+
+}
+
+reverse_proxy::~reverse_proxy()
+{
+   if ( m_eventfd != -1 )
+   {
+      close(m_eventfd);
+   }
+}
+
+reverse_proxy* reverse_proxy::get_instance()
+{
+   static reverse_proxy proxy;
+   return &proxy;
+}
+
+bool reverse_proxy::load(const char* file_name)
+{
+   FILE* fp = fopen(file_name, "r");
+   if ( fp == NULL )
+      return false;
+
+   char line[1024];
+   while ( fgets(line, sizeof(line), fp) )
+   {
+      if ( line[0] == '#' )
+         continue;
+
+      char* save = NULL;
+      char* prefix = strtok_r(line, " \t\r\n", &save);
+      char* policy = strtok_r(NULL, " \t\r\n", &save);
+      if ( !prefix || !policy || prefix[0] != '/' )
+         continue;
+
+      proxy_route route;
+      route.prefix = prefix;
+      route.policy = (strcasecmp(policy, "lc") == 0) ? LEAST_CONN : ROUND_ROBIN;
+      route.next = 0;
+
+      /*上游地址形如 127.0.0.1:8080*/
+      while ( char* addr = strtok_r(NULL, " \t\r\n", &save) )
+      {
+         char* colon = strrchr(addr, ':');
+         if ( !colon )
+            continue;
+
+         upstream_server server;
+         server.name = addr;
+         *colon = '\0';
+         bzero(&server.addr, sizeof(server.addr));
+         server.addr.sin_family = AF_INET;
+         server.addr.sin_port = htons(atoi(colon + 1));
+         if ( inet_pton(AF_INET, addr, &server.addr.sin_addr) != 1 )
+            continue;
+         server.healthy = true;
+         server.active = 0;
+         server.check_fd = -1;
+         route.servers.push_back(server);
+      }
+
+      if ( !route.servers.empty() )
+         m_routes.push_back(route);
+   }
+   fclose(fp);
+
+   /*前缀长的优先匹配*/
+   std::stable_sort(m_routes.begin(), m_routes.end(),
+                    [](const proxy_route& a, const proxy_route& b)
+                    { return a.prefix.size() > b.prefix.size(); });
+   return true;
+}
+
+int reverse_proxy::init(int epollfd, int close_log)
+{
+   m_epollfd = epollfd;
+   m_close_log = close_log;
+   m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   return m_eventfd;
+}
+
+int reverse_proxy::match(const char* url) const
+{
+   for (size_t i = 0; i < m_routes.size(); ++i)
+   {
+      if ( strncmp(url, m_routes[i].prefix.c_str(), m_routes[i].prefix.size()) == 0 )
+         return i;
+   }
+   return -1;
+}
+
+void reverse_proxy::submit(int client_fd, int route, bool keep_alive, std::string request)
+{
+   proxy_job job;
+   job.client_fd = client_fd;
+   job.route = route;
+   job.keep_alive = keep_alive;
+   job.request = std::move(request);
+   m_jobs.push(std::move(job));
+
+   uint64_t one = 1;
+   ::write(m_eventfd, &one, sizeof(one));
+}
+
+void reverse_proxy::watch(int fd, uint32_t events, bool add)
+{
+   epoll_event event;
+   event.data.fd = fd;
+   event.events = events;
+   epoll_ctl(m_epollfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+}
+
+void reverse_proxy::forget(int fd)
+{
+   epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+   m_owners.erase(fd);
+}
+
+int reverse_proxy::pick_server(proxy_route& route)
+{
+   int n = route.servers.size();
+
+   if ( route.policy == LEAST_CONN )
+   {
+      int best = -1;
+      for (int i = 0; i < n; ++i)
+      {
+         if ( route.servers[i].healthy &&
+              (best == -1 || route.servers[i].active < route.servers[best].active) )
+            best = i;
+      }
+      return best;
+   }
+
+   for (int k = 0; k < n; ++k)
+   {
+      int i = (route.next + k) % n;
+      if ( route.servers[i].healthy )
+      {
+         route.next = i + 1;
+         return i;
+      }
+   }
+   return -1;
+}
+
+int reverse_proxy::acquire(proxy_session* s, bool& reused)
+{
+   upstream_server& server = m_routes[s->route].servers[s->server];
+
+   /*优先复用池中的长连接*/
+   if ( !server.idle.empty() )
+   {
+      int fd = server.idle.back();
+      server.idle.pop_back();
+      reused = true;
+      return fd;
+   }
+
+   int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if ( fd < 0 )
+      return -1;
+
+   int flag = 1;
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+   if ( connect(fd, (struct sockaddr*)&server.addr, sizeof(server.addr)) < 0 &&
+        errno != EINPROGRESS )
+   {
+      close(fd);
+      return -1;
+   }
+
+   reused = false;
+   return fd;
+}
+
+/*把上游连接放回池中，池满了就直接关闭*/
+void reverse_proxy::release(proxy_session* s)
+{
+   upstream_server& server = m_routes[s->route].servers[s->server];
+   int fd = s->upstream_fd;
+   s->upstream_fd = -1;
+
+   if ( !s->reusable || (int)server.idle.size() >= MAX_IDLE_CONN )
+   {
+      forget(fd);
+      close(fd);
+      return;
+   }
+
+   fd_owner owner = { OWNER_IDLE, NULL, s->route, s->server };
+   m_owners[fd] = owner;
+   watch(fd, EPOLLIN | EPOLLRDHUP, false);
+   server.idle.push_back(fd);
+}
+
+void reverse_proxy::dispatch(proxy_result& res)
+{
+   uint64_t cnt = 0;
+   ::read(m_eventfd, &cnt, sizeof(cnt));
+
+   proxy_job job;
+   while ( m_jobs.try_pop(job) )
+   {
+      start(job, res);
+   }
+}
+
+void reverse_proxy::start(proxy_job& job, proxy_result& res)
+{
+   proxy_session* s = new proxy_session;
+   s->client_fd = job.client_fd;
+   s->upstream_fd = -1;
+   s->route = job.route;
+   s->server = -1;
+   s->reused = false;
+   s->keep_alive = job.keep_alive;
+   s->reusable = true;
+   s->client_blocked = false;
+   s->state = CONNECTING;
+   s->deadline = time(NULL) + PROXY_TIMEOUT;
+   s->request = std::move(job.request);
+   s->sent = 0;
+   s->out_off = 0;
+   s->chunked = false;
+   s->until_close = false;
+   s->remaining = 0;
+   s->chunk_state = CHUNK_SIZE;
+   s->chunk_left = 0;
+   s->pipefd[0] = s->pipefd[1] = -1;
+   s->in_pipe = 0;
+
+   m_sessions[s->client_fd] = s;
+   fd_owner owner = { OWNER_CLIENT, s, s->route, -1 };
+   m_owners[s->client_fd] = owner;
+   res.started.push_back(s->client_fd);
+
+   /*客户端连接此时处于 EPOLLONESHOT 失效状态，重新注册为只关注错误*/
+   watch(s->client_fd, 0, false);
+
+   if ( pipe2(s->pipefd, O_NONBLOCK | O_CLOEXEC) < 0 )
+   {
+      fail(s, 500, res);
+      return;
+   }
+
+   connect_upstream(s, res);
+}
+
+/*选择一个健康的上游并建立连接，连接失败时把该上游标记为不健康并换下一个*/
+void reverse_proxy::connect_upstream(proxy_session* s, proxy_result& res)
+{
+   proxy_route& route = m_routes[s->route];
+
+   while ( true )
+   {
+      s->server = pick_server(route);
+      if ( s->server == -1 )
+      {
+         LOG_ERROR("proxy %s: no healthy upstream", route.prefix.c_str());
+         fail(s, 502, res);
+         return;
+      }
+
+      bool reused = false;
+      int fd = acquire(s, reused);
+      if ( fd < 0 )
+      {
+         route.servers[s->server].healthy = false;
+         continue;
+      }
+
+      route.servers[s->server].active++;
+      s->upstream_fd = fd;
+      s->reused = reused;
+      s->state = reused ? SENDING : CONNECTING;
+
+      fd_owner up = { OWNER_UPSTREAM, s, s->route, s->server };
+      m_owners[fd] = up;
+      watch(fd, EPOLLOUT, !reused);
+      return;
+   }
+}
+
+void reverse_proxy::finish(proxy_session* s, bool ok, proxy_result& res)
+{
+   if ( s->upstream_fd != -1 )
+   {
+      if ( !ok )
+         s->reusable = false;
+      release(s);
+   }
+   if ( s->server != -1 )
+   {
+      m_routes[s->route].servers[s->server].active--;
+   }
+   if ( s->pipefd[0] != -1 )
+   {
+      close(s->pipefd[0]);
+      close(s->pipefd[1]);
+   }
+
+   m_owners.erase(s->client_fd);
+   m_sessions.erase(s->client_fd);
+
+   if ( ok && s->keep_alive )
+      res.keep_alive.push_back(s->client_fd);
+   else
+      res.closed.push_back(s->client_fd);
+
+   delete s;
+}
+
+void reverse_proxy::fail(proxy_session* s, int status, proxy_result& res)
+{
+   if ( s->upstream_fd != -1 )
+   {
+      s->reusable = false;
+      release(s);
+   }
+
+   const status_block* block = find_status_block(status);
+   char num[20];
+   const char* body = (status == 504) ? "upstream timed out\n" : "upstream unavailable\n";
+
+   s->keep_alive = false;
+   s->out.assign(block->close, block->close_len);
+   s->out += "Content-Length:";
+   s->out.append(num, format_uint(num, strlen(body)));
+   s->out += "\r\n";
+   s->out.append(http_date::get(), http_date::DATE_LEN);
+   s->out += "\r\n";
+   s->out += body;
+   s->out_off = 0;
+   s->state = FINISHED;
+   s->chunked = false;
+   s->until_close = false;
+   s->remaining = 0;
+   s->in_pipe = 0;
+
+   pump(s, res);
+}
+
+/*
+   上游的重连只在请求肯定没有被处理时进行：
+   池中取出的连接已经被上游关闭时换一个连接，新建的连接连不上或写失败时换一个上游
+*/
+void reverse_proxy::retry(proxy_session* s, proxy_result& res)
+{
+   upstream_server& server = m_routes[s->route].servers[s->server];
+   if ( !s->reused )
+   {
+      LOG_ERROR("proxy upstream %s failed", server.name.c_str());
+      server.healthy = false;
+   }
+
+   s->reusable = false;
+   release(s);
+   server.active--;
+   s->server = -1;
+   s->reusable = true;
+   s->sent = 0;
+   s->head.clear();
+
+   connect_upstream(s, res);
+}
+
+void reverse_proxy::handle_event(int fd, uint32_t events, proxy_result& res)
+{
+   auto it = m_owners.find(fd);
+   if ( it == m_owners.end() )
+      return;
+
+   fd_owner owner = it->second;
+   switch ( owner.type )
+   {
+      case OWNER_UPSTREAM:
+      {
+         on_upstream(owner.session, events, res);
+         break;
+      }
+      case OWNER_CLIENT:
+      {
+         on_client(owner.session, events, res);
+         break;
+      }
+      case OWNER_IDLE:
+      {
+         /*空闲连接可读说明上游关闭了连接或者发送了多余的数据，都不能再复用*/
+         std::vector<int>& idle = m_routes[owner.route].servers[owner.server].idle;
+         idle.erase(std::remove(idle.begin(), idle.end(), fd), idle.end());
+         forget(fd);
+         close(fd);
+         break;
+      }
+      case OWNER_CHECK:
+      {
+         on_check(fd, owner.route, owner.server);
+         break;
+      }
+   }
+}
+
+void reverse_proxy::on_upstream(proxy_session* s, uint32_t events, proxy_result& res)
+{
+   /*
+      连接和发送请求时出错或被挂断，还没有向客户端发送任何数据，换一台上游重试
+      读响应时的挂断由 recv 返回 0 处理，缓冲区中已经收到的数据仍然要读完
+   */
+   if ( s->state == CONNECTING || s->state == SENDING )
+   {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(s->upstream_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if ( err != 0 || (events & (EPOLLERR | EPOLLHUP)) )
+      {
+         retry(s, res);
+         return;
+      }
+   }
+
+   if ( s->state == CONNECTING )
+   {
+      s->state = SENDING;
+   }
+
+   if ( s->state == SENDING )
+   {
+      if ( !send_request(s) )
+      {
+         retry(s, res);
+         return;
+      }
+      if ( s->sent < s->request.size() )
+         return;
+
+      s->state = READ_HEAD;
+      watch(s->upstream_fd, EPOLLIN | EPOLLRDHUP, false);
+      return;
+   }
+
+   if ( s->state == READ_HEAD )
+   {
+      int ret = read_head(s);
+      if ( ret < 0 )
+      {
+         if ( s->reused && s->head.empty() )
+            retry(s, res);
+         else
+            fail(s, 502, res);
+         return;
+      }
+      if ( ret == 0 )
+         return;
+      s->state = READ_BODY;
+   }
+
+   pump(s, res);
+}
+
+void reverse_proxy::on_client(proxy_session* s, uint32_t events, proxy_result& res)
+{
+   if ( events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP) )
+   {
+      finish(s, false, res);
+      return;
+   }
+
+   if ( (events & EPOLLOUT) && s->client_blocked )
+   {
+      s->client_blocked = false;
+      watch(s->client_fd, 0, false);
+      pump(s, res);
+   }
+}
+
+bool reverse_proxy::send_request(proxy_session* s)
+{
+   while ( s->sent < s->request.size() )
+   {
+      int ret = send(s->upstream_fd, s->request.data() + s->sent,
+                     s->request.size() - s->sent, MSG_NOSIGNAL);
+      if ( ret < 0 )
+      {
+         if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            return true;
+         return false;
+      }
+      s->sent += ret;
+   }
+   return true;
+}
+
+/*返回 1 表示响应头已经完整，0 表示还需要继续读，-1 表示出错*/
+int reverse_proxy::read_head(proxy_session* s)
+{
+   char buf[4096];
+   while ( true )
+   {
+      int ret = recv(s->upstream_fd, buf, sizeof(buf), 0);
+      if ( ret < 0 )
+      {
+         if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            return 0;
+         return -1;
+      }
+      if ( ret == 0 )
+         return -1;
+
+      size_t from = s->head.size() > 3 ? s->head.size() - 3 : 0;
+      s->head.append(buf, ret);
+
+      size_t pos = s->head.find("\r\n\r\n", from);
+      if ( pos == std::string::npos )
+      {
+         if ( s->head.size() > MAX_HEAD_SIZE )
+            return -1;
+         continue;
+      }
+
+      if ( !parse_head(s, pos + 4) )
+         return -1;
+      return 1;
+   }
+}
+
+/*
+   解析上游响应头，确定响应体的长度，并把 Connection 头改写成客户端需要的值
+   响应头之后已经读到的响应体也一并放进 out 中
+*/
+bool reverse_proxy::parse_head(proxy_session* s, size_t head_len)
+{
+   const char* head = s->head.c_str();
+   const char* line_end = strstr(head, "\r\n");
+   if ( strncmp(head, "HTTP/1.", 7) != 0 || line_end == NULL || line_end - head < 12 )
+      return false;
+
+   int status = atoi(head + 9);
+   if ( head[7] == '0' )
+      s->reusable = false;
+
+   bool has_length = false;
+   long length = 0;
+   std::string headers;
+
+   const char* line = line_end + 2;
+   const char* end = head + head_len - 2;
+   while ( line < end )
+   {
+      const char* next = strstr(line, "\r\n");
+      if ( next == NULL || next > end )
+         return false;
+      size_t len = next - line;
+
+      if ( strncasecmp(line, "Content-Length:", 15) == 0 )
+      {
+         has_length = true;
+         length = atol(line + 15);
+      }
+      else if ( strncasecmp(line, "Transfer-Encoding:", 18) == 0 )
+      {
+         std::string value(line + 18, len - 18);
+         if ( strcasestr(value.c_str(), "chunked") )
+            s->chunked = true;
+      }
+      else if ( strncasecmp(line, "Connection:", 11) == 0 )
+      {
+         std::string value(line + 11, len - 11);
+         if ( strcasestr(value.c_str(), "close") )
+            s->reusable = false;
+         line = next + 2;
+         continue;
+      }
+      else if ( strncasecmp(line, "Keep-Alive:", 11) == 0 )
+      {
+         line = next + 2;
+         continue;
+      }
+
+      headers.append(line, len + 2);
+      line = next + 2;
+   }
+
+   /*确定响应体的边界*/
+   if ( (status >= 100 && status < 200) || status == 204 || status == 304 )
+   {
+      s->remaining = 0;
+   }
+   else if ( s->chunked )
+   {
+      s->chunk_state = CHUNK_SIZE;
+      s->chunk_left = 0;
+   }
+   else if ( has_length )
+   {
+      s->remaining = length;
+   }
+   else
+   {
+      s->until_close = true;
+      s->reusable = false;
+      s->keep_alive = false;
+   }
+
+   s->out.assign(head, line_end - head + 2);
+   s->out += headers;
+   s->out += s->keep_alive ? "Connection:keep-alive\r\n\r\n" : "Connection:close\r\n\r\n";
+   s->out_off = 0;
+
+   /*已经读到的部分响应体*/
+   const char* body = head + head_len;
+   size_t body_len = s->head.size() - head_len;
+   if ( s->chunked )
+   {
+      feed_chunked(s, body, body_len);
+   }
+   else if ( !s->until_close )
+   {
+      if ( (long)body_len > s->remaining )
+      {
+         body_len = s->remaining;
+         s->reusable = false;
+      }
+      s->remaining -= body_len;
+   }
+   s->out.append(body, body_len);
+   s->head.clear();
+   return true;
+}
+
+void reverse_proxy::feed_chunked(proxy_session* s, const char* data, size_t len)
+{
+   for (size_t i = 0; i < len; ++i)
+   {
+      char c = data[i];
+      switch ( s->chunk_state )
+      {
+         case CHUNK_SIZE:
+         case CHUNK_EXT:
+         {
+            if ( c == '\n' )
+            {
+               s->chunk_state = (s->chunk_left == 0) ? CHUNK_TRAILER : CHUNK_DATA;
+            }
+            else if ( s->chunk_state == CHUNK_SIZE && isxdigit((unsigned char)c) )
+            {
+               int v = isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10);
+               s->chunk_left = s->chunk_left * 16 + v;
+            }
+            else if ( c != '\r' )
+            {
+               s->chunk_state = CHUNK_EXT;
+            }
+            break;
+         }
+         case CHUNK_DATA:
+         {
+            size_t n = std::min((size_t)s->chunk_left, len - i);
+            s->chunk_left -= n;
+            i += n - 1;
+            if ( s->chunk_left == 0 )
+               s->chunk_state = CHUNK_DATA_CR;
+            break;
+         }
+         case CHUNK_DATA_CR:
+         {
+            s->chunk_state = (c == '\n') ? CHUNK_SIZE : CHUNK_DATA_LF;
+            break;
+         }
+         case CHUNK_DATA_LF:
+         {
+            s->chunk_state = CHUNK_SIZE;
+            break;
+         }
+         case CHUNK_TRAILER:
+         {
+            if ( c == '\n' )
+               s->chunk_state = CHUNK_DONE;
+            else if ( c != '\r' )
+               s->chunk_state = CHUNK_TRAILER_LINE;
+            break;
+         }
+         case CHUNK_TRAILER_LINE:
+         {
+            if ( c == '\n' )
+               s->chunk_state = CHUNK_TRAILER;
+            break;
+         }
+         case CHUNK_DONE:
+         {
+            /*响应结束后还有数据，连接不能再复用*/
+            s->reusable = false;
+            return;
+         }
+      }
+   }
+}
+
+/*返回 1 表示写完，0 表示客户端写缓冲区满，-1 表示出错*/
+int reverse_proxy::flush_client(proxy_session* s)
+{
+   while ( s->out_off < s->out.size() )
+   {
+      int ret = send(s->client_fd, s->out.data() + s->out_off,
+                     s->out.size() - s->out_off, MSG_NOSIGNAL);
+      if ( ret < 0 )
+      {
+         if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            return 0;
+         return -1;
+      }
+      s->out_off += ret;
+   }
+   s->out.clear();
+   s->out_off = 0;
+   return 1;
+}
+
+/*
+   把上游的响应尽可能多地转发给客户端
+   有 Content-Length 时走 splice：上游 -> 管道 -> 客户端
+   chunked 或读到关闭为止的响应需要识别结束位置，走用户态拷贝
+*/
+void reverse_proxy::pump(proxy_session* s, proxy_result& res)
+{
+   char buf[16384];
+
+   while ( true )
+   {
+      /*先把用户态缓冲区和管道中的数据写给客户端*/
+      int ret = flush_client(s);
+      while ( ret == 1 && s->in_pipe > 0 )
+      {
+         int n = splice(s->pipefd[0], NULL, s->client_fd, NULL, s->in_pipe,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+         if ( n < 0 )
+            ret = (errno == EAGAIN) ? 0 : -1;
+         else
+            s->in_pipe -= n;
+      }
+
+      if ( ret < 0 )
+      {
+         finish(s, false, res);
+         return;
+      }
+      if ( ret == 0 )
+      {
+         /*客户端写不动了，暂停读上游，等客户端可写*/
+         s->client_blocked = true;
+         watch(s->client_fd, EPOLLOUT, false);
+         if ( s->upstream_fd != -1 )
+            watch(s->upstream_fd, 0, false);
+         return;
+      }
+
+      /*响应已经完整转发*/
+      bool done = (s->state == FINISHED) ||
+                  (s->chunked ? (s->chunk_state == CHUNK_DONE)
+                              : (!s->until_close && s->remaining == 0));
+      if ( done )
+      {
+         finish(s, true, res);
+         return;
+      }
+
+      if ( !s->chunked && !s->until_close )
+      {
+         long want = std::min(s->remaining, (long)SPLICE_CHUNK);
+         int n = splice(s->upstream_fd, NULL, s->pipefd[1], NULL, want,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+         if ( n > 0 )
+         {
+            s->remaining -= n;
+            s->in_pipe += n;
+            continue;
+         }
+         if ( n < 0 && errno == EAGAIN )
+            break;
+         finish(s, false, res);
+         return;
+      }
+
+      int n = recv(s->upstream_fd, buf, sizeof(buf), 0);
+      if ( n > 0 )
+      {
+         if ( s->chunked )
+            feed_chunked(s, buf, n);
+         s->out.append(buf, n);
+         continue;
+      }
+      if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+         break;
+      if ( n == 0 && s->until_close )
+      {
+         s->state = FINISHED;
+         continue;
+      }
+      finish(s, false, res);
+      return;
+   }
+
+   watch(s->upstream_fd, EPOLLIN | EPOLLRDHUP, false);
+}
+
+void reverse_proxy::on_check(int fd, int route, int server)
+{
+   upstream_server& srv = m_routes[route].servers[server];
+
+   int err = 0;
+   socklen_t len = sizeof(err);
+   getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+   bool healthy = (err == 0);
+   if ( healthy != srv.healthy )
+   {
+      LOG_INFO("proxy upstream %s is %s", srv.name.c_str(), healthy ? "up" : "down");
+   }
+   srv.healthy = healthy;
+   srv.check_fd = -1;
+   forget(fd);
+   close(fd);
+}
+
+void reverse_proxy::tick(proxy_result& res)
+{
+   time_t cur = time(NULL);
+
+   /*超时的代理请求*/
+   std::vector<proxy_session*> expired;
+   for (auto& it : m_sessions)
+   {
+      if ( it.second->deadline <= cur )
+         expired.push_back(it.second);
+   }
+   for (proxy_session* s : expired)
+   {
+      LOG_ERROR("proxy request of fd %d timed out", s->client_fd);
+      if ( s->state < READ_BODY )
+         fail(s, 504, res);
+      else
+         finish(s, false, res);
+   }
+
+   /*健康检查：上一轮还没有连上的视为不健康*/
+   for (size_t r = 0; r < m_routes.size(); ++r)
+   {
+      for (size_t i = 0; i < m_routes[r].servers.size(); ++i)
+      {
+         upstream_server& srv = m_routes[r].servers[i];
+         if ( srv.check_fd != -1 )
+         {
+            if ( srv.healthy )
+            {
+               LOG_INFO("proxy upstream %s is down", srv.name.c_str());
+            }
+            srv.healthy = false;
+            forget(srv.check_fd);
+            close(srv.check_fd);
+            srv.check_fd = -1;
+         }
+
+         int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+         if ( fd < 0 )
+            continue;
+
+         if ( connect(fd, (struct sockaddr*)&srv.addr, sizeof(srv.addr)) == 0 )
+         {
+            srv.healthy = true;
+            close(fd);
+         }
+         else if ( errno == EINPROGRESS )
+         {
+            srv.check_fd = fd;
+            fd_owner owner = { OWNER_CHECK, NULL, (int)r, (int)i };
+            m_owners[fd] = owner;
+            watch(fd, EPOLLOUT, true);
+         }
+         else
+         {
+            srv.healthy = false;
+            close(fd);
+         }
+      }
+   }
+}
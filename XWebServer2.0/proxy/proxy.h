@@ -0,0 +1,219 @@
+/*
+   反向代理（全局只允许一个实例）
+   1、按 URL 前缀把请求转发给上游 HTTP 服务器，路由在启动时从配置文件加载
+   2、工作线程只负责把请求序列化好交过来，之后所有上游读写都在事件循环中以非阻塞方式完成
+   3、每个上游服务器维护一个长连接池，请求结束后连接放回池中复用，避免每次都三次握手
+   4、负载均衡支持轮询（rr）和最少连接（lc），定时器每次触发时对上游做一次 TCP 健康检查
+   5、响应体有 Content-Length 时使用 splice 经由管道直接转发给客户端，不经过用户态
+   配置文件每行一个路由，# 开头为注释：
+      URL前缀  rr|lc  上游地址1:端口 [上游地址2:端口 ...]
+*/
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <netinet/in.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "../thread_safe_queue/thread_safe_queue.h"
+#include "../log/log.h"
+
+/*交还给 WebServer 处理的客户端连接*/
+struct proxy_result
+{
+   std::vector<int>  started;       //开始代理的客户端，需要移除空闲定时器
+   std::vector<int>  keep_alive;    //代理结束并保持长连接，需要重新接收请求
+   std::vector<int>  closed;        //代理结束需要关闭的客户端
+};
+
+class reverse_proxy
+{
+public:
+   static const int MAX_IDLE_CONN      = 32;          //每个上游最多缓存的空闲连接
+   static const int MAX_HEAD_SIZE      = 8192;        //上游响应头最大长度
+   static const int SPLICE_CHUNK       = 65536;       //每次 splice 的最大字节数
+   static const int PROXY_TIMEOUT      = 15;          //单个代理请求的超时时间（秒）
+
+   enum POLICY
+   {
+      ROUND_ROBIN = 0,
+      LEAST_CONN
+   };
+
+private:
+   /*上游服务器*/
+   struct upstream_server
+   {
+      sockaddr_in       addr;
+      std::string       name;
+      bool              healthy;
+      int               active;        //正在处理的请求数
+      std::vector<int>  idle;          //空闲的长连接
+      int               check_fd;      //正在进行的健康检查
+   };
+
+   /*路由*/
+   struct proxy_route
+   {
+      std::string       prefix;
+      POLICY            policy;
+      unsigned          next;          //轮询位置
+      std::vector<upstream_server>
+                        servers;
+   };
+
+   /*工作线程交过来的请求*/
+   struct proxy_job
+   {
+      int               client_fd;
+      int               route;
+      bool              keep_alive;
+      std::string       request;
+   };
+
+   enum SESSION_STATE
+   {
+      CONNECTING = 0,
+      SENDING,
+      READ_HEAD,
+      READ_BODY,
+      FINISHED
+   };
+
+   /*只用来判断 chunked 响应体在哪里结束*/
+   enum CHUNK_STATE
+   {
+      CHUNK_SIZE = 0,
+      CHUNK_EXT,
+      CHUNK_DATA,
+      CHUNK_DATA_CR,
+      CHUNK_DATA_LF,
+      CHUNK_TRAILER,
+      CHUNK_TRAILER_LINE,
+      CHUNK_DONE
+   };
+
+   /*一次代理请求*/
+   struct proxy_session
+   {
+      int               client_fd;
+      int               upstream_fd;
+      int               route;
+      int               server;
+      bool              reused;        //上游连接是否从池中取出
+      bool              keep_alive;    //客户端是否长连接
+      bool              reusable;      //上游连接结束后是否还能复用
+      bool              client_blocked;//客户端写缓冲区满
+      SESSION_STATE     state;
+      time_t            deadline;
+
+      std::string       request;
+      size_t            sent;
+
+      std::string       head;          //上游响应头
+      std::string       out;           //待写给客户端的数据
+      size_t            out_off;
+
+      bool              chunked;
+      bool              until_close;   //没有长度信息，读到上游关闭为止
+      long              remaining;     //Content-Length 模式下剩余的字节数
+      CHUNK_STATE       chunk_state;
+      long              chunk_left;
+
+      int               pipefd[2];     //splice 使用的管道
+      long              in_pipe;       //管道中还没有写给客户端的字节
+   };
+
+   /*epoll 中每个描述符属于谁*/
+   enum OWNER
+   {
+      OWNER_UPSTREAM = 0,              //代理中的上游连接
+      OWNER_CLIENT,                    //代理中的客户端连接
+      OWNER_IDLE,                      //池中的空闲连接
+      OWNER_CHECK                      //健康检查
+   };
+
+   struct fd_owner
+   {
+      OWNER             type;
+      proxy_session*    session;
+      int               route;
+      int               server;
+   };
+
+   std::vector<proxy_route>   m_routes;
+   std::unordered_map<int, fd_owner>
+                              m_owners;
+   std::unordered_map<int, proxy_session*>
+                              m_sessions;    //客户端 -> 会话
+   thread_safe_queue<proxy_job>
+                              m_jobs;
+   int                        m_eventfd;
+   int                        m_epollfd;
+   int                        m_close_log;
+
+private:
+   reverse_proxy();
+   ~reverse_proxy();
+
+   /*选择上游服务器，没有可用的返回 -1*/
+   int               pick_server(proxy_route& route);
+
+   /*从连接池取一个连接，没有就新建一个非阻塞连接*/
+   int               acquire(proxy_session* s, bool& reused);
+   void              release(proxy_session* s);
+
+   void              start(proxy_job& job, proxy_result& res);
+   void              connect_upstream(proxy_session* s, proxy_result& res);
+   void              finish(proxy_session* s, bool ok, proxy_result& res);
+
+   /*在还没有向客户端写任何数据之前失败，返回错误页面*/
+   void              fail(proxy_session* s, int status, proxy_result& res);
+
+   /*还没有收到响应之前上游连接失败，换一个连接或上游重新发送*/
+   void              retry(proxy_session* s, proxy_result& res);
+
+   void              on_upstream(proxy_session* s, uint32_t events, proxy_result& res);
+   void              on_client(proxy_session* s, uint32_t events, proxy_result& res);
+
+   bool              send_request(proxy_session* s);
+   int               read_head(proxy_session* s);
+   bool              parse_head(proxy_session* s, size_t head_len);
+   int               flush_client(proxy_session* s);
+   void              pump(proxy_session* s, proxy_result& res);
+   void              feed_chunked(proxy_session* s, const char* data, size_t len);
+
+   void              watch(int fd, uint32_t events, bool add);
+   void              forget(int fd);
+
+   void              on_check(int fd, int route, int server);
+
+public:
+   static reverse_proxy*
+                     get_instance();
+
+   /*加载路由配置，失败返回 false*/
+   bool              load(const char* file_name);
+
+   /*创建 eventfd，返回值需要由事件循环注册到 epoll 中*/
+   int               init(int epollfd, int close_log);
+
+   /*返回匹配的路由编号，没有返回 -1；路由只在启动时加载，可以在工作线程中调用*/
+   int               match(const char* url) const;
+
+   /*工作线程调用，把序列化好的请求交给事件循环*/
+   void              submit(int client_fd, int route, bool keep_alive, std::string request);
+
+   /*以下函数只能在事件循环所在的线程调用*/
+   bool              owns(int fd) const { return m_owners.find(fd) != m_owners.end(); }
+   void              dispatch(proxy_result& res);
+   void              handle_event(int fd, uint32_t events, proxy_result& res);
+
+   /*定时器触发时调用：健康检查和超时处理*/
+   void              tick(proxy_result& res);
+};
+
+#endif
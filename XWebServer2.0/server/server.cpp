@@ -41,14 +41,22 @@ WebServer::~WebServer()
    close(m_listenfd);
    close(m_pipefd[1]);
    close(m_pipefd[0]);
+   close(m_clockfd);
+   close(m_proxyfd);
+   close(m_fcgifd);
+   //先等工作线程退出，它们可能还在处理某个连接
+   if( m_pool )delete m_pool;
    if( users )delete[] users;
    if( users_timer )delete[] users_timer;
-   if( m_pool )delete m_pool;
 }
 
 void WebServer::init(int port, std::string user, std::string passWord, 
                      std::string databaseName,bool async, int opt_linger, 
-                     int trigmode, int sql_num, int thread_num, int close_log)
+                     int trigmode, int sql_num, int thread_num, int close_log,
+                     std::string vhost_file, std::string proxy_file, std::string fcgi_file,
+                     int reg_window, int reg_batch, int sql_local, int sql_min,
+                     std::string user_store, int session_ttl, int snapshot_interval,
+                     int query_cache_mb, std::string replicas, int lookup_window)
 {
    m_port         = port;
    m_user         = user;
@@ -60,6 +68,19 @@ void WebServer::init(int port, std::string user, std::string passWord,
    m_sql_num      = sql_num;
    m_thread_num   = thread_num;
    m_close_log    = close_log;
+   m_vhost_file   = vhost_file;
+   m_proxy_file   = proxy_file;
+   m_fcgi_file    = fcgi_file;
+   m_reg_window   = reg_window;
+   m_reg_batch    = reg_batch;
+   m_sql_local    = sql_local;
+   m_sql_min      = sql_min;
+   m_user_store   = user_store;
+   m_session_ttl  = session_ttl;
+   m_snapshot_interval = snapshot_interval;
+   m_query_cache_mb = query_cache_mb;
+   m_replicas     = replicas;
+   m_lookup_window = lookup_window;
 }
 
 void WebServer::set_trigmode()
@@ -99,18 +120,135 @@ void WebServer::set_log()
    }
 }
 
+void WebServer::set_vhost()
+{
+   //默认虚拟主机使用启动目录下的 root 文件夹
+   vhost_table* table = vhost_table::get_instance();
+   table->set_default(m_root, http::READ_BUFFER_SIZE);
+
+   if ( !m_vhost_file.empty() )
+   {
+      if ( !table->load(m_vhost_file.c_str()) )
+      {
+         LOG_ERROR("load vhost file %s failed", m_vhost_file.c_str());
+      }
+      else
+      {
+         LOG_INFO("load %d vhosts from %s", (int)table->size(), m_vhost_file.c_str());
+      }
+   }
+}
+
+void WebServer::set_proxy()
+{
+   if ( m_proxy_file.empty() )
+      return;
+
+   if ( !reverse_proxy::get_instance()->load(m_proxy_file.c_str()) )
+   {
+      LOG_ERROR("load proxy file %s failed", m_proxy_file.c_str());
+   }
+}
+
+void WebServer::set_fastcgi()
+{
+   if ( m_fcgi_file.empty() )
+      return;
+
+   if ( !fastcgi_client::get_instance()->load(m_fcgi_file.c_str()) )
+   {
+      LOG_ERROR("load fastcgi file %s failed", m_fcgi_file.c_str());
+   }
+}
+
 void WebServer::set_sqlpool()
 {
-   //初始化数据库连接池
+   //初始化数据库连接池，只有 MySQL 后端需要，初始连接在后台同时建立
    m_connPool = connection_pool::GetInstance();
-   m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 
-                  3306, m_sql_num, m_close_log);
+   if ( m_user_store == "mysql" )
+   {
+      m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 
+                     3306, m_sql_num, m_close_log, m_sql_local, m_sql_min);
+
+      //从库各自一个连接池，读取由 db_router 在从库之间选择
+      db_router::get_instance()->init(m_connPool, m_replicas, m_user, m_passWord, m_databaseName,
+                                      m_sql_num, m_sql_min, m_close_log);
+   }
+
+   //连接池前面的查询结果缓存
+   query_cache::get_instance()->init((size_t)m_query_cache_mb << 20);
+
+   //用户数据的存储后端
+   db_params params = { m_user, m_passWord, m_databaseName, m_sql_num, m_sql_min, m_lookup_window };
+   m_store = user_store::create(m_user_store, m_connPool, m_close_log, &params);
+   if ( m_store == NULL )
+   {
+      LOG_ERROR("create user store %s failed", m_user_store.c_str());
+      exit(1);
+   }
+
+   //登录会话表
+   session_table::get_instance()->init(m_session_ttl);
+
+   //数据库阶段在后台完成，监听端口不用等它，完成之前登录和注册返回 503
+   std::thread(&WebServer::set_userdata, this).detach();
+}
+
+void WebServer::set_userdata()
+{
+   startup_stage stage("db");
+
+   //等连接池达到最小连接数，数据库不可用时由连接池的后台线程重试
+   if ( m_user_store == "mysql" )
+   {
+      startup_stage pool_stage("db_pool");
+      if ( !m_connPool->WaitReady() )
+         return;
+   }
+
+   /*
+      用户信息只在启动时加载一次，启用快照时先映射快照，只加载水位之后的用户
+      加载失败时缓存和布隆过滤器不完整，注册会把已有的用户名当成新的，
+      所以不进入就绪状态（登录和注册继续返回 503），间隔从 1 秒开始翻倍重试
+   */
+   {
+      startup_stage cache_stage("user_cache");
+      int delay = 1;
+      while ( true )
+      {
+         int count = user_cache::get_instance()->load(m_store, m_close_log, 
+                                                      m_snapshot_interval > 0 ? USER_SNAPSHOT : "",
+                                                      m_user_store);
+         if ( count >= 0 )
+         {
+            LOG_INFO("load %d users into cache", count);
+            break;
+         }
+
+         LOG_ERROR("load user cache failed, retry in %d s", delay);
+         std::this_thread::sleep_for(std::chrono::seconds(delay));
+         delay = std::min(delay * 2, LOAD_RETRY_MAX);
+         if ( m_user_store == "mysql" && !m_connPool->WaitReady() )
+            return;
+      }
+   }
+
+   user_cache::get_instance()->start_snapshot(m_snapshot_interval);
+
+   //注册写入线程，合并同一时间窗口内的注册
+   if ( !register_writer::get_instance()->init(m_store, m_reg_window, m_reg_batch, m_close_log) )
+   {
+      LOG_ERROR("%s", "start register writer failed, register directly");
+   }
+
+   startup::get_instance()->set_ready(startup::STAGE_DB);
 }
 
 void WebServer::set_threadpool()
 {
-   //线程池
-   m_pool = new thread_pool<http>(m_connPool, m_thread_num);
+   //线程池，登录和注册由同样数量的数据库通道线程处理，数据库慢的时候静态资源不受影响
+   m_pool = new thread_pool<http>(m_connPool, m_thread_num, m_thread_num, MAX_FD);
+   http::m_pool = m_pool;
 }
 
 void WebServer::eventListen()
@@ -162,6 +300,32 @@ void WebServer::eventListen()
    utils.setnonblocking(m_pipefd[1]);
    utils.addfd(m_epollfd, m_pipefd[0], false, 0);
 
+   //SSE 事件下发
+   m_ssefd = sse_hub::get_instance()->init(m_epollfd, m_close_log);
+   assert(m_ssefd != -1);
+   utils.addfd(m_epollfd, m_ssefd, false, 0);
+
+   //反向代理
+   m_proxyfd = reverse_proxy::get_instance()->init(m_epollfd, m_close_log);
+   assert(m_proxyfd != -1);
+   utils.addfd(m_epollfd, m_proxyfd, false, 0);
+
+   //FastCGI
+   m_fcgifd = fastcgi_client::get_instance()->init(m_epollfd, m_close_log);
+   assert(m_fcgifd != -1);
+   utils.addfd(m_epollfd, m_fcgifd, false, 0);
+
+   //非阻塞数据库，没有启用或者不是 MySQL 后端时只用来接收写入线程交回的结果
+   m_sqlfd = async_sql::get_instance()->init(m_epollfd, "localhost", m_user, m_passWord, m_databaseName,
+                                             3306, m_user_store == "mysql" ? m_sql_num : 0, m_close_log);
+   assert(m_sqlfd != -1);
+   utils.addfd(m_epollfd, m_sqlfd, false, 0);
+
+   //每秒刷新一次 Date 头
+   m_clockfd = utils.init_clock();
+   assert(m_clockfd != -1);
+   utils.addfd(m_epollfd, m_clockfd, false, 0);
+
    utils.addsig(SIGPIPE, SIG_IGN);
    utils.addsig(SIGALRM, utils.sig_handler, false);
    utils.addsig(SIGTERM, utils.sig_handler, false);
@@ -178,9 +342,15 @@ void WebServer::add_timer(int connfd, struct sockaddr_in client_address)
    users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
 
    //初始化client_data数据
-   //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
    users_timer[connfd].address = client_address;
    users_timer[connfd].sockfd = connfd;
+   users_timer[connfd].conn = users + connfd;
+   attach_timer(connfd);
+}
+
+//创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到时间堆中
+void WebServer::attach_timer(int connfd)
+{
    heap_timer* timer = new heap_timer;
    timer->user_data = &users_timer[connfd];
    timer->cb_func = cb_func;
@@ -201,9 +371,28 @@ void WebServer::adjust_timer(heap_timer* timer)
    LOG_INFO("%s", "adjust timer once");
 }
 
+//连接交给 sse_hub、reverse_proxy 或 fastcgi_client 接管时移除空闲定时器
+void WebServer::detach_timer(int sockfd)
+{
+   heap_timer* timer = users_timer[sockfd].timer;
+   if ( timer )
+   {
+      utils.m_timer_heap.del_timer(timer);
+      delete timer;
+      users_timer[sockfd].timer = NULL;
+   }
+}
+
 void WebServer::deal_timer(heap_timer* timer, int sockfd)
 {
-   timer->cb_func(&users_timer[sockfd]);
+   if ( users[sockfd].is_sse() )
+   {
+      close_sse(sockfd);
+      return;
+   }
+
+   //请求还在线程池中时 cb_func 只做取消标记，连接由处理线程关闭
+   cb_func(&users_timer[sockfd]);
 
    if ( timer )
    {
@@ -299,17 +488,25 @@ void WebServer::deal_read(int sockfd)
 {
    heap_timer* timer = users_timer[sockfd].timer;
 
+   //event-stream 客户端不会再发送数据，可读说明对端关闭或出错
+   if ( sse_hub::get_instance()->is_subscriber(sockfd) )
+   {
+      close_sse(sockfd);
+      return;
+   }
+
    if ( users[sockfd].read() )
    {
       LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
-      //若监测到读事件，将该事件放入请求队列
-      m_pool->append(users + sockfd);
-
       if ( timer )
       {
          adjust_timer(timer);
       }
+
+      //若监测到读事件，将该事件放入请求队列，请求的截止时间就是刚延后的定时器的到期时间
+      users[sockfd].start_work(timer ? timer->expire : 0);
+      m_pool->append(users + sockfd);
    }
    else
    {
@@ -322,10 +519,27 @@ void WebServer::deal_write(int sockfd)
 {
    heap_timer*timer = users_timer[sockfd].timer;
 
+   //订阅者上次没写完的事件
+   if ( sse_hub::get_instance()->is_subscriber(sockfd) )
+   {
+      if ( !sse_hub::get_instance()->flush(sockfd) )
+      {
+         close_sse(sockfd);
+      }
+      return;
+   }
+
    if ( users[sockfd].write() )
    {
       LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
+      //SSE 响应头已经全部发送完毕，转为长连接，没写完时等下一次可写事件
+      if ( users[sockfd].is_sse() && users[sockfd].write_done() )
+      {
+         deal_sse(sockfd);
+         return;
+      }
+
       if ( timer )
       {
          adjust_timer(timer);
@@ -337,6 +551,59 @@ void WebServer::deal_write(int sockfd)
    }
 }
 
+void WebServer::deal_sse(int sockfd)
+{
+   //SSE 连接的存活由心跳是否写成功来判断
+   detach_timer(sockfd);
+   sse_hub::get_instance()->subscribe(sockfd, users[sockfd].sse_channel());
+}
+
+void WebServer::close_sse(int sockfd)
+{
+   sse_hub::get_instance()->unsubscribe(sockfd);
+   detach_timer(sockfd);
+   users[sockfd].close_conn();
+   LOG_INFO("close sse fd %d", sockfd);
+}
+
+void WebServer::deal_sse_events()
+{
+   std::vector<int> dead;
+   sse_hub::get_instance()->dispatch(dead);
+   for (int sockfd : dead)
+   {
+      close_sse(sockfd);
+   }
+}
+
+void WebServer::deal_sse_heartbeat()
+{
+   std::vector<int> dead;
+   sse_hub::get_instance()->heartbeat(dead);
+   for (int sockfd : dead)
+   {
+      close_sse(sockfd);
+   }
+}
+
+void WebServer::deal_proxy(proxy_result& res)
+{
+   for (int sockfd : res.started)
+   {
+      detach_timer(sockfd);
+   }
+   for (int sockfd : res.keep_alive)
+   {
+      attach_timer(sockfd);
+      users[sockfd].reset_conn();
+   }
+   for (int sockfd : res.closed)
+   {
+      users[sockfd].close_conn();
+      LOG_INFO("close proxied fd %d", sockfd);
+   }
+}
+
 void WebServer::eventLoop()
 {
    bool timeout = false;
@@ -362,7 +629,57 @@ void WebServer::eventLoop()
             if ( flag == false )
                continue;
          }
-         else if ( events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR) )
+         //处理其他线程发布的 SSE 事件
+         else if ( sockfd == m_ssefd )
+         {
+            deal_sse_events();
+         }
+         //刷新 Date 头
+         else if ( sockfd == m_clockfd )
+         {
+            utils.clock_handler(m_clockfd);
+         }
+         //工作线程交过来的代理请求
+         else if ( sockfd == m_proxyfd )
+         {
+            proxy_result res;
+            reverse_proxy::get_instance()->dispatch(res);
+            deal_proxy(res);
+         }
+         //代理中的上游连接和客户端连接
+         else if ( reverse_proxy::get_instance()->owns(sockfd) )
+         {
+            proxy_result res;
+            reverse_proxy::get_instance()->handle_event(sockfd, events[i].events, res);
+            deal_proxy(res);
+         }
+         //工作线程交过来的 FastCGI 请求
+         else if ( sockfd == m_fcgifd )
+         {
+            proxy_result res;
+            fastcgi_client::get_instance()->dispatch(res);
+            deal_proxy(res);
+         }
+         //到应用服务器的连接和等待应用响应的客户端连接
+         else if ( fastcgi_client::get_instance()->owns(sockfd) )
+         {
+            proxy_result res;
+            fastcgi_client::get_instance()->handle_event(sockfd, events[i].events, res);
+            deal_proxy(res);
+         }
+         //数据库结果和挂起请求的回调
+         else if ( sockfd == m_sqlfd )
+         {
+            async_sql::get_instance()->dispatch();
+         }
+         //非阻塞数据库连接
+         else if ( async_sql::get_instance()->owns(sockfd) )
+         {
+            async_sql::get_instance()->handle_event(sockfd, events[i].events);
+         }
+         //对端只是关闭了写方向时还能收响应，有待发送的响应先发送
+         else if ( (events[i].events & (EPOLLHUP | EPOLLERR)) || 
+                   ((events[i].events & EPOLLRDHUP) && !(events[i].events & EPOLLOUT)) )
          {
             //服务器端关闭连接，移除对应的定时器
             heap_timer* timer = users_timer[sockfd].timer;
@@ -387,7 +704,17 @@ void WebServer::eventLoop()
       }
       if ( timeout )
       {
+         //先把新登录的会话挂到时间堆上，再处理到期的定时器
+         session_table::get_instance()->schedule(utils.m_timer_heap);
          utils.timer_handler();
+         deal_sse_heartbeat();
+
+         proxy_result res;
+         reverse_proxy::get_instance()->tick(res);
+         fastcgi_client::get_instance()->tick(res);
+         deal_proxy(res);
+
+         async_sql::get_instance()->tick();
 
          LOG_INFO("%s", "timer tick");
 
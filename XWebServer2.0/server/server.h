@@ -16,12 +16,16 @@
 #include "../pool/thread_pool.h"
 #include "../http/http.h"
 #include "../timer/timer.h"
+#include "../user/user_store.h"
+#include "../startup/startup.h"
 
 const int MAX_FD           = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000;          //最大事件数
 const int TIMESLOT         = 5;              //最小超时单位
 const int LOG_BUF_SIZE     = 2000;           //日志缓冲区大小
 const int LOG_MAX_LINES    = 800000;         //日志行数
+const char* const USER_SNAPSHOT = "./UserSnapshot";   //用户表快照文件
+const int LOAD_RETRY_MAX   = 30;             //加载用户缓存失败后重试的最大间隔（秒）
 
 class WebServer
 {
@@ -31,8 +35,18 @@ public:
    char*                      m_root;
    bool                       m_async;
    int                        m_close_log;
+   std::string                m_vhost_file;
+   std::string                m_proxy_file;
+   std::string                m_fcgi_file;
+   int                        m_reg_window;
+   int                        m_reg_batch;
    int                        m_pipefd[2];
    int                        m_epollfd;
+   int                        m_ssefd;
+   int                        m_clockfd;
+   int                        m_proxyfd;
+   int                        m_fcgifd;
+   int                        m_sqlfd;
    http*                      users;
 
    /*数据库相关信息*/
@@ -41,6 +55,15 @@ public:
    std::string                m_passWord;     
    std::string                m_databaseName; 
    int                        m_sql_num;
+   int                        m_sql_local;
+   int                        m_sql_min;
+   std::string                m_user_store;
+   user_store*                m_store;
+   int                        m_session_ttl;
+   int                        m_snapshot_interval;
+   int                        m_query_cache_mb;
+   std::string                m_replicas;
+   int                        m_lookup_window;
 
    /*线程池相关信息*/
    thread_pool<http>*         m_pool;
@@ -74,23 +97,49 @@ public:
          5、是否开启异步写日志
          6、是否优雅关闭连接
          7、触发模式（ ET/LT）
-         8、数据库连接数量
+         8、数据库连接池的最大连接数
          9、线程数量
          10、是否关闭日志
+         11、虚拟主机配置文件，为空则只使用默认根目录
+         12、反向代理路由配置文件，为空则不转发
+         13、FastCGI 路由配置文件，为空则不使用
+         14、注册合并提交的时间窗口（微秒），0 表示不合并
+         15、注册合并提交时一批最多的请求数
+         16、每个工作线程的专属数据库连接数，0 表示都从共享的连接池中取
+         17、数据库连接池的最小连接数
+         18、用户数据的存储后端：mysql、shard:地址列表[/旧地址列表]、sqlite[:路径]、memory
+         19、登录会话的有效期（秒）
+         20、用户表快照的写入间隔（秒），0 表示不使用快照
+         21、查询结果缓存的内存预算（MB），0 表示不使用
+         22、只读从库列表，逗号分隔的 主机:端口，为空时读写都走主库
+         23、登录查询合并的时间窗口（微秒），0 表示不合并
    */
    void init(int port, std::string user, std::string passWord, std::string databaseName,
              bool async, int opt_linger, int trigmode, 
-             int sql_num, int thread_num, int close_log);
+             int sql_num, int thread_num, int close_log, std::string vhost_file = "",
+             std::string proxy_file = "", std::string fcgi_file = "",
+             int reg_window = 0, int reg_batch = 1, int sql_local = 0,
+             int sql_min = 0, std::string user_store = "mysql",
+             int session_ttl = session_table::DEFAULT_TTL, int snapshot_interval = 0,
+             int query_cache_mb = 0, std::string replicas = "", int lookup_window = 0);
 
    void set_threadpool();
    void set_sqlpool();
+
+   /*数据库阶段：等连接池就绪、加载用户缓存、启动注册写入线程，在后台线程中执行*/
+   void set_userdata();
    void set_log();
    void set_trigmode();
+   void set_vhost();
+   void set_proxy();
+   void set_fastcgi();
 
    void eventListen();
    void eventLoop();
 
    void add_timer(int connfd, struct sockaddr_in client_address);
+   void attach_timer(int connfd);
+   void detach_timer(int sockfd);
    void adjust_timer(heap_timer* timer);
    void deal_timer(heap_timer* timer, int sockfd);
 
@@ -99,6 +148,15 @@ public:
    void deal_read(int sockfd);
    void deal_write(int sockfd);
 
+   /*SSE 长连接不参与空闲超时，由 sse_hub 维护并依靠定时器发送心跳*/
+   void deal_sse(int sockfd);
+   void close_sse(int sockfd);
+   void deal_sse_events();
+   void deal_sse_heartbeat();
+
+   /*反向代理或 FastCGI 请求开始、结束时，处理被接管的客户端连接*/
+   void deal_proxy(proxy_result& res);
+
 };
 
 #endif
@@ -0,0 +1,192 @@
+#include "sse.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <algorithm>
+
+sse_hub::sse_hub() : m_eventfd(-1), m_epollfd(-1), m_close_log(0)
+{
+
+}
+
+sse_hub::~sse_hub()
+{
+   if ( m_eventfd != -1 )
+   {
+      close(m_eventfd);
+   }
+}
+
+sse_hub* sse_hub::get_instance()
+{
+   static sse_hub hub;
+   return &hub;
+}
+
+int sse_hub::init(int epollfd, int close_log)
+{
+   m_epollfd = epollfd;
+   m_close_log = close_log;
+   m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   return m_eventfd;
+}
+
+/*
+   按 event-stream 格式序列化事件
+   多行数据需要拆成多个 data: 字段
+*/
+void sse_hub::publish(const std::string& channel, const std::string& data, 
+                      const std::string& event_name)
+{
+   event ev;
+   ev.channel = channel;
+
+   if ( !event_name.empty() )
+   {
+      ev.payload += "event: ";
+      ev.payload += event_name;
+      ev.payload += "\n";
+   }
+
+   size_t start = 0;
+   while ( true )
+   {
+      size_t end = data.find('\n', start);
+      ev.payload += "data: ";
+      ev.payload.append(data, start, end == std::string::npos ? std::string::npos : end - start);
+      ev.payload += "\n";
+      if ( end == std::string::npos )
+         break;
+      start = end + 1;
+   }
+   ev.payload += "\n";
+
+   m_events.push(std::move(ev));
+
+   /*唤醒事件循环*/
+   uint64_t one = 1;
+   ::write(m_eventfd, &one, sizeof(one));
+}
+
+void sse_hub::subscribe(int sockfd, const std::string& channel)
+{
+   m_subscribers[sockfd].channel = channel;
+   m_channels[channel].push_back(sockfd);
+   LOG_INFO("sse subscribe fd %d channel %s", sockfd, channel.c_str());
+}
+
+void sse_hub::unsubscribe(int sockfd)
+{
+   auto it = m_subscribers.find(sockfd);
+   if ( it == m_subscribers.end() )
+      return;
+
+   auto ch = m_channels.find(it->second.channel);
+   if ( ch != m_channels.end() )
+   {
+      std::vector<int>& fds = ch->second;
+      fds.erase(std::remove(fds.begin(), fds.end(), sockfd), fds.end());
+      if ( fds.empty() )
+         m_channels.erase(ch);
+   }
+
+   m_subscribers.erase(it);
+   LOG_INFO("sse unsubscribe fd %d", sockfd);
+}
+
+bool sse_hub::is_subscriber(int sockfd) const
+{
+   return m_subscribers.find(sockfd) != m_subscribers.end();
+}
+
+bool sse_hub::send_to(int sockfd, subscriber& sub, const std::string& data)
+{
+   sub.pending += data;
+
+   while ( !sub.pending.empty() )
+   {
+      int ret = send(sockfd, sub.pending.data(), sub.pending.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+      if ( ret < 0 )
+      {
+         if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            break;
+         return false;
+      }
+      sub.pending.erase(0, ret);
+   }
+
+   /*没写完的数据等 socket 可写时立即继续，不等下一个事件或心跳*/
+   if ( !sub.pending.empty() && !sub.want_write )
+   {
+      sub.want_write = true;
+      watch(sockfd, true);
+   }
+
+   /*客户端长时间不读，积压太多就断开*/
+   return sub.pending.size() <= MAX_PENDING_BYTES;
+}
+
+bool sse_hub::flush(int sockfd)
+{
+   auto it = m_subscribers.find(sockfd);
+   if ( it == m_subscribers.end() )
+      return false;
+
+   /*EPOLLONESHOT，触发之后需要重新注册*/
+   subscriber& sub = it->second;
+   sub.want_write = false;
+   if ( !send_to(sockfd, sub, std::string()) )
+      return false;
+
+   if ( !sub.want_write )
+      watch(sockfd, false);
+   return true;
+}
+
+void sse_hub::watch(int sockfd, bool want_write)
+{
+   epoll_event event;
+   event.data.fd = sockfd;
+   event.events = EPOLLIN | EPOLLONESHOT | EPOLLRDHUP;
+   if ( want_write )
+      event.events |= EPOLLOUT;
+   epoll_ctl(m_epollfd, EPOLL_CTL_MOD, sockfd, &event);
+}
+
+void sse_hub::dispatch(std::vector<int>& dead)
+{
+   uint64_t cnt = 0;
+   ::read(m_eventfd, &cnt, sizeof(cnt));
+
+   event ev;
+   while ( m_events.try_pop(ev) )
+   {
+      auto ch = m_channels.find(ev.channel);
+      if ( ch == m_channels.end() )
+         continue;
+
+      for (int sockfd : ch->second)
+      {
+         if ( !send_to(sockfd, m_subscribers[sockfd], ev.payload) )
+            dead.push_back(sockfd);
+      }
+   }
+
+   /*dead 中可能有重复的连接*/
+   std::sort(dead.begin(), dead.end());
+   dead.erase(std::unique(dead.begin(), dead.end()), dead.end());
+}
+
+/*注释行作为心跳，浏览器会直接忽略*/
+void sse_hub::heartbeat(std::vector<int>& dead)
+{
+   static const std::string ping = ":\n\n";
+   for (auto& it : m_subscribers)
+   {
+      if ( !send_to(it.first, it.second, ping) )
+         dead.push_back(it.first);
+   }
+}
@@ -0,0 +1,86 @@
+/*
+   Server-Sent Events 推送中心（全局只允许一个实例）
+   1、订阅者是已经发送完 text/event-stream 响应头的长连接，只在主线程（事件循环）中维护
+   2、任意线程都可以 publish，事件先放进线程安全的队列，再通过 eventfd 唤醒事件循环统一下发，
+      因此发布一次事件不会为每个订阅者占用一个线程池的线程
+   3、心跳由定时器在每个 TIMESLOT 触发
+   4、一次没有写完的数据留在订阅者中并监听可写事件，socket 可写时由事件循环调用 flush 继续写
+*/
+
+#ifndef SSE_H
+#define SSE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "../thread_safe_queue/thread_safe_queue.h"
+#include "../log/log.h"
+
+class sse_hub
+{
+public:
+   static const int CHANNEL_LEN        = 64;          //频道名最大长度
+   static const int MAX_PENDING_BYTES  = 64 * 1024;   //单个订阅者最多积压的字节数
+
+private:
+   /*订阅者*/
+   struct subscriber
+   {
+      std::string    channel;
+      std::string    pending;       //上次没有写完的数据
+      bool           want_write = false;  //是否在等待可写事件
+   };
+
+   /*待下发的事件*/
+   struct event
+   {
+      std::string    channel;
+      std::string    payload;       //已经按 event-stream 格式序列化好的数据
+   };
+
+   std::unordered_map<std::string, std::vector<int>>
+                     m_channels;    //频道 -> 订阅者 socket
+   std::unordered_map<int, subscriber>
+                     m_subscribers; //socket -> 订阅者
+
+   thread_safe_queue<event>
+                     m_events;      //各线程发布的事件
+   int               m_eventfd;     //用于唤醒事件循环
+   int               m_epollfd;
+   int               m_close_log;   //日志开关
+
+private:
+   sse_hub();
+   ~sse_hub();
+
+   /*向一个订阅者写数据，写失败或积压过多返回 false*/
+   bool              send_to(int sockfd, subscriber& sub, const std::string& data);
+
+   /*重新注册订阅者的 socket，还有没写完的数据时同时监听可写事件*/
+   void              watch(int sockfd, bool want_write);
+
+public:
+   static sse_hub*   get_instance();
+
+   /*创建 eventfd，返回值需要由事件循环注册到 epoll 中*/
+   int               init(int epollfd, int close_log);
+
+   /*以下函数可以在任意线程调用*/
+   void              publish(const std::string& channel, const std::string& data, 
+                             const std::string& event_name = "");
+
+   /*以下函数只能在事件循环所在的线程调用，dead 中返回需要关闭的连接*/
+   void              subscribe(int sockfd, const std::string& channel);
+   void              unsubscribe(int sockfd);
+   bool              is_subscriber(int sockfd) const;
+
+   /*订阅者的 socket 可写时调用，写失败返回 false*/
+   bool              flush(int sockfd);
+   void              dispatch(std::vector<int>& dead);
+   void              heartbeat(std::vector<int>& dead);
+
+   size_t            subscriber_count() const { return m_subscribers.size(); }
+};
+
+#endif
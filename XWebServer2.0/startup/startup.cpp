@@ -0,0 +1,71 @@
+#include "startup.h"
+
+#include <stdio.h>
+
+startup::startup() : m_start(std::chrono::steady_clock::now())
+{
+   for (int i = 0; i < STAGE_NUM; ++i)
+   {
+      m_ready[i] = false;
+      m_ready_at[i] = 0;
+   }
+}
+
+startup* startup::get_instance()
+{
+   static startup instance;
+   return &instance;
+}
+
+double startup::elapsed() const
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void startup::record(const char* name, double seconds)
+{
+   std::lock_guard<std::mutex> lk(m_mutex);
+   m_timings.push_back({ name, seconds });
+   printf("startup stage %s: %.3f ms\n", name, seconds * 1000);
+}
+
+/*就绪时间在 m_ready 置位之前写入，读到 m_ready 为 true 的线程一定能看到*/
+void startup::set_ready(STAGE stage)
+{
+   static const char* names[STAGE_NUM] = { "static", "db" };
+
+   m_ready_at[stage] = elapsed();
+   m_ready[stage].store(true, std::memory_order_release);
+   printf("startup %s ready after %.3f ms\n", names[stage], m_ready_at[stage] * 1000);
+}
+
+void startup::report(std::string& out) const
+{
+   static const char* names[STAGE_NUM] = { "static", "db" };
+
+   char buf[256];
+   int len;
+   for (int i = 0; i < STAGE_NUM; ++i)
+   {
+      bool r = ready((STAGE)i);
+      len = snprintf(buf, sizeof(buf),
+                     "startup_ready{stage=\"%s\"} %d\n"
+                     "startup_ready_seconds{stage=\"%s\"} %.6f\n",
+                     names[i], r ? 1 : 0, names[i], r ? m_ready_at[i] : 0.0);
+      out.append(buf, len);
+   }
+
+   std::lock_guard<std::mutex> lk(m_mutex);
+   for (const timing& t : m_timings)
+   {
+      len = snprintf(buf, sizeof(buf), "startup_stage_seconds{stage=\"%s\"} %.6f\n",
+                     t.name.c_str(), t.seconds);
+      out.append(buf, len);
+   }
+}
+
+startup_stage::~startup_stage()
+{
+   startup::get_instance()->record(m_name,
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - m_begin).count());
+}
@@ -0,0 +1,78 @@
+/*
+   启动过程（全局只允许一个实例）
+   1、记录每个启动阶段的耗时，启动时打印，/metrics 中输出
+   2、分阶段就绪：静态资源所需的配置加载完就开始监听，数据库阶段（连接池达到最小连接数、
+      用户缓存加载完成）在后台进行，完成之前依赖数据库的路由返回 503
+*/
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+class startup
+{
+public:
+   enum STAGE
+   {
+      STAGE_STATIC = 0,             //可以服务静态资源
+      STAGE_DB,                     //可以登录和注册
+      STAGE_NUM
+   };
+
+private:
+   struct timing
+   {
+      std::string    name;
+      double         seconds;
+   };
+
+   std::chrono::steady_clock::time_point
+                     m_start;
+   std::atomic<bool> m_ready[STAGE_NUM];
+   double            m_ready_at[STAGE_NUM];     //从进程启动到就绪的时间（秒）
+
+   mutable std::mutex
+                     m_mutex;
+   std::vector<timing>
+                     m_timings;
+
+private:
+   startup();
+   ~startup() {}
+
+public:
+   static startup*   get_instance();
+
+   /*从启动到现在经过的秒数*/
+   double            elapsed() const;
+
+   /*记录一个阶段的耗时，可以在任意线程调用*/
+   void              record(const char* name, double seconds);
+
+   void              set_ready(STAGE stage);
+
+   bool              ready(STAGE stage) const { return m_ready[stage].load(std::memory_order_acquire); }
+
+   /*以 Prometheus 文本格式追加统计*/
+   void              report(std::string& out) const;
+};
+
+/*作用域结束时把经过的时间记为一个启动阶段*/
+class startup_stage
+{
+private:
+   const char*       m_name;
+   std::chrono::steady_clock::time_point
+                     m_begin;
+
+public:
+   startup_stage(const char* name) : m_name(name), m_begin(std::chrono::steady_clock::now()) {}
+   ~startup_stage();
+};
+
+#endif
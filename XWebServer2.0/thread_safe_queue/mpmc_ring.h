@@ -0,0 +1,311 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+/*
+   有界的多生产者多消费者环形队列（Dmitry Vyukov 的算法）
+   每个槽位带一个序号，生产者和消费者各自用 CAS 抢位置，不加锁，
+   元素按值存放在槽位中，创建之后入队出队都不再分配内存，
+   入队位置、出队位置和等待用的状态各占一个缓存行，生产者和消费者之间没有伪共享
+   满的时候 try_push 返回 false，由调用方决定丢弃、降级还是等待；push 阻塞到有空位，
+   wait_and_pop 阻塞到有元素，只有真的有线程在等时才用到锁和条件变量
+*/
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <stddef.h>
+#include <stdint.h>
+
+template<typename T>
+class mpmc_ring
+{
+public:
+   static const size_t     CACHE_LINE = 64;
+
+private:
+   /*seq 等于位置时可以写入，等于位置加一时可以读出*/
+   struct cell
+   {
+      std::atomic<size_t>  seq;
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type
+                           storage;
+   };
+
+   cell*                   m_cells;
+   size_t                  m_mask;
+
+   alignas(CACHE_LINE) std::atomic<size_t>
+                           m_enqueue_pos;
+
+   alignas(CACHE_LINE) std::atomic<size_t>
+                           m_dequeue_pos;
+
+   /*阻塞的 push 和 wait_and_pop 用*/
+   alignas(CACHE_LINE) std::atomic<int>
+                           m_push_waiters;
+   std::atomic<int>        m_pop_waiters;
+   bool                    m_closed;
+   std::mutex              m_mutex;
+   std::condition_variable m_not_full;
+   std::condition_variable m_not_empty;
+
+private:
+   /*以下函数全是辅助函数*/
+   bool                    readable() const;
+   bool                    writable() const;
+   void                    wake(std::atomic<int>& waiters, std::condition_variable& cond);
+
+public:
+   /*容量向上取整到 2 的幂*/
+   explicit mpmc_ring(size_t capacity);
+   ~mpmc_ring();
+   mpmc_ring(const mpmc_ring&) = delete;
+   mpmc_ring& operator=(const mpmc_ring&) = delete;
+
+   /*队列满时返回 false，value 保持不变*/
+   template<typename U>
+   bool                    try_push(U&& value);
+
+   /*队列满时阻塞到有空位，队列关闭后返回 false*/
+   template<typename U>
+   bool                    push(U&& value);
+
+   /*队列满时最多等到 deadline，超时或者队列关闭返回 false，value 保持不变*/
+   template<typename U, typename Clock, typename Duration>
+   bool                    push_until(U&& value, const std::chrono::time_point<Clock, Duration>& deadline);
+
+   /*队列空时返回 false*/
+   bool                    try_pop(T& value);
+
+   /*队列空时阻塞到有元素，关闭并且取完之后返回 false*/
+   bool                    wait_and_pop(T& value);
+
+   /*唤醒所有阻塞的线程，之后不应再放入*/
+   void                    close();
+
+   /*以下结果在并发修改时只是近似值*/
+   bool                    empty() const { return !readable(); }
+   size_t                  size() const;
+   size_t                  capacity() const { return m_mask + 1; }
+};
+
+/*--------------------------------------实现------------------------------------------*/
+
+template<typename T>
+mpmc_ring<T>::mpmc_ring(size_t capacity) :
+   m_enqueue_pos(0),
+   m_dequeue_pos(0),
+   m_push_waiters(0),
+   m_pop_waiters(0),
+   m_closed(false)
+{
+   size_t size = 2;
+   while ( size < capacity )
+      size <<= 1;
+
+   m_cells = new cell[size];
+   m_mask = size - 1;
+   for (size_t i = 0; i < size; ++i)
+   {
+      m_cells[i].seq.store(i, std::memory_order_relaxed);
+   }
+}
+
+template<typename T>
+mpmc_ring<T>::~mpmc_ring()
+{
+   for (size_t pos = m_dequeue_pos.load(); ; ++pos)
+   {
+      cell& c = m_cells[pos & m_mask];
+      if ( c.seq.load() != pos + 1 )
+         break;
+      reinterpret_cast<T*>(&c.storage)->~T();
+   }
+   delete[] m_cells;
+}
+
+template<typename T>
+template<typename U>
+bool
+mpmc_ring<T>::try_push(U&& value)
+{
+   cell* c;
+   size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+   while ( true )
+   {
+      c = &m_cells[pos & m_mask];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if ( dif == 0 )
+      {
+         if ( m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+            break;
+      }
+      /*这个槽位上一轮的元素还没有被取走，队列满了*/
+      else if ( dif < 0 )
+      {
+         return false;
+      }
+      else
+      {
+         pos = m_enqueue_pos.load(std::memory_order_relaxed);
+      }
+   }
+
+   new (&c->storage) T(std::forward<U>(value));
+   c->seq.store(pos + 1, std::memory_order_release);
+   wake(m_pop_waiters, m_not_empty);
+   return true;
+}
+
+template<typename T>
+bool
+mpmc_ring<T>::try_pop(T& value)
+{
+   cell* c;
+   size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+   while ( true )
+   {
+      c = &m_cells[pos & m_mask];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if ( dif == 0 )
+      {
+         if ( m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+            break;
+      }
+      /*还没有写入，队列空了*/
+      else if ( dif < 0 )
+      {
+         return false;
+      }
+      else
+      {
+         pos = m_dequeue_pos.load(std::memory_order_relaxed);
+      }
+   }
+
+   T* data = reinterpret_cast<T*>(&c->storage);
+   value = std::move(*data);
+   data->~T();
+   c->seq.store(pos + m_mask + 1, std::memory_order_release);
+   wake(m_push_waiters, m_not_full);
+   return true;
+}
+
+template<typename T>
+template<typename U>
+bool
+mpmc_ring<T>::push(U&& value)
+{
+   while ( !try_push(std::forward<U>(value)) )
+   {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      if ( m_closed )
+         return false;
+
+      /*先登记再检查，和 wake 中的栅栏配对，不会漏掉唤醒*/
+      m_push_waiters.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      m_not_full.wait(lk, [this] { return writable() || m_closed; });
+      m_push_waiters.fetch_sub(1);
+   }
+   return true;
+}
+
+template<typename T>
+template<typename U, typename Clock, typename Duration>
+bool
+mpmc_ring<T>::push_until(U&& value, const std::chrono::time_point<Clock, Duration>& deadline)
+{
+   while ( !try_push(std::forward<U>(value)) )
+   {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      if ( m_closed )
+         return false;
+
+      m_push_waiters.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool ready = m_not_full.wait_until(lk, deadline, [this] { return writable() || m_closed; });
+      m_push_waiters.fetch_sub(1);
+      if ( !ready )
+         return false;
+   }
+   return true;
+}
+
+template<typename T>
+bool
+mpmc_ring<T>::wait_and_pop(T& value)
+{
+   while ( !try_pop(value) )
+   {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      if ( m_closed )
+         return false;
+
+      m_pop_waiters.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      m_not_empty.wait(lk, [this] { return readable() || m_closed; });
+      m_pop_waiters.fetch_sub(1);
+   }
+   return true;
+}
+
+template<typename T>
+void
+mpmc_ring<T>::close()
+{
+   {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_closed = true;
+   }
+   m_not_full.notify_all();
+   m_not_empty.notify_all();
+}
+
+template<typename T>
+bool
+mpmc_ring<T>::readable() const
+{
+   size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+   return m_cells[pos & m_mask].seq.load(std::memory_order_acquire) == pos + 1;
+}
+
+template<typename T>
+bool
+mpmc_ring<T>::writable() const
+{
+   size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+   return m_cells[pos & m_mask].seq.load(std::memory_order_acquire) == pos;
+}
+
+/*没有线程在等时只多一个栅栏，不碰锁*/
+template<typename T>
+void
+mpmc_ring<T>::wake(std::atomic<int>& waiters, std::condition_variable& cond)
+{
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if ( waiters.load(std::memory_order_relaxed) == 0 )
+      return;
+
+   {
+      std::lock_guard<std::mutex> lk(m_mutex);
+   }
+   cond.notify_one();
+}
+
+template<typename T>
+size_t
+mpmc_ring<T>::size() const
+{
+   size_t enqueue = m_enqueue_pos.load(std::memory_order_relaxed);
+   size_t dequeue = m_dequeue_pos.load(std::memory_order_relaxed);
+   return enqueue > dequeue ? enqueue - dequeue : 0;
+}
+
+#endif
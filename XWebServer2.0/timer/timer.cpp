@@ -1,6 +1,8 @@
 #include "timer.h"
 #include "../http/http.h"
 
+#include <sys/timerfd.h>
+
 time_heap::time_heap(int cap) :
    capacity(cap),
    cur_size(0),
@@ -109,6 +111,7 @@ void time_heap::tick()
 
       /*否则执行回调函数*/
       if( array[0]->cb_func )array[0]->cb_func(array[0]->user_data);
+      else if( array[0]->task )array[0]->task(array[0]->arg);
 
       pop_timer();
       tmp = array[0];
@@ -217,11 +220,43 @@ void Utils::show_error(int connfd, const char *info)
    close(connfd);
 }
 
+int Utils::init_clock()
+{
+   int clockfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if ( clockfd == -1 )
+      return -1;
+
+   struct itimerspec spec;
+   spec.it_interval.tv_sec = 1;
+   spec.it_interval.tv_nsec = 0;
+   spec.it_value = spec.it_interval;
+   timerfd_settime(clockfd, 0, &spec, NULL);
+
+   http_date::refresh();
+   return clockfd;
+}
+
+void Utils::clock_handler(int clockfd)
+{
+   uint64_t expirations = 0;
+   read(clockfd, &expirations, sizeof(expirations));
+   http_date::refresh();
+}
+
 class Utils;
 void cb_func(client_data* user_data)
 {
-   epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
    assert(user_data);
+   /*
+      请求还在线程池中，只做取消标记，由处理这个请求的线程关闭连接，
+      定时器马上会被删除，不再留在 client_data 中
+   */
+   if ( user_data->conn && !user_data->conn->cancel() )
+   {
+      user_data->timer = NULL;
+      return;
+   }
+   epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
    close(user_data->sockfd);
    http::m_user_count--;
 }
@@ -16,13 +16,15 @@ using std::swap;
 #define BUFFER_SIZE 64
 
 class heap_timer;
+class http;
 
-/*绑定 socket 和定时器*/
+/*绑定 socket、定时器和连接对象*/
 struct client_data
 {
    sockaddr_in address;
    int         sockfd;
    heap_timer* timer;
+   http*       conn;
 };
 
 /*定时器*/
@@ -38,10 +40,14 @@ public:
    /*回调函数*/
    void (*cb_func)(client_data*);
 
+   /*不绑定连接的定时任务（比如回收过期会话），没有 cb_func 时以 arg 调用*/
+   void (*task)(void*);
+   void*          arg;
+
 public:
-   heap_timer(){}
+   heap_timer() : user_data(NULL), cb_func(NULL), task(NULL), arg(NULL) {}
 
-   heap_timer(int delay)
+   heap_timer(int delay) : user_data(NULL), cb_func(NULL), task(NULL), arg(NULL)
    {
       expire = time(NULL) + delay;
    }
@@ -122,6 +128,12 @@ public:
 
     void show_error(int connfd, const char* info);
 
+    //创建每秒触发一次的时钟描述符，用于刷新缓存的 Date 头
+    int init_clock();
+
+    //时钟描述符可读时调用
+    void clock_handler(int clockfd);
+
 public:
     static int*      u_pipefd;
     time_heap        m_timer_heap;
@@ -0,0 +1,72 @@
+/*
+   用户表重新分片工具，服务不停机时把用户迁移到新的归属
+   用法：./reshard [-U 用户名] [-P 密码] [-d 库名] [-b 每批用户数] [-s 批间暂停毫秒] 新地址列表/旧地址列表
+   地址列表和服务的 -u shard:... 配置相同，可以带 shard: 前缀，
+   服务应该已经用同样的 新地址列表/旧地址列表 重启，迁移完成后再去掉旧地址列表
+   错误记录在 ./ReshardLog
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include "../log/log.h"
+#include "../user/sharded_store.h"
+
+int main(int argc, char* argv[])
+{
+   //和 main.cpp 中的数据库信息一致
+   db_params params = { "root", "root", "X_server", 2, 1, 0 };
+   int batch = 1000;
+   int pause_ms = 0;
+
+   int opt;
+   while ( (opt = getopt(argc, argv, "U:P:d:b:s:")) != -1 )
+   {
+      switch ( opt )
+      {
+         case 'U': params.user = optarg; break;
+         case 'P': params.passwd = optarg; break;
+         case 'd': params.db_name = optarg; break;
+         case 'b': batch = atoi(optarg); break;
+         case 's': pause_ms = atoi(optarg); break;
+         default:
+            return 1;
+      }
+   }
+
+   if ( optind >= argc || batch <= 0 )
+   {
+      fprintf(stderr, "usage: %s [-U user] [-P passwd] [-d db] [-b batch] [-s pause_ms] new_list[/old_list]\n",
+              argv[0]);
+      return 1;
+   }
+
+   std::string spec = argv[optind];
+   if ( spec.compare(0, 6, "shard:") == 0 )
+      spec = spec.substr(6);
+
+   Log::get_instance()->init("./ReshardLog", 0, 2000, 800000, 0);
+
+   sharded_user_store store(0);
+   if ( !store.open(spec, params) )
+   {
+      fprintf(stderr, "invalid shard list: %s\n", spec.c_str());
+      return 1;
+   }
+
+   long moved = store.reshard(batch, pause_ms, [](const std::string& shard, long checked, long moved)
+   {
+      printf("%s: checked %ld, moved %ld\n", shard.c_str(), checked, moved);
+      fflush(stdout);
+   });
+
+   if ( moved < 0 )
+   {
+      fprintf(stderr, "reshard failed, see ReshardLog; it is safe to run again\n");
+      return 1;
+   }
+   printf("done, %ld users moved\n", moved);
+   return 0;
+}
@@ -0,0 +1,126 @@
+#include "bloom_filter.h"
+
+#include <math.h>
+
+bloom_filter::bloom_filter(size_t init_capacity, double fp_rate) : 
+   m_stage_num(0), 
+   m_init_capacity(init_capacity), 
+   m_fp_rate(fp_rate)
+{
+   for (int i = 0; i < MAX_STAGES; ++i)
+   {
+      m_stages[i] = NULL;
+   }
+   m_stages[0] = new_stage(m_init_capacity, m_fp_rate / 2);
+   m_stage_num = 1;
+}
+
+bloom_filter::~bloom_filter()
+{
+   for (int i = 0; i < m_stage_num; ++i)
+   {
+      stage* s = m_stages[i];
+      delete[] s->bits;
+      delete s;
+   }
+}
+
+/*位数 m = -n*ln(p)/(ln2)^2，哈希函数个数 k = -log2(p)*/
+bloom_filter::stage* bloom_filter::new_stage(size_t capacity, double fp_rate)
+{
+   stage* s = new stage;
+   s->capacity = capacity;
+   s->fp_rate = fp_rate;
+   s->k = (int)ceil(-log2(fp_rate));
+   s->nbits = (uint64_t)ceil(-(double)capacity * log(fp_rate) / (M_LN2 * M_LN2));
+   s->nbits = (s->nbits + 63) & ~63ull;
+   s->count = 0;
+
+   s->bits = new std::atomic<uint64_t>[s->nbits / 64];
+   for (uint64_t i = 0; i < s->nbits / 64; ++i)
+   {
+      s->bits[i].store(0, std::memory_order_relaxed);
+   }
+   return s;
+}
+
+/*双重哈希：第 i 个位置为 h1 + i*h2*/
+bool bloom_filter::test(const stage* s, uint64_t h)
+{
+   uint64_t h1 = h, h2 = (h >> 32) | (h << 32) | 1;
+   for (int i = 0; i < s->k; ++i)
+   {
+      uint64_t bit = (h1 + i * h2) % s->nbits;
+      if ( !(s->bits[bit / 64].load(std::memory_order_relaxed) & (1ull << (bit % 64))) )
+         return false;
+   }
+   return true;
+}
+
+bool bloom_filter::may_contain(uint64_t h) const
+{
+   int n = m_stage_num.load(std::memory_order_acquire);
+   for (int i = 0; i < n; ++i)
+   {
+      if ( test(m_stages[i].load(std::memory_order_acquire), h) )
+         return true;
+   }
+   return false;
+}
+
+void bloom_filter::add(uint64_t h)
+{
+   int n = m_stage_num.load(std::memory_order_acquire);
+   stage* s = m_stages[n - 1].load(std::memory_order_acquire);
+
+   /*当前一级插满，新建一级，容量翻倍、误判率减半*/
+   if ( s->count.load(std::memory_order_relaxed) >= s->capacity && n < MAX_STAGES )
+   {
+      std::lock_guard<std::mutex> lk(m_grow_mutex);
+      n = m_stage_num.load(std::memory_order_acquire);
+      s = m_stages[n - 1].load(std::memory_order_acquire);
+      if ( s->count.load(std::memory_order_relaxed) >= s->capacity && n < MAX_STAGES )
+      {
+         s = new_stage(s->capacity * 2, s->fp_rate / 2);
+         m_stages[n].store(s, std::memory_order_release);
+         m_stage_num.store(n + 1, std::memory_order_release);
+      }
+   }
+
+   uint64_t h1 = h, h2 = (h >> 32) | (h << 32) | 1;
+   for (int i = 0; i < s->k; ++i)
+   {
+      uint64_t bit = (h1 + i * h2) % s->nbits;
+      s->bits[bit / 64].fetch_or(1ull << (bit % 64), std::memory_order_relaxed);
+   }
+   s->count.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t bloom_filter::bits() const
+{
+   uint64_t total = 0;
+   int n = m_stage_num.load(std::memory_order_acquire);
+   for (int i = 0; i < n; ++i)
+   {
+      total += m_stages[i].load(std::memory_order_acquire)->nbits;
+   }
+   return total;
+}
+
+/*每一级的误判率为置位比例的 k 次方，任意一级误判整体就误判*/
+double bloom_filter::estimated_fp_rate() const
+{
+   double pass = 1.0;
+   int n = m_stage_num.load(std::memory_order_acquire);
+   for (int i = 0; i < n; ++i)
+   {
+      const stage* s = m_stages[i].load(std::memory_order_acquire);
+      uint64_t set = 0;
+      for (uint64_t w = 0; w < s->nbits / 64; ++w)
+      {
+         set += __builtin_popcountll(s->bits[w].load(std::memory_order_relaxed));
+      }
+      pass *= 1.0 - pow((double)set / s->nbits, s->k);
+   }
+   return 1.0 - pass;
+}
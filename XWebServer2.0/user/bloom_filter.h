@@ -0,0 +1,63 @@
+/*
+   可扩展的布隆过滤器（Scalable Bloom Filter）
+   1、由若干级普通布隆过滤器组成，当前一级插满后新建一级，容量翻倍、误判率减半，
+      第一级的误判率取 fp_rate 的一半，总的误判率不超过 fp_rate，不需要预先知道用户数量
+   2、位数组使用原子操作，查询和插入都不加锁，只有新建一级时加锁
+   3、may_contain 返回 false 表示一定不存在，返回 true 表示可能存在
+*/
+
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+
+class bloom_filter
+{
+public:
+   static const int MAX_STAGES = 32;
+
+private:
+   /*一级过滤器*/
+   struct stage
+   {
+      std::atomic<uint64_t>*  bits;
+      uint64_t                nbits;
+      int                     k;          //哈希函数个数
+      size_t                  capacity;   //按设计误判率能容纳的元素个数
+      std::atomic<size_t>     count;
+      double                  fp_rate;    //设计误判率
+   };
+
+   std::atomic<stage*>  m_stages[MAX_STAGES];
+   std::atomic<int>     m_stage_num;
+   std::mutex           m_grow_mutex;
+   size_t               m_init_capacity;
+   double               m_fp_rate;
+
+private:
+   static stage*        new_stage(size_t capacity, double fp_rate);
+   static bool          test(const stage* s, uint64_t h);
+
+   bloom_filter(const bloom_filter&) = delete;
+   bloom_filter& operator=(const bloom_filter&) = delete;
+
+public:
+   /*第一级的容量和误判率*/
+   bloom_filter(size_t init_capacity = 1 << 20, double fp_rate = 0.01);
+   ~bloom_filter();
+
+   /*h 为 flat_table::hash 计算出的哈希值*/
+   bool                 may_contain(uint64_t h) const;
+   void                 add(uint64_t h);
+
+   int                  stages() const { return m_stage_num.load(std::memory_order_acquire); }
+   uint64_t             bits() const;
+
+   /*按每一级已经置位的比例估算当前的误判率*/
+   double               estimated_fp_rate() const;
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "flat_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*组内与 tag 相同的控制字节，第 i 位为 1 表示第 i 个槽位匹配*/
+static inline uint32_t match_tag(const int8_t* group, int8_t tag)
+{
+#ifdef __SSE2__
+   __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+#else
+   uint32_t mask = 0;
+   for (int i = 0; i < flat_table::GROUP_SIZE; ++i)
+   {
+      if ( group[i] == tag )
+         mask |= 1u << i;
+   }
+   return mask;
+#endif
+}
+
+/*空或者已删除的槽位，这两种控制字节最高位都是 1，标签的最高位是 0*/
+static inline uint32_t match_free(const int8_t* group)
+{
+#ifdef __SSE2__
+   return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+   uint32_t mask = 0;
+   for (int i = 0; i < flat_table::GROUP_SIZE; ++i)
+   {
+      if ( group[i] < 0 )
+         mask |= 1u << i;
+   }
+   return mask;
+#endif
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+   __uint128_t r = (__uint128_t)a * b;
+   return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+uint64_t flat_table::hash(const char* data, size_t len)
+{
+   uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+   while ( len >= 8 )
+   {
+      uint64_t k;
+      memcpy(&k, data, 8);
+      h = mix(h ^ k, 0xBF58476D1CE4E5B9ull);
+      data += 8;
+      len -= 8;
+   }
+
+   uint64_t k = 0;
+   memcpy(&k, data, len);
+   h = mix(h ^ k, 0x94D049BB133111EBull);
+   return mix(h, 0x9E3779B97F4A7C15ull);
+}
+
+const char* flat_table::short_str::data() const
+{
+   if ( len <= INLINE_CAP )
+      return buf;
+
+   char* ptr;
+   memcpy(&ptr, buf, sizeof(ptr));
+   return ptr;
+}
+
+void flat_table::short_str::assign(const char* s, size_t n)
+{
+   len = n;
+   if ( n <= INLINE_CAP )
+   {
+      memcpy(buf, s, n);
+   }
+   else
+   {
+      char* ptr = (char*)malloc(n);
+      memcpy(ptr, s, n);
+      memcpy(buf, &ptr, sizeof(ptr));
+   }
+}
+
+void flat_table::short_str::release()
+{
+   if ( len > INLINE_CAP )
+      free((void*)data());
+}
+
+bool flat_table::short_str::equals(const char* s, size_t n) const
+{
+   return len == n && memcmp(data(), s, n) == 0;
+}
+
+flat_table::flat_table() : m_ctrl(NULL), m_slots(NULL), m_capacity(0), m_size(0), m_deleted(0)
+{
+
+}
+
+flat_table::~flat_table()
+{
+   for (size_t i = 0; i < m_capacity; ++i)
+   {
+      if ( m_ctrl[i] >= 0 )
+      {
+         m_slots[i].key.release();
+         m_slots[i].value.release();
+      }
+   }
+   free(m_ctrl);
+   free(m_slots);
+}
+
+/*
+   哈希值低 7 位作为标签，其余位决定从哪一组开始找
+   组之间按 1、2、3... 递增的步长探测，组数是 2 的幂次时可以遍历所有组
+*/
+long flat_table::find_slot(const char* key, size_t len, uint64_t h) const
+{
+   if ( m_capacity == 0 )
+      return -1;
+
+   int8_t tag = h & 0x7f;
+   size_t mask = m_capacity / GROUP_SIZE - 1;
+   size_t group = (h >> 7) & mask;
+
+   for (size_t step = 1; ; ++step)
+   {
+      const int8_t* ctrl = m_ctrl + group * GROUP_SIZE;
+      for (uint32_t m = match_tag(ctrl, tag); m != 0; m &= m - 1)
+      {
+         size_t i = group * GROUP_SIZE + __builtin_ctz(m);
+         if ( m_slots[i].key.equals(key, len) )
+            return i;
+      }
+      if ( match_tag(ctrl, CTRL_EMPTY) != 0 )
+         return -1;
+      group = (group + step) & mask;
+   }
+}
+
+size_t flat_table::find_free(uint64_t h) const
+{
+   size_t mask = m_capacity / GROUP_SIZE - 1;
+   size_t group = (h >> 7) & mask;
+
+   for (size_t step = 1; ; ++step)
+   {
+      uint32_t m = match_free(m_ctrl + group * GROUP_SIZE);
+      if ( m != 0 )
+         return group * GROUP_SIZE + __builtin_ctz(m);
+      group = (group + step) & mask;
+   }
+}
+
+/*
+   百万级用户时槽位数组有几十上百 MB，随机访问的瓶颈在 TLB，
+   大数组按 2MB 对齐分配并建议内核使用透明大页
+*/
+static void* alloc_slots(size_t bytes, size_t align)
+{
+   const size_t HUGE_PAGE = 2 << 20;
+   if ( bytes < HUGE_PAGE )
+      return aligned_alloc(align, bytes);
+
+   bytes = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+   void* p = aligned_alloc(HUGE_PAGE, bytes);
+   if ( p )
+      madvise(p, bytes, MADV_HUGEPAGE);
+   return p;
+}
+
+/*槽位里只有字符串的指针，重新分布时直接按字节搬过去*/
+void flat_table::rehash(size_t capacity)
+{
+   int8_t* old_ctrl = m_ctrl;
+   slot* old_slots = m_slots;
+   size_t old_capacity = m_capacity;
+
+   m_ctrl = (int8_t*)malloc(capacity);
+   m_slots = (slot*)alloc_slots(capacity * sizeof(slot), alignof(slot));
+   memset(m_ctrl, CTRL_EMPTY, capacity);
+   m_capacity = capacity;
+   m_deleted = 0;
+
+   for (size_t i = 0; i < old_capacity; ++i)
+   {
+      if ( old_ctrl[i] < 0 )
+         continue;
+
+      const short_str& key = old_slots[i].key;
+      uint64_t h = hash(key.data(), key.len);
+      size_t pos = find_free(h);
+      m_ctrl[pos] = h & 0x7f;
+      memcpy(&m_slots[pos], &old_slots[i], sizeof(slot));
+   }
+
+   free(old_ctrl);
+   free(old_slots);
+}
+
+bool flat_table::find(const char* key, size_t len, uint64_t h, std::string& value) const
+{
+   long i = find_slot(key, len, h);
+   if ( i < 0 )
+      return false;
+   value.assign(m_slots[i].value.data(), m_slots[i].value.len);
+   return true;
+}
+
+bool flat_table::insert(const char* key, size_t len, uint64_t h, const char* value, size_t value_len)
+{
+   if ( find_slot(key, len, h) >= 0 )
+      return false;
+
+   /*装载率超过 7/8 时扩容，大部分是已删除的槽位时原地整理*/
+   if ( (m_size + m_deleted + 1) * 8 > m_capacity * 7 )
+   {
+      if ( m_capacity == 0 )
+         rehash(GROUP_SIZE);
+      else if ( (m_size + 1) * 2 > m_capacity )
+         rehash(m_capacity * 2);
+      else
+         rehash(m_capacity);
+   }
+
+   size_t i = find_free(h);
+   if ( m_ctrl[i] == CTRL_DELETED )
+      --m_deleted;
+   m_ctrl[i] = h & 0x7f;
+   m_slots[i].key.assign(key, len);
+   m_slots[i].value.assign(value, value_len);
+   ++m_size;
+   return true;
+}
+
+bool flat_table::erase(const char* key, size_t len, uint64_t h)
+{
+   long i = find_slot(key, len, h);
+   if ( i < 0 )
+      return false;
+
+   m_slots[i].key.release();
+   m_slots[i].value.release();
+   m_ctrl[i] = CTRL_DELETED;
+   --m_size;
+   ++m_deleted;
+   return true;
+}
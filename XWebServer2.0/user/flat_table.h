@@ -0,0 +1,98 @@
+/*
+   开放寻址哈希表，用户名 -> 密码（参考 Swiss table 的布局）
+   1、每 16 个槽位为一组，每个槽位对应一个字节的控制位：空、已删除，或者哈希值低 7 位的标签
+   2、查找时用 SSE2 一次比较一组 16 个标签，只有标签相同的槽位才比较字符串，
+      组内有空槽位说明查找结束，整个过程几乎只访问连续的内存
+   3、短字符串直接存放在槽位中，只有超过 INLINE_CAP 的字符串才单独分配内存
+   本身不是线程安全的，由 user_cache 分片加锁使用
+*/
+
+#ifndef FLAT_TABLE_H
+#define FLAT_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+class flat_table
+{
+public:
+   static const int GROUP_SIZE = 16;
+
+   /*计算哈希值，调用者可以先算好再传进来，分片和表内定位共用一次计算*/
+   static uint64_t   hash(const char* data, size_t len);
+
+private:
+   static const int8_t CTRL_EMPTY   = -128;     //0x80
+   static const int8_t CTRL_DELETED = -2;       //0xFE
+
+   /*
+      长度不超过 INLINE_CAP 的字符串存放在槽位内部，否则 buf 中保存单独分配的内存的地址
+      一个槽位正好 64 字节，和缓存行对齐，查找命中时只访问一个缓存行
+   */
+   struct short_str
+   {
+      static const uint32_t INLINE_CAP = 28;
+
+      uint32_t    len;
+      char        buf[INLINE_CAP];
+
+      const char* data() const;
+      void        assign(const char* s, size_t n);
+      void        release();
+      bool        equals(const char* s, size_t n) const;
+   };
+
+   struct alignas(64) slot
+   {
+      short_str   key;
+      short_str   value;
+   };
+
+   int8_t*        m_ctrl;           //控制字节，长度为 m_capacity
+   slot*          m_slots;
+   size_t         m_capacity;       //槽位数，是 GROUP_SIZE 的 2 的幂次倍
+   size_t         m_size;
+   size_t         m_deleted;        //已删除的槽位，和 m_size 一起决定何时扩容
+
+private:
+   flat_table(const flat_table&) = delete;
+   flat_table& operator=(const flat_table&) = delete;
+
+   /*返回 key 所在的槽位，不存在返回 -1*/
+   long           find_slot(const char* key, size_t len, uint64_t h) const;
+
+   /*返回一个可以写入的槽位（空或者已删除）*/
+   size_t         find_free(uint64_t h) const;
+
+   void           rehash(size_t capacity);
+
+public:
+   flat_table();
+   ~flat_table();
+
+   bool           find(const char* key, size_t len, uint64_t h, std::string& value) const;
+   bool           find(const std::string& key, std::string& value) const
+                  {
+                     return find(key.data(), key.size(), hash(key.data(), key.size()), value);
+                  }
+
+   /*key 已存在时返回 false，不覆盖*/
+   bool           insert(const char* key, size_t len, uint64_t h, const char* value, size_t value_len);
+   bool           insert(const std::string& key, const std::string& value)
+                  {
+                     return insert(key.data(), key.size(), hash(key.data(), key.size()),
+                                   value.data(), value.size());
+                  }
+
+   bool           erase(const char* key, size_t len, uint64_t h);
+   bool           erase(const std::string& key)
+                  {
+                     return erase(key.data(), key.size(), hash(key.data(), key.size()));
+                  }
+
+   size_t         size() const { return m_size; }
+   size_t         capacity() const { return m_capacity; }
+};
+
+#endif
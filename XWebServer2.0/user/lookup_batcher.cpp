@@ -0,0 +1,152 @@
+#include "lookup_batcher.h"
+#include "../pool/sqlconn_pool.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+std::atomic<unsigned long> lookup_batcher::s_batches(0);
+std::atomic<unsigned long> lookup_batcher::s_names(0);
+
+lookup_batcher::lookup_batcher() :
+   m_waiting(0),
+   m_abandoned(false),
+   m_window_us(0),
+   m_stop(false)
+{
+
+}
+
+lookup_batcher::~lookup_batcher()
+{
+   {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_stop = true;
+   }
+   m_queue_cond.notify_all();
+   if ( m_thread.joinable() )
+      m_thread.join();
+}
+
+void lookup_batcher::init(batch_fn fn, int window_us)
+{
+   m_fn = std::move(fn);
+   m_window_us = window_us;
+   if ( m_window_us > 0 )
+      m_thread = std::thread(&lookup_batcher::run, this);
+}
+
+int lookup_batcher::lookup(const std::string& name, std::string& passwd)
+{
+   request_ptr req = std::make_shared<request>();
+   req->name = name;
+   req->res.ret = -1;
+   req->deadline = connection_scope::deadline();
+   req->done = false;
+   req->running = false;
+
+   std::unique_lock<std::mutex> lk(m_mutex);
+   m_queue.push_back(req);
+   m_queue_cond.notify_one();
+
+   //客户端断开只设置取消标记，不会唤醒这里，每隔 WATCH_INTERVAL_MS 检查一次
+   while ( !req->done )
+   {
+      if ( connection_scope::expired() )
+      {
+         abandon(req);
+         return -1;
+      }
+      auto poll = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds((int)connection_pool::WATCH_INTERVAL_MS);
+      m_done_cond.wait_until(lk, std::min(poll, req->deadline));
+   }
+
+   if ( req->res.ret == 1 )
+      passwd = std::move(req->res.passwd);
+   return req->res.ret;
+}
+
+void lookup_batcher::abandon(const request_ptr& req)
+{
+   if ( !req->running )
+   {
+      m_queue.erase(std::find(m_queue.begin(), m_queue.end(), req));
+      return;
+   }
+   if ( --m_waiting == 0 )
+      m_abandoned = true;
+}
+
+void lookup_batcher::run()
+{
+   std::vector<request_ptr> batch;
+   std::vector<std::string> names;
+   std::vector<result> results;
+   while ( true )
+   {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      m_queue_cond.wait(lk, [this] { return m_stop || !m_queue.empty(); });
+      if ( m_queue.empty() )
+         return;
+
+      /*第一个请求到达后再等一个时间窗口，让并发的登录凑成一批*/
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(m_window_us);
+      m_queue_cond.wait_until(lk, deadline, [this]
+                              { return m_stop || (int)m_queue.size() >= MAX_BATCH; });
+
+      auto batch_deadline = std::chrono::steady_clock::time_point::min();
+      while ( !m_queue.empty() && (int)batch.size() < MAX_BATCH )
+      {
+         request_ptr req = m_queue.front();
+         m_queue.pop_front();
+         req->running = true;
+         batch_deadline = std::max(batch_deadline, req->deadline);
+         names.push_back(req->name);
+         batch.push_back(std::move(req));
+      }
+      //窗口期间等待的请求可能都放弃了
+      if ( batch.empty() )
+         continue;
+      m_waiting = batch.size();
+      m_abandoned = false;
+      lk.unlock();
+
+      /*最晚的请求超时或者所有请求都放弃之后，连接池的监视线程 KILL 这一批的查询*/
+      results.clear();
+      {
+         connection_scope batch_scope(batch_deadline, &m_abandoned);
+         m_fn(names, results);
+      }
+
+      lk.lock();
+      for (size_t i = 0; i < batch.size(); ++i)
+      {
+         if ( i < results.size() )
+            batch[i]->res = std::move(results[i]);
+         batch[i]->done = true;
+         batch[i]->running = false;
+      }
+      m_waiting = 0;
+      lk.unlock();
+      m_done_cond.notify_all();
+
+      s_batches.fetch_add(1, std::memory_order_relaxed);
+      s_names.fetch_add(batch.size(), std::memory_order_relaxed);
+      batch.clear();
+      names.clear();
+   }
+}
+
+void lookup_batcher::report(std::string& out)
+{
+   unsigned long batches = s_batches.load(std::memory_order_relaxed);
+   unsigned long names = s_names.load(std::memory_order_relaxed);
+
+   char buf[256];
+   int len = snprintf(buf, sizeof(buf),
+                      "login_lookup_batches %lu\n"
+                      "login_lookup_names %lu\n"
+                      "login_lookup_avg_batch_size %.2f\n",
+                      batches, names, batches ? (double)names / batches : 0.0);
+   out.append(buf, len);
+}
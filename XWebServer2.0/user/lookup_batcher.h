@@ -0,0 +1,97 @@
+/*
+   登录查询合并，把并发的按用户名查密码合并成一次多键查询
+   1、工作线程提交用户名后等待结果，合并线程收集一个时间窗口内（或者凑满 MAX_BATCH 个）的请求
+   2、同一批用户名交给批量查询函数（MySQL 后端是一条 WHERE username IN (...)），
+      一次往返的开销由整批请求分摊，结果按用户名分发给各自的请求
+   3、放在查询结果缓存的后面，只有没有命中、也没有其它线程在查同一个键的请求才进入合并
+   4、等待不超过请求的截止时间，请求超时或被取消时放弃等待；
+      一批查询在合并线程的请求范围内执行，截止时间取这一批中最晚的，
+      这一批的请求都放弃后取消标记置位，监视线程 KILL 正在执行的查询
+   每个存储实例一个，时间窗口为 0 时不启用
+*/
+
+#ifndef LOOKUP_BATCHER_H
+#define LOOKUP_BATCHER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+
+class lookup_batcher
+{
+public:
+   static const int MAX_BATCH = 64;          //一批最多的用户名数
+
+   /*一个用户名的查询结果，ret 同 user_store::lookup*/
+   struct result
+   {
+      int               ret;
+      std::string       passwd;
+   };
+
+   /*批量查询函数，results 和 names 一一对应*/
+   typedef std::function<void(const std::vector<std::string>& names, std::vector<result>& results)>
+                        batch_fn;
+
+private:
+   /*请求由等待者和合并线程共同持有，等待者放弃后合并线程仍可以安全地写结果*/
+   struct request
+   {
+      std::string          name;
+      result               res;
+      std::chrono::steady_clock::time_point
+                           deadline;
+      bool                 done;
+      bool                 running;          //在正在执行的一批中
+   };
+   typedef std::shared_ptr<request> request_ptr;
+
+   std::deque<request_ptr> m_queue;
+   std::mutex              m_mutex;
+   std::condition_variable m_queue_cond;     //有新请求
+   std::condition_variable m_done_cond;      //有一批请求完成
+   int                     m_waiting;        //正在执行的一批中还在等待的请求数
+   std::atomic<bool>       m_abandoned;      //正在执行的一批都已放弃，作为合并线程请求范围的取消标记
+
+   batch_fn                m_fn;
+   std::thread             m_thread;
+   int                     m_window_us;      //收集请求的时间窗口（微秒）
+   bool                    m_stop;
+
+   /*所有实例合计的统计信息*/
+   static std::atomic<unsigned long>   s_batches;
+   static std::atomic<unsigned long>   s_names;
+
+private:
+   void                    run();
+
+   /*等待的请求超时或被取消，还没开始执行的从队列中去掉，调用时持有锁*/
+   void                    abandon(const request_ptr& req);
+
+public:
+   lookup_batcher();
+   ~lookup_batcher();
+
+   /*window_us 为 0 时不启动合并线程*/
+   void                    init(batch_fn fn, int window_us);
+
+   bool                    enabled() const { return m_window_us > 0; }
+
+   /*
+      阻塞到所在的一批查询完成，返回值同 user_store::lookup，只能在启用时调用
+      在请求范围内调用时最多等到请求的截止时间，超时或被取消返回 -1
+   */
+   int                     lookup(const std::string& name, std::string& passwd);
+
+   /*按 Prometheus 文本格式追加统计信息*/
+   static void             report(std::string& out);
+};
+
+#endif
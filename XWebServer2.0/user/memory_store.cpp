@@ -0,0 +1,35 @@
+#include "memory_store.h"
+
+#include <mutex>
+
+int memory_user_store::load(const user_visitor& visit)
+{
+   std::shared_lock<std::shared_mutex> lk(m_mutex);
+   for (auto& it : m_users)
+   {
+      visit(it.first, it.second);
+   }
+   return m_users.size();
+}
+
+int memory_user_store::exists(const std::string& name)
+{
+   std::shared_lock<std::shared_mutex> lk(m_mutex);
+   return m_users.count(name) ? 1 : 0;
+}
+
+int memory_user_store::lookup(const std::string& name, std::string& passwd)
+{
+   std::shared_lock<std::shared_mutex> lk(m_mutex);
+   auto it = m_users.find(name);
+   if ( it == m_users.end() )
+      return 0;
+   passwd = it->second;
+   return 1;
+}
+
+int memory_user_store::insert(const std::string& name, const std::string& passwd)
+{
+   std::unique_lock<std::shared_mutex> lk(m_mutex);
+   return m_users.emplace(name, passwd).second ? 0 : 1;
+}
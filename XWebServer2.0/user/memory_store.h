@@ -0,0 +1,30 @@
+/*
+   内存中的用户存储，不做持久化
+   没有数据库的开销，压测时用来衡量请求处理本身的性能，以及作为其它后端的对照
+*/
+
+#ifndef MEMORY_STORE_H
+#define MEMORY_STORE_H
+
+#include <unordered_map>
+#include <shared_mutex>
+
+#include "user_store.h"
+
+class memory_user_store : public user_store
+{
+private:
+   std::unordered_map<std::string, std::string>
+                        m_users;
+   std::shared_mutex    m_mutex;
+
+public:
+   const char*          name() const override { return "memory"; }
+
+   int                  load(const user_visitor& visit) override;
+   int                  exists(const std::string& name) override;
+   int                  lookup(const std::string& name, std::string& passwd) override;
+   int                  insert(const std::string& name, const std::string& passwd) override;
+};
+
+#endif
@@ -0,0 +1,474 @@
+#include "mysql_store.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unordered_map>
+
+mysql_user_store::mysql_user_store(connection_pool* connPool, int close_log, db_router* router,
+                                   const std::string& cache_tag, int lookup_window) :
+   m_connPool(connPool),
+   m_router(router),
+   m_cache_tag(cache_tag),
+   m_batch_conn(NULL),
+   m_close_log(close_log)
+{
+   m_batcher.init([this](const std::vector<std::string>& names,
+                         std::vector<lookup_batcher::result>& results)
+   {
+      lookup_batch_db(names, results);
+   }, lookup_window);
+}
+
+mysql_user_store::~mysql_user_store()
+{
+   if ( m_batch_conn )
+      connection_pool::CloseConnection(m_batch_conn);
+}
+
+int mysql_user_store::load(const user_visitor& visit)
+{
+   MYSQL* mysql = NULL;
+   connectionRAII mysqlcon(&mysql, m_connPool);
+   if ( mysql == NULL )
+      return -1;
+
+   //在user表中检索username，passwd数据
+   if ( mysql_query(mysql, "SELECT username,passwd FROM user") )
+   {
+      LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+      return -1;
+   }
+
+   MYSQL_RES* result = mysql_store_result(mysql);
+   if ( result == NULL )
+      return -1;
+
+   int count = 0;
+   while ( MYSQL_ROW row = mysql_fetch_row(result) )
+   {
+      visit(row[0], row[1]);
+      ++count;
+   }
+   mysql_free_result(result);
+
+   return count;
+}
+
+/*
+   按 id 顺序读取，watermark 只在读完之后更新
+   并发写入的事务可能不按 id 顺序提交，快照由同一进程的注册写入线程按顺序写入时没有这个问题
+*/
+int mysql_user_store::load_since(uint64_t since, const user_visitor& visit, uint64_t& watermark)
+{
+   uint64_t last = since;
+   int count = scan(since, 0, [&](uint64_t id, const std::string& name, const std::string& passwd)
+   {
+      last = id;
+      visit(name, passwd);
+   });
+   if ( count < 0 )
+      return -1;
+
+   watermark = last;
+   return count;
+}
+
+int mysql_user_store::scan(uint64_t since, int limit, const id_visitor& visit)
+{
+   MYSQL* mysql = NULL;
+   connectionRAII mysqlcon(&mysql, m_connPool);
+   if ( mysql == NULL )
+      return -1;
+
+   char sql[160];
+   int len = snprintf(sql, sizeof(sql), "SELECT id,username,passwd FROM user WHERE id>%llu ORDER BY id",
+                      (unsigned long long)since);
+   if ( limit > 0 )
+      snprintf(sql + len, sizeof(sql) - len, " LIMIT %d", limit);
+   if ( mysql_query(mysql, sql) )
+   {
+      LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+      return -1;
+   }
+
+   MYSQL_RES* result = mysql_use_result(mysql);
+   if ( result == NULL )
+      return -1;
+
+   int count = 0;
+   while ( MYSQL_ROW row = mysql_fetch_row(result) )
+   {
+      visit(strtoull(row[0], NULL, 10), row[1], row[2]);
+      ++count;
+   }
+   mysql_free_result(result);
+
+   return count;
+}
+
+int mysql_user_store::remove(uint64_t id, const std::string& name)
+{
+   MYSQL* mysql = NULL;
+   connectionRAII mysqlcon(&mysql, m_connPool);
+   if ( mysql == NULL )
+      return -1;
+
+   char sql[64];
+   snprintf(sql, sizeof(sql), "DELETE FROM user WHERE id=%llu", (unsigned long long)id);
+   if ( mysql_query(mysql, sql) )
+   {
+      LOG_ERROR("DELETE error:%s\n", mysql_error(mysql));
+      return -1;
+   }
+
+   invalidate(name);
+   return 0;
+}
+
+/*找只有 username 一列的唯一索引（包括主键），username 只是联合唯一索引的一部分时不能保证不重名*/
+int mysql_user_store::unique_names()
+{
+   MYSQL* mysql = NULL;
+   connectionRAII mysqlcon(&mysql, m_connPool);
+   if ( mysql == NULL )
+      return -1;
+
+   if ( mysql_query(mysql, "SELECT INDEX_NAME FROM information_schema.STATISTICS "
+                           "WHERE TABLE_SCHEMA=DATABASE() AND TABLE_NAME='user' AND NON_UNIQUE=0 "
+                           "GROUP BY INDEX_NAME HAVING COUNT(*)=1 AND MAX(COLUMN_NAME)='username'") )
+   {
+      LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+      return -1;
+   }
+
+   MYSQL_RES* result = mysql_store_result(mysql);
+   if ( result == NULL )
+      return -1;
+   int unique = mysql_num_rows(result) > 0 ? 1 : 0;
+   mysql_free_result(result);
+   return unique;
+}
+
+/*绑定一个字符串参数*/
+static void bind_string(MYSQL_BIND& bind, const std::string& str, unsigned long& len)
+{
+   memset(&bind, 0, sizeof(bind));
+   len = str.size();
+   bind.buffer_type = MYSQL_TYPE_STRING;
+   bind.buffer = (void*)str.data();
+   bind.buffer_length = len;
+   bind.length = &len;
+}
+
+/*查询失败时区分是这个请求自己超时或被取消，还是数据库出错，前者不影响等待同一个结果的其它请求*/
+static int load_error()
+{
+   return connection_scope::expired() ? query_cache::LOAD_ABORTED : -1;
+}
+
+int mysql_user_store::exists(const std::string& name)
+{
+   query_cache::result_ptr res = query_cache::get_instance()->get(
+      query_cache::make_key("user.exists", { m_cache_tag, name }), "user", [this, &name](query_cache::result& rows)
+      {
+         int ret = exists_db(name);
+         if ( ret == 1 )
+            rows.emplace_back();
+         return ret < 0 ? load_error() : (ret == 1 ? (int)FOUND_TTL : (int)MISSING_TTL);
+      }, connection_scope::deadline());
+   if ( !res )
+      return -1;
+   return res->empty() ? 0 : 1;
+}
+
+int mysql_user_store::lookup(const std::string& name, std::string& passwd)
+{
+   query_cache::result_ptr res = query_cache::get_instance()->get(
+      query_cache::make_key("user.lookup", { m_cache_tag, name }), "user", [this, &name](query_cache::result& rows)
+      {
+         std::string value;
+         int ret;
+         if ( m_batcher.enabled() )
+         {
+            //合并线程自己取连接，等待期间不占用请求租用的连接
+            connection_scope::release();
+            ret = m_batcher.lookup(name, value);
+         }
+         else
+         {
+            ret = lookup_db(name, value);
+         }
+         if ( ret == 1 )
+            rows.push_back({ value });
+         return ret < 0 ? load_error() : (ret == 1 ? (int)FOUND_TTL : (int)MISSING_TTL);
+      }, connection_scope::deadline());
+   if ( !res )
+      return -1;
+   if ( res->empty() )
+      return 0;
+   passwd = (*res)[0][0];
+   return 1;
+}
+
+connection_pool* mysql_user_store::reader(const std::string& name)
+{
+   return m_router ? m_router->reader(name) : m_connPool;
+}
+
+/*先记下写入再删缓存，删除之后重新查询的请求不会从还没追上的从库读到旧结果再缓存起来*/
+void mysql_user_store::invalidate(const std::string& name)
+{
+   if ( m_router )
+      m_router->wrote(name);
+
+   query_cache* cache = query_cache::get_instance();
+   cache->invalidate(query_cache::make_key("user.exists", { m_cache_tag, name }));
+   cache->invalidate(query_cache::make_key("user.lookup", { m_cache_tag, name }));
+}
+
+int mysql_user_store::exists_db(const std::string& name)
+{
+   MYSQL* mysql = NULL;
+   connectionRAII mysqlcon(&mysql, reader(name));
+   if ( mysql == NULL )
+      return -1;
+
+   MYSQL_BIND param;
+   unsigned long len;
+   bind_string(param, name, len);
+
+   stmt_cache* stmts = connection_pool::GetStmtCache(mysql);
+   if ( stmts->execute(STMT_EXISTS, &param) )
+      return -1;
+
+   MYSQL_STMT* stmt = stmts->get(STMT_EXISTS);
+   int ret = mysql_stmt_fetch(stmt);
+   mysql_stmt_free_result(stmt);
+   if ( ret != 0 && ret != MYSQL_NO_DATA && ret != MYSQL_DATA_TRUNCATED )
+      return -1;
+
+   return ret != MYSQL_NO_DATA;
+}
+
+int mysql_user_store::lookup_db(const std::string& name, std::string& passwd)
+{
+   MYSQL* mysql = NULL;
+   connectionRAII mysqlcon(&mysql, reader(name));
+   if ( mysql == NULL )
+      return -1;
+
+   MYSQL_BIND param;
+   unsigned long len;
+   bind_string(param, name, len);
+
+   stmt_cache* stmts = connection_pool::GetStmtCache(mysql);
+   if ( stmts->execute(STMT_LOGIN, &param) )
+      return -1;
+
+   char buf[256];
+   unsigned long buf_len = 0;
+   sql_bool is_null = 0;
+   MYSQL_BIND result;
+   memset(&result, 0, sizeof(result));
+   result.buffer_type = MYSQL_TYPE_STRING;
+   result.buffer = buf;
+   result.buffer_length = sizeof(buf);
+   result.length = &buf_len;
+   result.is_null = &is_null;
+
+   MYSQL_STMT* stmt = stmts->get(STMT_LOGIN);
+   int ret = -1;
+   if ( !mysql_stmt_bind_result(stmt, &result) )
+   {
+      int fetch = mysql_stmt_fetch(stmt);
+      if ( fetch == MYSQL_NO_DATA )
+      {
+         ret = 0;
+      }
+      else if ( fetch == 0 && !is_null )
+      {
+         passwd.assign(buf, buf_len);
+         ret = 1;
+      }
+   }
+   mysql_stmt_free_result(stmt);
+   return ret;
+}
+
+/*
+   刚写入过的用户名可能要读主库，按读取使用的连接池分组，每组一条 IN 查询
+   结果按用户名精确匹配，和内存中的用户缓存一致
+*/
+void mysql_user_store::lookup_batch_db(const std::vector<std::string>& names,
+                                       std::vector<lookup_batcher::result>& results)
+{
+   results.assign(names.size(), { -1, "" });
+
+   std::vector<connection_pool*> pools;
+   std::vector<std::vector<size_t>> groups;
+   for (size_t i = 0; i < names.size(); ++i)
+   {
+      connection_pool* pool = reader(names[i]);
+      size_t g = 0;
+      while ( g < pools.size() && pools[g] != pool )
+         ++g;
+      if ( g == pools.size() )
+      {
+         pools.push_back(pool);
+         groups.emplace_back();
+      }
+      groups[g].push_back(i);
+   }
+
+   for (size_t g = 0; g < pools.size(); ++g)
+   {
+      MYSQL* mysql = NULL;
+      connectionRAII mysqlcon(&mysql, pools[g]);
+      if ( mysql == NULL )
+         continue;
+
+      std::string sql = "SELECT username,passwd FROM user WHERE username IN (";
+      std::vector<char> escaped;
+      for (size_t j = 0; j < groups[g].size(); ++j)
+      {
+         const std::string& name = names[groups[g][j]];
+         escaped.resize(name.size() * 2 + 1);
+         unsigned long len = mysql_real_escape_string(mysql, escaped.data(), name.data(), name.size());
+         if ( j > 0 )
+            sql += ',';
+         sql += '\'';
+         sql.append(escaped.data(), len);
+         sql += '\'';
+      }
+      sql += ')';
+
+      if ( mysql_real_query(mysql, sql.data(), sql.size()) )
+      {
+         LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+         continue;
+      }
+
+      MYSQL_RES* result = mysql_store_result(mysql);
+      if ( result == NULL )
+         continue;
+
+      std::unordered_map<std::string, std::string> found;
+      while ( MYSQL_ROW row = mysql_fetch_row(result) )
+      {
+         unsigned long* lens = mysql_fetch_lengths(result);
+         if ( row[0] && row[1] )
+            found.emplace(std::string(row[0], lens[0]), std::string(row[1], lens[1]));
+      }
+      mysql_free_result(result);
+
+      for (size_t i : groups[g])
+      {
+         auto it = found.find(names[i]);
+         if ( it == found.end() )
+         {
+            results[i].ret = 0;
+         }
+         else
+         {
+            results[i].ret = 1;
+            results[i].passwd = it->second;
+         }
+      }
+   }
+}
+
+int mysql_user_store::insert_on(MYSQL* mysql, const std::string& name, const std::string& passwd,
+                                bool retry)
+{
+   MYSQL_BIND params[2];
+   unsigned long lens[2];
+   bind_string(params[0], name, lens[0]);
+   bind_string(params[1], passwd, lens[1]);
+
+   unsigned int err = connection_pool::GetStmtCache(mysql)->execute(STMT_REGISTER, params, retry);
+   if ( err == 0 )
+      return 0;
+   return err == ER_DUP_ENTRY ? 1 : -1;
+}
+
+int mysql_user_store::insert(const std::string& name, const std::string& passwd)
+{
+   MYSQL* mysql = NULL;
+   connectionRAII mysqlcon(&mysql, m_connPool);
+   if ( mysql == NULL )
+      return -1;
+
+   //写入成功或者用户名已存在，缓存中“不存在”的结果都已经过时
+   int ret = insert_on(mysql, name, passwd, true);
+   if ( ret >= 0 )
+      invalidate(name);
+   return ret;
+}
+
+/*
+   事务中出现重复以外的错误（比如连接断开）时整批回滚，除重复的以外都算失败
+   事务中的语句不自动重试，避免重连后在自动提交模式下写入一半
+*/
+void mysql_user_store::insert_batch(const user_list& users, std::vector<int>& results)
+{
+   results.assign(users.size(), -1);
+
+   if ( m_batch_conn == NULL )
+   {
+      m_batch_conn = m_connPool->NewConnection();
+      if ( m_batch_conn == NULL )
+         return;
+   }
+
+   //等待这一批的请求都已经放弃，不再写入
+   if ( connection_scope::expired() )
+      return;
+
+   mysql_ping(m_batch_conn);
+   if ( mysql_autocommit(m_batch_conn, 0) )
+   {
+      LOG_ERROR("autocommit error:%s", mysql_error(m_batch_conn));
+      return;
+   }
+
+   /*
+      写入线程在这一批的请求范围内调用，INSERT 执行期间登记给监视线程，请求都放弃后被 KILL，
+      提交和回滚之前注销，KILL 不会落到它们上面，回滚失败后打开自动提交会把写了一半的事务提交
+   */
+   bool failed = false;
+   m_connPool->WatchConnection(m_batch_conn);
+   for (size_t i = 0; i < users.size(); ++i)
+   {
+      results[i] = insert_on(m_batch_conn, users[i].first, users[i].second, false);
+      if ( results[i] < 0 )
+      {
+         failed = true;
+         break;
+      }
+   }
+   m_connPool->UnwatchConnection(m_batch_conn);
+
+   if ( !failed && mysql_commit(m_batch_conn) )
+   {
+      LOG_ERROR("commit error:%s", mysql_error(m_batch_conn));
+      failed = true;
+   }
+
+   if ( failed )
+   {
+      mysql_rollback(m_batch_conn);
+      for (int& ret : results)
+      {
+         if ( ret != 1 )
+            ret = -1;
+      }
+   }
+   mysql_autocommit(m_batch_conn, 1);
+
+   for (size_t i = 0; i < users.size(); ++i)
+   {
+      if ( results[i] >= 0 )
+         invalidate(users[i].first);
+   }
+}
@@ -0,0 +1,81 @@
+/*
+   MySQL 用户存储
+   1、每次调用从连接池取一个连接，使用连接自带的预处理语句
+   2、批量写入只由注册写入线程调用，使用单独的连接，在一个事务中提交
+   3、增量加载依赖 user 表的自增列 id，没有这一列时快照不可用，启动时退回全表加载；
+      重名判断依赖 username 上只有这一列的唯一索引，启动时检查，没有时注册总是先到数据库确认
+   4、exists 和 lookup 的结果放在查询结果缓存中，不存在的结果只缓存几秒，写入后删除对应的项
+   5、exists 和 lookup 由 db_router 选择从库读取，写入和加载走主库，写入后通知 db_router 实现读己之写，
+      没有 db_router 时（比如作为分片的一个实例）都走 connPool
+   6、启用查询合并时，lookup 在查询结果缓存未命中后交给 lookup_batcher，并发的查询合并成一条 IN 查询
+*/
+
+#ifndef MYSQL_STORE_H
+#define MYSQL_STORE_H
+
+#include "../pool/sqlconn_pool.h"
+#include "../pool/query_cache.h"
+#include "../pool/db_router.h"
+#include "user_store.h"
+#include "lookup_batcher.h"
+
+class mysql_user_store : public user_store
+{
+public:
+   static const int FOUND_TTL    = 60;        //查到的结果缓存的秒数
+   static const int MISSING_TTL  = 5;         //不存在的结果缓存的秒数
+
+   /*scan 访问的用户：序号、用户名、密码*/
+   typedef std::function<void(uint64_t, const std::string&, const std::string&)> id_visitor;
+
+private:
+   connection_pool*     m_connPool;       //主库
+   db_router*           m_router;         //读写分离，可以为空
+   std::string          m_cache_tag;      //查询结果缓存的键前缀，多个实例共用缓存时区分实例
+   MYSQL*               m_batch_conn;     //批量写入使用的连接，第一次写入时建立
+   int                  m_close_log;
+   lookup_batcher       m_batcher;        //最后一个成员，先于其它成员析构，合并线程会用到它们
+
+private:
+   /*在指定的连接上写入，在事务中调用时 retry 为 false*/
+   int                  insert_on(MYSQL* mysql, const std::string& name, const std::string& passwd,
+                                  bool retry);
+
+   /*直接查数据库，不经过查询结果缓存*/
+   int                  exists_db(const std::string& name);
+   int                  lookup_db(const std::string& name, std::string& passwd);
+
+   /*合并线程调用，一条 IN 查询查多个用户名*/
+   void                 lookup_batch_db(const std::vector<std::string>& names,
+                                        std::vector<lookup_batcher::result>& results);
+
+   /*写入 name 之后删除它在查询结果缓存中的项，并通知 db_router*/
+   void                 invalidate(const std::string& name);
+
+   /*读取 name 使用的连接池*/
+   connection_pool*     reader(const std::string& name);
+
+public:
+   /*lookup_window 是登录查询合并的时间窗口（微秒），0 表示不合并*/
+   mysql_user_store(connection_pool* connPool, int close_log, db_router* router = NULL,
+                    const std::string& cache_tag = "", int lookup_window = 0);
+   ~mysql_user_store();
+
+   const char*          name() const override { return "mysql"; }
+
+   int                  load(const user_visitor& visit) override;
+   int                  load_since(uint64_t since, const user_visitor& visit, uint64_t& watermark) override;
+   int                  exists(const std::string& name) override;
+   int                  lookup(const std::string& name, std::string& passwd) override;
+   int                  insert(const std::string& name, const std::string& passwd) override;
+   void                 insert_batch(const user_list& users, std::vector<int>& results) override;
+   int                  unique_names() override;
+
+   /*按 id 顺序访问 id 大于 since 的用户，limit 为 0 表示不限，返回访问的用户数，失败返回 -1*/
+   int                  scan(uint64_t since, int limit, const id_visitor& visit);
+
+   /*按 id 删除用户，name 用于清理缓存，返回 0 成功，-1 出错*/
+   int                  remove(uint64_t id, const std::string& name);
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "register_writer.h"
+#include "user_cache.h"
+#include "../pool/sqlconn_pool.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+register_writer::register_writer() : 
+   m_waiting(0),
+   m_abandoned(false),
+   m_store(NULL), 
+   m_window_us(0), 
+   m_batch_size(1), 
+   m_stop(false), 
+   m_close_log(0),
+   m_batches(0),
+   m_rows(0)
+{
+
+}
+
+register_writer::~register_writer()
+{
+   {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_stop = true;
+   }
+   m_queue_cond.notify_all();
+   if ( m_thread.joinable() )
+      m_thread.join();
+}
+
+register_writer* register_writer::get_instance()
+{
+   static register_writer writer;
+   return &writer;
+}
+
+bool register_writer::init(user_store* store, int window_us, int batch_size, int close_log)
+{
+   m_store = store;
+   m_window_us = window_us;
+   m_batch_size = batch_size > 0 ? batch_size : 1;
+   m_close_log = close_log;
+   if ( m_window_us <= 0 )
+      return true;
+
+   m_thread = std::thread(&register_writer::run, this);
+   return true;
+}
+
+int register_writer::submit(const std::string& name, const std::string& passwd)
+{
+   if ( m_window_us <= 0 )
+      return user_cache::get_instance()->insert_db(name, passwd);
+
+   //写入线程用自己的连接，等待期间把请求租用的连接还回去
+   connection_scope::release();
+
+   request_ptr req = std::make_shared<reg_request>();
+   req->name = name;
+   req->passwd = passwd;
+   req->result = -1;
+   req->deadline = connection_scope::deadline();
+   req->done = false;
+   req->running = false;
+
+   std::unique_lock<std::mutex> lk(m_mutex);
+   m_queue.push_back(req);
+   m_queue_cond.notify_one();
+
+   //客户端断开只设置取消标记，不会唤醒这里，每隔 WATCH_INTERVAL_MS 检查一次
+   while ( !req->done )
+   {
+      if ( connection_scope::expired() )
+      {
+         abandon(req);
+         return -1;
+      }
+      auto poll = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds((int)connection_pool::WATCH_INTERVAL_MS);
+      m_done_cond.wait_until(lk, std::min(poll, req->deadline));
+   }
+   return req->result;
+}
+
+void register_writer::abandon(const request_ptr& req)
+{
+   if ( !req->running )
+   {
+      m_queue.erase(std::find(m_queue.begin(), m_queue.end(), req));
+      return;
+   }
+   if ( --m_waiting == 0 )
+      m_abandoned = true;
+}
+
+void register_writer::submit_async(const std::string& name, const std::string& passwd,
+                                   std::function<void(int)> callback)
+{
+   request_ptr req = std::make_shared<reg_request>();
+   req->name = name;
+   req->passwd = passwd;
+   req->result = -1;
+   req->deadline = std::chrono::steady_clock::time_point::max();
+   req->done = false;
+   req->running = false;
+   req->callback = std::move(callback);
+
+   std::lock_guard<std::mutex> lk(m_mutex);
+   m_queue.push_back(req);
+   m_queue_cond.notify_one();
+}
+
+void register_writer::run()
+{
+   std::vector<request_ptr> batch;
+   while ( true )
+   {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      m_queue_cond.wait(lk, [this] { return m_stop || !m_queue.empty(); });
+      if ( m_queue.empty() )
+         return;
+
+      /*第一个请求到达后再等一个时间窗口，让并发的注册凑成一批*/
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(m_window_us);
+      m_queue_cond.wait_until(lk, deadline, [this] 
+                              { return m_stop || (int)m_queue.size() >= m_batch_size; });
+
+      auto batch_deadline = std::chrono::steady_clock::time_point::min();
+      while ( !m_queue.empty() && (int)batch.size() < m_batch_size )
+      {
+         request_ptr req = m_queue.front();
+         m_queue.pop_front();
+         req->running = true;
+         batch_deadline = std::max(batch_deadline, req->deadline);
+         batch.push_back(std::move(req));
+      }
+      //窗口期间等待的请求可能都放弃了
+      if ( batch.empty() )
+         continue;
+      m_waiting = batch.size();
+      m_abandoned = false;
+      lk.unlock();
+
+      /*最晚的请求超时或者同步请求都放弃之后，连接池的监视线程 KILL 这一批的 INSERT*/
+      {
+         connection_scope batch_scope(batch_deadline, &m_abandoned);
+         write_batch(batch);
+      }
+
+      for (const request_ptr& req : batch)
+      {
+         if ( req->callback )
+            req->callback(req->result);
+      }
+
+      lk.lock();
+      for (const request_ptr& req : batch)
+      {
+         req->done = true;
+         req->running = false;
+      }
+      m_waiting = 0;
+      lk.unlock();
+      m_done_cond.notify_all();
+      batch.clear();
+   }
+}
+
+void register_writer::write_batch(std::vector<request_ptr>& batch)
+{
+   user_store::user_list users;
+   users.reserve(batch.size());
+   for (const request_ptr& req : batch)
+   {
+      users.emplace_back(req->name, req->passwd);
+   }
+
+   std::vector<int> results;
+   m_store->insert_batch(users, results);
+   for (size_t i = 0; i < batch.size(); ++i)
+   {
+      batch[i]->result = results[i];
+   }
+
+   m_batches.fetch_add(1, std::memory_order_relaxed);
+   m_rows.fetch_add(batch.size(), std::memory_order_relaxed);
+}
+
+void register_writer::report(std::string& out) const
+{
+   unsigned long batches = m_batches.load(std::memory_order_relaxed);
+   unsigned long rows = m_rows.load(std::memory_order_relaxed);
+
+   char buf[256];
+   int len = snprintf(buf, sizeof(buf),
+                      "register_batches %lu\n"
+                      "register_rows %lu\n"
+                      "register_avg_batch_size %.2f\n",
+                      batches, rows, batches ? (double)rows / batches : 0.0);
+   out.append(buf, len);
+}
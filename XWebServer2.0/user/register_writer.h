@@ -0,0 +1,100 @@
+/*
+   注册写入线程（全局只允许一个实例），把并发的注册合并成一次提交
+   1、工作线程提交注册请求后等待结果，写入线程收集一个时间窗口内（或者凑满一批）的请求
+   2、同一批请求交给存储后端批量写入，支持事务的后端只提交一次，提交的开销由整批请求分摊
+   3、重复的用户名只会让那一条语句失败，不影响同一批中的其它请求，每个请求得到各自的结果
+   4、MySQL 后端的批量写入使用单独的数据库连接，不和工作线程争抢连接池
+   5、submit_async 不等待，结果在写入线程中通过回调返回
+   6、submit 最多等到请求的截止时间，超时或被取消时放弃等待，还没开始写入的不再写入；
+      一批在写入线程的请求范围内写入，截止时间取这一批中最晚的，这一批的同步请求都放弃后
+      取消标记置位，监视线程 KILL 正在执行的 INSERT，整批回滚
+   时间窗口为 0 时不启用，注册直接在工作线程中写入
+*/
+
+#ifndef REGISTER_WRITER_H
+#define REGISTER_WRITER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+
+#include "user_store.h"
+
+class register_writer
+{
+private:
+   /*请求由等待者和写入线程共同持有，等待者放弃后写入线程仍可以安全地写结果*/
+   struct reg_request
+   {
+      std::string       name;
+      std::string       passwd;
+      int               result;
+      std::chrono::steady_clock::time_point
+                        deadline;
+      bool              done;
+      bool              running;       //在正在写入的一批中
+      std::function<void(int)>
+                        callback;      //异步提交时不为空，不会放弃
+   };
+   typedef std::shared_ptr<reg_request> request_ptr;
+
+   std::deque<request_ptr>    m_queue;
+   std::mutex                 m_mutex;
+   std::condition_variable    m_queue_cond;     //有新请求
+   std::condition_variable    m_done_cond;      //有一批请求完成
+   int                        m_waiting;        //正在写入的一批中还在等待的请求数
+   std::atomic<bool>          m_abandoned;      //正在写入的一批都已放弃，作为写入线程请求范围的取消标记
+
+   user_store*                m_store;
+   std::thread                m_thread;
+   int                        m_window_us;      //收集请求的时间窗口（微秒）
+   int                        m_batch_size;     //一批最多的请求数
+   bool                       m_stop;
+   int                        m_close_log;
+
+   std::atomic<unsigned long> m_batches;
+   std::atomic<unsigned long> m_rows;
+
+private:
+   register_writer();
+   ~register_writer();
+
+   void                       run();
+
+   /*批量写入一批请求*/
+   void                       write_batch(std::vector<request_ptr>& batch);
+
+   /*等待的请求超时或被取消，还没开始写入的从队列中去掉，调用时持有锁*/
+   void                       abandon(const request_ptr& req);
+
+public:
+   static register_writer*    get_instance();
+
+   /*window_us 为 0 时不启动写入线程，失败返回 false*/
+   bool                       init(user_store* store, int window_us, int batch_size, int close_log);
+
+   /*
+      写入一个新用户，阻塞到所在的一批提交完成
+      返回 0 成功，1 用户名重复，-1 出错，在请求范围内调用时超时或被取消也返回 -1（这时可能已经写入）
+      没有启用时直接在调用者的线程中写入
+   */
+   int                        submit(const std::string& name, const std::string& passwd);
+
+   /*只能在启用时调用，写入完成后在写入线程中以同样的返回值调用 callback*/
+   void                       submit_async(const std::string& name, const std::string& passwd,
+                                           std::function<void(int)> callback);
+
+   bool                       enabled() const { return m_window_us > 0; }
+
+   /*按 Prometheus 文本格式追加统计信息*/
+   void                       report(std::string& out) const;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "session_table.h"
+#include "../timer/timer.h"
+
+#include <stdio.h>
+#include <sys/random.h>
+
+session_table::session_table() :
+   m_ttl(DEFAULT_TTL),
+   m_size(0),
+   m_created(0),
+   m_hits(0),
+   m_misses(0),
+   m_expired(0)
+{
+
+}
+
+session_table* session_table::get_instance()
+{
+   static session_table table;
+   return &table;
+}
+
+void session_table::init(int ttl)
+{
+   if ( ttl > 0 )
+      m_ttl = ttl;
+}
+
+static int hex_value(char c)
+{
+   if ( c >= '0' && c <= '9' )
+      return c - '0';
+   if ( c >= 'a' && c <= 'f' )
+      return c - 'a' + 10;
+   return -1;
+}
+
+session_table::shard& session_table::get_shard(const char* id)
+{
+   return m_shards[hex_value(id[0]) % SHARD_NUM];
+}
+
+bool session_table::create(const std::string& user, char* id)
+{
+   unsigned char bytes[ID_LEN / 2];
+   if ( getrandom(bytes, sizeof(bytes), 0) != (ssize_t)sizeof(bytes) )
+      return false;
+
+   static const char digits[] = "0123456789abcdef";
+   for (int i = 0; i < ID_LEN / 2; ++i)
+   {
+      id[2 * i] = digits[bytes[i] >> 4];
+      id[2 * i + 1] = digits[bytes[i] & 0xf];
+   }
+   id[ID_LEN] = '\0';
+
+   session s = { user, time(NULL) + m_ttl };
+   shard& sh = get_shard(id);
+   {
+      std::unique_lock<std::shared_mutex> lk(sh.mutex);
+      if ( !sh.sessions.emplace(std::string(id, ID_LEN), s).second )
+         return false;
+   }
+   m_size.fetch_add(1, std::memory_order_relaxed);
+   m_created.fetch_add(1, std::memory_order_relaxed);
+
+   std::lock_guard<std::mutex> lk(m_pending_mutex);
+   m_pending.push_back(std::string(id, ID_LEN));
+   return true;
+}
+
+bool session_table::find(const char* id, std::string* user)
+{
+   /*Cookie 来自客户端，格式不对的直接拒绝，也保证了选分片时下标合法*/
+   for (int i = 0; i < ID_LEN; ++i)
+   {
+      if ( hex_value(id[i]) < 0 )
+      {
+         m_misses.fetch_add(1, std::memory_order_relaxed);
+         return false;
+      }
+   }
+
+   bool found = false;
+   shard& sh = get_shard(id);
+   {
+      std::shared_lock<std::shared_mutex> lk(sh.mutex);
+      auto it = sh.sessions.find(std::string(id, ID_LEN));
+      if ( it != sh.sessions.end() && it->second.expire > time(NULL) )
+      {
+         found = true;
+         if ( user )
+            *user = it->second.user;
+      }
+   }
+   (found ? m_hits : m_misses).fetch_add(1, std::memory_order_relaxed);
+   return found;
+}
+
+/*
+   有效期固定，同一批会话中最晚过期的也不会晚于现在加上有效期，
+   所以整批共用一个定时器，堆中的定时器数量和心搏次数相当，而不是和会话数量相当
+*/
+void session_table::schedule(time_heap& heap)
+{
+   std::vector<std::string>* batch = new std::vector<std::string>;
+   {
+      std::lock_guard<std::mutex> lk(m_pending_mutex);
+      batch->swap(m_pending);
+   }
+   if ( batch->empty() )
+   {
+      delete batch;
+      return;
+   }
+
+   heap_timer* timer = new heap_timer(m_ttl);
+   timer->task = expire_batch;
+   timer->arg = batch;
+   heap.add_timer(timer);
+}
+
+void session_table::expire_batch(void* arg)
+{
+   std::vector<std::string>* batch = (std::vector<std::string>*)arg;
+   session_table* table = get_instance();
+   time_t now = time(NULL);
+
+   size_t removed = 0;
+   for (const std::string& id : *batch)
+   {
+      shard& sh = table->get_shard(id.c_str());
+      std::unique_lock<std::shared_mutex> lk(sh.mutex);
+      auto it = sh.sessions.find(id);
+      if ( it != sh.sessions.end() && it->second.expire <= now )
+      {
+         sh.sessions.erase(it);
+         ++removed;
+      }
+   }
+   table->m_size.fetch_sub(removed, std::memory_order_relaxed);
+   table->m_expired.fetch_add(removed, std::memory_order_relaxed);
+   delete batch;
+}
+
+void session_table::report(std::string& out) const
+{
+   char buf[256];
+   int len = snprintf(buf, sizeof(buf),
+                      "session_active %lu\n"
+                      "session_created %lu\n"
+                      "session_hits %lu\n"
+                      "session_misses %lu\n"
+                      "session_expired %lu\n",
+                      (unsigned long)size(),
+                      m_created.load(std::memory_order_relaxed),
+                      m_hits.load(std::memory_order_relaxed),
+                      m_misses.load(std::memory_order_relaxed),
+                      m_expired.load(std::memory_order_relaxed));
+   out.append(buf, len);
+}
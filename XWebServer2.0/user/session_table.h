@@ -0,0 +1,96 @@
+/*
+   登录会话表（全局只允许一个实例）
+   1、登录成功后生成一个随机的会话 ID 写进 Cookie，之后带着这个 Cookie 的请求只需要查一次表，
+      不用再比对密码或者访问数据库
+   2、会话 ID 是 128 位随机数的十六进制表示，第一个字符直接选出分片，每个分片一把读写锁，
+      分片内是哈希表，查找是 O(1)
+   3、会话的有效期固定，查找时检查是否过期；过期会话的内存由事件循环的时间堆回收：
+      工作线程创建的会话先放进待定列表，事件循环每次心搏时把它们合并成一个定时器挂到时间堆上
+*/
+
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <time.h>
+
+class time_heap;
+
+class session_table
+{
+public:
+   static const int SHARD_NUM   = 16;
+   static const int ID_LEN      = 32;          //会话 ID 的长度（十六进制字符）
+   static const int DEFAULT_TTL = 1800;        //默认有效期（秒）
+
+private:
+   struct session
+   {
+      std::string                user;
+      time_t                     expire;
+   };
+
+   struct alignas(64) shard
+   {
+      mutable std::shared_mutex  mutex;
+      std::unordered_map<std::string, session>
+                                 sessions;      //会话 ID -> 会话
+   };
+
+   shard                m_shards[SHARD_NUM];
+   int                  m_ttl;
+
+   /*还没有挂到时间堆上的会话 ID，只在事件循环中取走*/
+   std::mutex           m_pending_mutex;
+   std::vector<std::string>
+                        m_pending;
+
+   std::atomic<size_t>  m_size;
+   std::atomic<unsigned long>
+                        m_created;
+   std::atomic<unsigned long>
+                        m_hits;
+   std::atomic<unsigned long>
+                        m_misses;
+   std::atomic<unsigned long>
+                        m_expired;
+
+private:
+   session_table();
+   ~session_table() {}
+
+   /*ID 是随机的十六进制串，第一个字符就足够均匀*/
+   shard&               get_shard(const char* id);
+
+   /*时间堆上的定时器到期时调用，arg 是一批会话 ID*/
+   static void          expire_batch(void* arg);
+
+public:
+   static session_table*
+                        get_instance();
+
+   void                 init(int ttl);
+
+   int                  ttl() const { return m_ttl; }
+
+   /*为 user 创建会话，ID 写入 id（至少 ID_LEN + 1 字节），取随机数失败返回 false*/
+   bool                 create(const std::string& user, char* id);
+
+   /*查找没有过期的会话，找到时 user 不为 NULL 则写入用户名*/
+   bool                 find(const char* id, std::string* user = NULL);
+
+   /*只在事件循环中调用：把新建的会话挂到时间堆上，到期后删除*/
+   void                 schedule(time_heap& heap);
+
+   size_t               size() const { return m_size.load(std::memory_order_relaxed); }
+
+   /*以 Prometheus 文本格式追加统计*/
+   void                 report(std::string& out) const;
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include "sharded_store.h"
+#include "flat_table.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+sharded_user_store::sharded_user_store(int close_log) :
+   m_close_log(close_log)
+{
+
+}
+
+sharded_user_store::~sharded_user_store()
+{
+   for (shard* s : m_shards)
+   {
+      delete s->store;
+      delete s->pool;
+      delete s;
+   }
+}
+
+bool sharded_user_store::add_shards(const std::string& list, const db_params& params, ring& r)
+{
+   size_t begin = 0;
+   while ( begin < list.size() )
+   {
+      size_t end = list.find(',', begin);
+      if ( end == std::string::npos )
+         end = list.size();
+      std::string addr = list.substr(begin, end - begin);
+      begin = end + 1;
+      if ( addr.empty() )
+         continue;
+
+      size_t colon = addr.rfind(':');
+      std::string host = colon == std::string::npos ? addr : addr.substr(0, colon);
+      int port = colon == std::string::npos ? 3306 : atoi(addr.c_str() + colon + 1);
+      std::string name = host + ":" + std::to_string(port);
+
+      //新旧列表中都有的实例只建立一次连接池
+      int index = -1;
+      for (size_t i = 0; i < m_shards.size(); ++i)
+      {
+         if ( m_shards[i]->name == name )
+            index = i;
+      }
+
+      if ( index < 0 )
+      {
+         shard* s = new shard;
+         s->name = name;
+         s->pool = new connection_pool;
+         s->pool->init(host, params.user, params.passwd, params.db_name, port,
+                       params.max_conn, m_close_log, 0, params.min_conn);
+         s->store = new mysql_user_store(s->pool, m_close_log, NULL, name, params.lookup_window);
+         index = m_shards.size();
+         m_shards.push_back(s);
+      }
+
+      //虚拟节点的位置只由地址决定，列表的顺序不影响归属
+      for (int v = 0; v < VNODES; ++v)
+      {
+         std::string point = name + "#" + std::to_string(v);
+         r.emplace_back(flat_table::hash(point.data(), point.size()), index);
+      }
+   }
+
+   std::sort(r.begin(), r.end());
+   return !r.empty();
+}
+
+bool sharded_user_store::open(const std::string& spec, const db_params& params)
+{
+   size_t slash = spec.find('/');
+   if ( !add_shards(spec.substr(0, slash), params, m_ring) )
+   {
+      LOG_ERROR("no shard in %s", spec.c_str());
+      return false;
+   }
+
+   if ( slash != std::string::npos && !add_shards(spec.substr(slash + 1), params, m_old_ring) )
+   {
+      LOG_ERROR("no old shard in %s", spec.c_str());
+      return false;
+   }
+
+   LOG_INFO("user store sharded across %d instances%s", (int)m_shards.size(),
+            m_old_ring.empty() ? "" : ", resharding");
+   return true;
+}
+
+int sharded_user_store::owner(const ring& r, const std::string& name)
+{
+   uint64_t h = flat_table::hash(name.data(), name.size());
+   auto it = std::lower_bound(r.begin(), r.end(), std::make_pair(h, 0));
+   if ( it == r.end() )
+      it = r.begin();
+   return it->second;
+}
+
+int sharded_user_store::old_owner(const std::string& name, int cur) const
+{
+   if ( m_old_ring.empty() )
+      return -1;
+   int old = owner(m_old_ring, name);
+   return old == cur ? -1 : old;
+}
+
+/*迁移过程中同一个用户可能暂时在两个实例上都有，调用方按用户名去重*/
+int sharded_user_store::load(const user_visitor& visit)
+{
+   int count = 0;
+   for (shard* s : m_shards)
+   {
+      if ( !s->pool->WaitReady() )
+         return -1;
+
+      int n = s->store->load(visit);
+      if ( n < 0 )
+      {
+         LOG_ERROR("load users from shard %s failed", s->name.c_str());
+         return -1;
+      }
+      count += n;
+   }
+   return count;
+}
+
+int sharded_user_store::exists(const std::string& name)
+{
+   int cur = owner(m_ring, name);
+   int ret = m_shards[cur]->store->exists(name);
+   int old = old_owner(name, cur);
+   if ( ret == 0 && old >= 0 )
+      ret = m_shards[old]->store->exists(name);
+   return ret;
+}
+
+int sharded_user_store::lookup(const std::string& name, std::string& passwd)
+{
+   int cur = owner(m_ring, name);
+   int ret = m_shards[cur]->store->lookup(name, passwd);
+   int old = old_owner(name, cur);
+   if ( ret == 0 && old >= 0 )
+      ret = m_shards[old]->store->lookup(name, passwd);
+   return ret;
+}
+
+/*迁移中的用户名在旧的归属中已经存在时按重名处理，迁移先写新的归属，不会两边都漏掉*/
+int sharded_user_store::insert(const std::string& name, const std::string& passwd)
+{
+   int cur = owner(m_ring, name);
+   int old = old_owner(name, cur);
+   if ( old >= 0 )
+   {
+      int ret = m_shards[old]->store->exists(name);
+      if ( ret != 0 )
+         return ret;
+   }
+   return m_shards[cur]->store->insert(name, passwd);
+}
+
+/*每个实例都有唯一索引才算有，同一个用户名只会写到它归属的实例*/
+int sharded_user_store::unique_names()
+{
+   int unique = 1;
+   for (shard* s : m_shards)
+   {
+      int ret = s->store->unique_names();
+      if ( ret < 0 )
+         return -1;
+      if ( ret == 0 )
+      {
+         LOG_WARN("shard %s has no unique index on user.username", s->name.c_str());
+         unique = 0;
+      }
+   }
+   return unique;
+}
+
+/*按归属拆成每个实例一批，各自在一个事务中提交*/
+void sharded_user_store::insert_batch(const user_list& users, std::vector<int>& results)
+{
+   results.assign(users.size(), -1);
+
+   std::vector<user_list> batches(m_shards.size());
+   std::vector<std::vector<size_t>> indexes(m_shards.size());
+   for (size_t i = 0; i < users.size(); ++i)
+   {
+      int cur = owner(m_ring, users[i].first);
+      int old = old_owner(users[i].first, cur);
+      if ( old >= 0 )
+      {
+         int ret = m_shards[old]->store->exists(users[i].first);
+         if ( ret != 0 )
+         {
+            results[i] = ret;
+            continue;
+         }
+      }
+      batches[cur].push_back(users[i]);
+      indexes[cur].push_back(i);
+   }
+
+   std::vector<int> shard_results;
+   for (size_t s = 0; s < m_shards.size(); ++s)
+   {
+      if ( batches[s].empty() )
+         continue;
+
+      m_shards[s]->store->insert_batch(batches[s], shard_results);
+      for (size_t j = 0; j < indexes[s].size(); ++j)
+      {
+         results[indexes[s][j]] = shard_results[j];
+      }
+   }
+}
+
+/*
+   逐个实例按 id 顺序扫描，不属于这个实例的用户先写入当前的归属再删除，
+   中途退出后重新执行时，目标实例上已有且密码相同的用户直接删除原来的一份，
+   密码不同的是真正的重名，保留两份并记录日志，需要人工处理
+*/
+long sharded_user_store::reshard(int batch, int pause_ms, const progress& report)
+{
+   struct row
+   {
+      uint64_t       id;
+      std::string    name;
+      std::string    passwd;
+   };
+
+   long moved = 0;
+   for (size_t i = 0; i < m_shards.size(); ++i)
+   {
+      shard* src = m_shards[i];
+      uint64_t since = 0;
+      long checked = 0, shard_moved = 0;
+
+      while ( true )
+      {
+         std::vector<row> rows;
+         int n = src->store->scan(since, batch, [&rows](uint64_t id, const std::string& name,
+                                                         const std::string& passwd)
+         {
+            rows.push_back({ id, name, passwd });
+         });
+         if ( n < 0 )
+            return -1;
+         if ( rows.empty() )
+            break;
+
+         for (const row& r : rows)
+         {
+            since = r.id;
+            ++checked;
+
+            int dst = owner(m_ring, r.name);
+            if ( dst == (int)i )
+               continue;
+
+            int ret = m_shards[dst]->store->insert(r.name, r.passwd);
+            if ( ret < 0 )
+               return -1;
+
+            if ( ret == 1 )
+            {
+               std::string passwd;
+               if ( m_shards[dst]->store->lookup(r.name, passwd) < 0 )
+                  return -1;
+               if ( passwd != r.passwd )
+               {
+                  LOG_ERROR("user %s exists on both %s and %s, skipped", r.name.c_str(),
+                            src->name.c_str(), m_shards[dst]->name.c_str());
+                  continue;
+               }
+            }
+
+            if ( src->store->remove(r.id, r.name) < 0 )
+               return -1;
+            ++shard_moved;
+         }
+
+         if ( report )
+            report(src->name, checked, shard_moved);
+         if ( pause_ms > 0 )
+            usleep(pause_ms * 1000);
+      }
+
+      moved += shard_moved;
+   }
+   return moved;
+}
@@ -0,0 +1,82 @@
+/*
+   按用户名分片的 MySQL 用户存储
+   1、配置为 shard:地址列表[/旧地址列表]，地址列表是逗号分隔的 主机:端口，
+      每个实例有自己的连接池和 mysql_user_store，实例上的 user 表结构和单实例时相同
+   2、用户名按一致性哈希映射到实例：每个实例在环上有 VNODES 个虚拟节点，位置由地址决定，
+      增加一个实例只有大约 1/N 的用户需要迁移，其它用户的归属不变
+   3、重新分片分三步：
+      先用 新地址列表/旧地址列表 重启服务，写入按新的归属，读取在新的归属找不到时再查旧的归属，
+      注册时旧的归属中已有同名用户也按重名处理；
+      再运行 tools/reshard 迁移（先写入新的归属再从原来的实例删除，服务不停）；
+      迁移完成后去掉旧地址列表重启
+   4、各实例的自增 id 互不相关，不支持增量加载，启用快照时退回全表加载
+*/
+
+#ifndef SHARDED_STORE_H
+#define SHARDED_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+
+#include "mysql_store.h"
+
+class sharded_user_store : public user_store
+{
+public:
+   static const int VNODES = 160;            //每个实例在哈希环上的虚拟节点数
+
+   /*迁移进度：实例地址、已检查的用户数、已迁移的用户数*/
+   typedef std::function<void(const std::string&, long, long)> progress;
+
+private:
+   struct shard
+   {
+      std::string          name;             //主机:端口
+      connection_pool*     pool;
+      mysql_user_store*    store;
+   };
+
+   /*哈希环，按位置排序的 (位置, 实例下标)*/
+   typedef std::vector<std::pair<uint64_t, int>> ring;
+
+   std::vector<shard*>  m_shards;            //新旧地址列表中的全部实例
+   ring                 m_ring;              //当前的归属
+   ring                 m_old_ring;          //重新分片之前的归属，不在迁移中时为空
+   int                  m_close_log;
+
+private:
+   /*解析地址列表，加入 m_shards 并在 r 上放置虚拟节点*/
+   bool                 add_shards(const std::string& list, const db_params& params, ring& r);
+
+   static int           owner(const ring& r, const std::string& name);
+
+   /*name 在迁移前的归属，和当前的归属相同或者不在迁移中时返回 -1*/
+   int                  old_owner(const std::string& name, int cur) const;
+
+public:
+   explicit sharded_user_store(int close_log);
+   ~sharded_user_store();
+
+   /*spec 是去掉 shard: 前缀的配置，连接池的初始连接在后台建立*/
+   bool                 open(const std::string& spec, const db_params& params);
+
+   const char*          name() const override { return "shard"; }
+
+   int                  load(const user_visitor& visit) override;
+   int                  exists(const std::string& name) override;
+   int                  lookup(const std::string& name, std::string& passwd) override;
+   int                  insert(const std::string& name, const std::string& passwd) override;
+   void                 insert_batch(const user_list& users, std::vector<int>& results) override;
+   int                  unique_names() override;
+
+   /*
+      把每个实例上不属于它的用户迁移到当前的归属，每次读取 batch 个用户，批之间暂停 pause_ms 毫秒，
+      可以重复执行，返回迁移的用户数，出错返回 -1
+   */
+   long                 reshard(int batch, int pause_ms, const progress& report);
+};
+
+#endif
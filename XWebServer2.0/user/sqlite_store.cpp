@@ -0,0 +1,216 @@
+#include "sqlite_store.h"
+
+#ifdef USE_SQLITE
+
+#include "../log/log.h"
+
+static const char* SQLITE_STMT_SQL[] =
+{
+   "SELECT passwd FROM user WHERE username=?",
+   "SELECT 1 FROM user WHERE username=? LIMIT 1",
+   "INSERT INTO user(username, passwd) VALUES(?, ?)"
+};
+
+sqlite_user_store::sqlite_user_store(int close_log) : m_db(NULL), m_close_log(close_log)
+{
+   for (int i = 0; i < SQLITE_STMT_NUM; ++i)
+   {
+      m_stmts[i] = NULL;
+   }
+}
+
+sqlite_user_store::~sqlite_user_store()
+{
+   for (int i = 0; i < SQLITE_STMT_NUM; ++i)
+   {
+      sqlite3_finalize(m_stmts[i]);
+   }
+   sqlite3_close(m_db);
+}
+
+bool sqlite_user_store::open(const std::string& path)
+{
+   if ( sqlite3_open_v2(path.c_str(), &m_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                        SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK )
+   {
+      LOG_ERROR("open sqlite %s error:%s", path.c_str(), sqlite3_errmsg(m_db));
+      return false;
+   }
+
+   /*WAL 模式下写入不阻塞读取，NORMAL 同步级别在 WAL 下仍然保证数据库不会损坏*/
+   const char* setup =
+      "PRAGMA journal_mode=WAL;"
+      "PRAGMA synchronous=NORMAL;"
+      "CREATE TABLE IF NOT EXISTS user(username TEXT PRIMARY KEY, passwd TEXT NOT NULL);";
+   char* err = NULL;
+   if ( sqlite3_exec(m_db, setup, NULL, NULL, &err) != SQLITE_OK )
+   {
+      LOG_ERROR("init sqlite error:%s", err);
+      sqlite3_free(err);
+      return false;
+   }
+
+   for (int i = 0; i < SQLITE_STMT_NUM; ++i)
+   {
+      if ( sqlite3_prepare_v2(m_db, SQLITE_STMT_SQL[i], -1, &m_stmts[i], NULL) != SQLITE_OK )
+      {
+         LOG_ERROR("prepare error:%s", sqlite3_errmsg(m_db));
+         return false;
+      }
+   }
+   return true;
+}
+
+int sqlite_user_store::load(const user_visitor& visit)
+{
+   std::lock_guard<std::mutex> lk(m_mutex);
+
+   sqlite3_stmt* stmt = NULL;
+   if ( sqlite3_prepare_v2(m_db, "SELECT username,passwd FROM user", -1, &stmt, NULL) != SQLITE_OK )
+   {
+      LOG_ERROR("SELECT error:%s", sqlite3_errmsg(m_db));
+      return -1;
+   }
+
+   int count = 0, rc;
+   while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW )
+   {
+      visit(std::string((const char*)sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0)),
+            std::string((const char*)sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1)));
+      ++count;
+   }
+   sqlite3_finalize(stmt);
+   return rc == SQLITE_DONE ? count : -1;
+}
+
+int sqlite_user_store::load_since(uint64_t since, const user_visitor& visit, uint64_t& watermark)
+{
+   std::lock_guard<std::mutex> lk(m_mutex);
+
+   sqlite3_stmt* stmt = NULL;
+   if ( sqlite3_prepare_v2(m_db, "SELECT rowid,username,passwd FROM user WHERE rowid>? ORDER BY rowid",
+                           -1, &stmt, NULL) != SQLITE_OK )
+   {
+      LOG_ERROR("SELECT error:%s", sqlite3_errmsg(m_db));
+      return -1;
+   }
+   sqlite3_bind_int64(stmt, 1, (sqlite3_int64)since);
+
+   int count = 0, rc;
+   uint64_t last = since;
+   while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW )
+   {
+      last = sqlite3_column_int64(stmt, 0);
+      visit(std::string((const char*)sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1)),
+            std::string((const char*)sqlite3_column_text(stmt, 2), sqlite3_column_bytes(stmt, 2)));
+      ++count;
+   }
+   sqlite3_finalize(stmt);
+   if ( rc != SQLITE_DONE )
+      return -1;
+
+   watermark = last;
+   return count;
+}
+
+int sqlite_user_store::exists(const std::string& name)
+{
+   std::lock_guard<std::mutex> lk(m_mutex);
+
+   sqlite3_stmt* stmt = m_stmts[SQLITE_STMT_EXISTS];
+   sqlite3_bind_text(stmt, 1, name.data(), name.size(), SQLITE_STATIC);
+   int rc = sqlite3_step(stmt);
+   sqlite3_reset(stmt);
+   sqlite3_clear_bindings(stmt);
+
+   if ( rc == SQLITE_ROW )
+      return 1;
+   return rc == SQLITE_DONE ? 0 : -1;
+}
+
+int sqlite_user_store::lookup(const std::string& name, std::string& passwd)
+{
+   std::lock_guard<std::mutex> lk(m_mutex);
+
+   sqlite3_stmt* stmt = m_stmts[SQLITE_STMT_LOOKUP];
+   sqlite3_bind_text(stmt, 1, name.data(), name.size(), SQLITE_STATIC);
+   int rc = sqlite3_step(stmt);
+   int ret = -1;
+   if ( rc == SQLITE_ROW )
+   {
+      passwd.assign((const char*)sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0));
+      ret = 1;
+   }
+   else if ( rc == SQLITE_DONE )
+   {
+      ret = 0;
+   }
+   sqlite3_reset(stmt);
+   sqlite3_clear_bindings(stmt);
+   return ret;
+}
+
+int sqlite_user_store::insert_locked(const std::string& name, const std::string& passwd)
+{
+   sqlite3_stmt* stmt = m_stmts[SQLITE_STMT_INSERT];
+   sqlite3_bind_text(stmt, 1, name.data(), name.size(), SQLITE_STATIC);
+   sqlite3_bind_text(stmt, 2, passwd.data(), passwd.size(), SQLITE_STATIC);
+   int rc = sqlite3_step(stmt);
+   sqlite3_reset(stmt);
+   sqlite3_clear_bindings(stmt);
+
+   if ( rc == SQLITE_DONE )
+      return 0;
+   if ( rc == SQLITE_CONSTRAINT )
+      return 1;
+   LOG_ERROR("INSERT error:%s", sqlite3_errmsg(m_db));
+   return -1;
+}
+
+int sqlite_user_store::insert(const std::string& name, const std::string& passwd)
+{
+   std::lock_guard<std::mutex> lk(m_mutex);
+   return insert_locked(name, passwd);
+}
+
+/*和 MySQL 一样，重复以外的错误整批回滚*/
+void sqlite_user_store::insert_batch(const user_list& users, std::vector<int>& results)
+{
+   std::lock_guard<std::mutex> lk(m_mutex);
+   results.assign(users.size(), -1);
+
+   if ( sqlite3_exec(m_db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK )
+   {
+      LOG_ERROR("BEGIN error:%s", sqlite3_errmsg(m_db));
+      return;
+   }
+
+   bool failed = false;
+   for (size_t i = 0; i < users.size(); ++i)
+   {
+      results[i] = insert_locked(users[i].first, users[i].second);
+      if ( results[i] < 0 )
+      {
+         failed = true;
+         break;
+      }
+   }
+
+   if ( !failed && sqlite3_exec(m_db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK )
+   {
+      LOG_ERROR("COMMIT error:%s", sqlite3_errmsg(m_db));
+      failed = true;
+   }
+
+   if ( failed )
+   {
+      sqlite3_exec(m_db, "ROLLBACK", NULL, NULL, NULL);
+      for (int& ret : results)
+      {
+         if ( ret != 1 )
+            ret = -1;
+      }
+   }
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+   SQLite 用户存储，编译时需要定义 USE_SQLITE（make SQLITE=0 可以去掉）
+   1、整个进程共用一个数据库连接，预处理语句只准备一次，访问时加锁
+   2、使用 WAL 日志，批量写入在一个事务中提交
+   表不存在时自动创建：user(username TEXT PRIMARY KEY, passwd TEXT NOT NULL)
+*/
+
+#ifndef SQLITE_STORE_H
+#define SQLITE_STORE_H
+
+#ifdef USE_SQLITE
+
+#include <sqlite3.h>
+#include <mutex>
+
+#include "user_store.h"
+
+class sqlite_user_store : public user_store
+{
+private:
+   enum STMT_ID
+   {
+      SQLITE_STMT_LOOKUP = 0,
+      SQLITE_STMT_EXISTS,
+      SQLITE_STMT_INSERT,
+      SQLITE_STMT_NUM
+   };
+
+   sqlite3*             m_db;
+   sqlite3_stmt*        m_stmts[SQLITE_STMT_NUM];
+   std::mutex           m_mutex;
+   int                  m_close_log;
+
+private:
+   /*调用时持有 m_mutex*/
+   int                  insert_locked(const std::string& name, const std::string& passwd);
+
+public:
+   sqlite_user_store(int close_log);
+   ~sqlite_user_store();
+
+   /*打开（不存在时创建）数据库文件，失败返回 false*/
+   bool                 open(const std::string& path);
+
+   const char*          name() const override { return "sqlite"; }
+
+   int                  load(const user_visitor& visit) override;
+   int                  load_since(uint64_t since, const user_visitor& visit, uint64_t& watermark) override;
+   int                  exists(const std::string& name) override;
+   int                  lookup(const std::string& name, std::string& passwd) override;
+   int                  insert(const std::string& name, const std::string& passwd) override;
+   void                 insert_batch(const user_list& users, std::vector<int>& results) override;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,316 @@
+#include "user_cache.h"
+
+#include "../log/log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <chrono>
+
+user_cache::user_cache() : 
+   m_size(0), 
+   m_store(NULL), 
+   m_close_log(0), 
+   m_bloom_negatives(0), 
+   m_bloom_true_positives(0), 
+   m_bloom_false_positives(0),
+   m_bloom_trusted(false),
+   m_snapshot_size(0),
+   m_snapshot_stop(false),
+   m_snapshot_saves(0),
+   m_snapshot_failures(0),
+   m_snapshot_watermark(0)
+{
+   for (int i = 0; i < SHARD_NUM; ++i)
+   {
+      m_shards[i].hits = 0;
+      m_shards[i].misses = 0;
+   }
+}
+
+user_cache::~user_cache()
+{
+   {
+      std::lock_guard<std::mutex> lk(m_snapshot_mutex);
+      m_snapshot_stop = true;
+   }
+   m_snapshot_cond.notify_all();
+   if ( m_snapshot_thread.joinable() )
+      m_snapshot_thread.join();
+}
+
+user_cache* user_cache::get_instance()
+{
+   static user_cache cache;
+   return &cache;
+}
+
+int user_cache::load(user_store* store, int close_log, const std::string& snapshot,
+                     const std::string& store_spec)
+{
+   m_store = store;
+   m_close_log = close_log;
+   m_snapshot_path = snapshot;
+   m_store_spec = store_spec;
+
+   //没有唯一约束时数据库不会报重名，一定不存在的判断也要到数据库确认
+   int unique = store->unique_names();
+   if ( unique == 0 )
+   {
+      LOG_ERROR("%s", "user.username has no unique index, every register checks the database first");
+   }
+   else if ( unique < 0 )
+   {
+      LOG_ERROR("%s", "check unique index on user.username failed, every register checks the database first");
+   }
+
+   //加载完成之前布隆过滤器中的用户名不全，不能据此跳过重名确认
+   m_bloom_trusted = false;
+   if ( !load_users(store, snapshot, store_spec) )
+      return -1;
+   m_bloom_trusted = unique == 1;
+   return (int)size();
+}
+
+/*失败后可以再次调用，已经放进缓存的用户不会重复计数*/
+bool user_cache::load_users(user_store* store, const std::string& snapshot, const std::string& store_spec)
+{
+   auto visit = [this](const std::string& name, const std::string& passwd)
+   {
+      insert(name, passwd);
+   };
+
+   if ( snapshot.empty() )
+      return store->load(visit) >= 0;
+
+   /*快照中的用户不进分片，查找时分片没有命中再查映射的快照*/
+   uint64_t since = 0;
+   if ( m_snapshot.open(snapshot, store_spec) )
+   {
+      since = m_snapshot.watermark();
+      m_snapshot_watermark = since;
+      LOG_INFO("map snapshot %s: %lu users, watermark %llu", snapshot.c_str(),
+               (unsigned long)m_snapshot.size(), (unsigned long long)since);
+   }
+   else
+   {
+      LOG_INFO("snapshot %s missing or invalid, load all users", snapshot.c_str());
+   }
+
+   uint64_t watermark = since;
+   if ( store->load_since(since, visit, watermark) >= 0 )
+   {
+      m_snapshot_size = m_snapshot.size();
+      return true;
+   }
+
+   /*后端不支持增量加载，快照也就不能用，退回全表加载*/
+   LOG_ERROR("%s store can not load incrementally, snapshot disabled", store->name());
+   m_snapshot.close();
+   m_snapshot_path.clear();
+   return store->load(visit) >= 0;
+}
+
+bool user_cache::save_snapshot()
+{
+   if ( m_snapshot_path.empty() )
+      return false;
+
+   /*以磁盘上最新的快照为基础，不碰正在使用的映射*/
+   user_snapshot base;
+   bool has_base = base.open(m_snapshot_path, m_store_spec);
+   uint64_t since = has_base ? base.watermark() : 0;
+
+   user_store::user_list users;
+   auto collect = [&users](const std::string& name, const std::string& passwd)
+   {
+      users.emplace_back(name, passwd);
+   };
+
+   uint64_t watermark = since;
+   int ret = m_store->load_since(since, collect, watermark);
+   if ( ret < 0 )
+   {
+      m_snapshot_failures.fetch_add(1, std::memory_order_relaxed);
+      return false;
+   }
+
+   //没有新用户，不用重写
+   if ( has_base && ret == 0 )
+      return true;
+
+   base.visit(collect);
+   base.close();
+
+   if ( !user_snapshot::write(m_snapshot_path, m_store_spec, watermark, users) )
+   {
+      LOG_ERROR("write snapshot %s failed", m_snapshot_path.c_str());
+      m_snapshot_failures.fetch_add(1, std::memory_order_relaxed);
+      return false;
+   }
+
+   LOG_INFO("write snapshot %s: %lu users, watermark %llu", m_snapshot_path.c_str(),
+            (unsigned long)users.size(), (unsigned long long)watermark);
+   m_snapshot_saves.fetch_add(1, std::memory_order_relaxed);
+   m_snapshot_watermark = watermark;
+   return true;
+}
+
+void user_cache::start_snapshot(int interval)
+{
+   if ( interval <= 0 || m_snapshot_path.empty() || m_snapshot_thread.joinable() )
+      return;
+   m_snapshot_thread = std::thread(&user_cache::snapshot_loop, this, interval);
+}
+
+void user_cache::snapshot_loop(int interval)
+{
+   if ( !m_snapshot.is_open() )
+      save_snapshot();
+
+   std::unique_lock<std::mutex> lk(m_snapshot_mutex);
+   while ( !m_snapshot_stop )
+   {
+      m_snapshot_cond.wait_for(lk, std::chrono::seconds(interval));
+      if ( m_snapshot_stop )
+         break;
+
+      lk.unlock();
+      save_snapshot();
+      lk.lock();
+   }
+}
+
+bool user_cache::find(const std::string& name, std::string& passwd)
+{
+   uint64_t h = flat_table::hash(name.data(), name.size());
+   shard& s = get_shard(h);
+   {
+      std::shared_lock<std::shared_mutex> lk(s.mutex);
+      if ( s.users.find(name.data(), name.size(), h, passwd) )
+      {
+         lk.unlock();
+         s.hits.fetch_add(1, std::memory_order_relaxed);
+         return true;
+      }
+   }
+
+   if ( m_snapshot.find(name.data(), name.size(), h, &passwd) )
+   {
+      s.hits.fetch_add(1, std::memory_order_relaxed);
+      return true;
+   }
+   s.misses.fetch_add(1, std::memory_order_relaxed);
+   return false;
+}
+
+bool user_cache::insert(const std::string& name, const std::string& passwd)
+{
+   uint64_t h = flat_table::hash(name.data(), name.size());
+   if ( m_snapshot.find(name.data(), name.size(), h, NULL) )
+      return false;
+
+   shard& s = get_shard(h);
+   std::unique_lock<std::shared_mutex> lk(s.mutex);
+   if ( !s.users.insert(name.data(), name.size(), h, passwd.data(), passwd.size()) )
+      return false;
+   lk.unlock();
+
+   m_names.add(h);
+   m_size.fetch_add(1, std::memory_order_relaxed);
+   return true;
+}
+
+void user_cache::erase(const std::string& name)
+{
+   uint64_t h = flat_table::hash(name.data(), name.size());
+   shard& s = get_shard(h);
+   std::unique_lock<std::shared_mutex> lk(s.mutex);
+   if ( s.users.erase(name.data(), name.size(), h) )
+      m_size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool user_cache::may_exist(const std::string& name)
+{
+   //快照中的用户没有放进布隆过滤器，直接查快照的索引
+   if ( !m_bloom_trusted.load(std::memory_order_relaxed) )
+      return true;
+
+   uint64_t h = flat_table::hash(name.data(), name.size());
+   if ( m_names.may_contain(h) || m_snapshot.find(name.data(), name.size(), h, NULL) )
+      return true;
+   m_bloom_negatives.fetch_add(1, std::memory_order_relaxed);
+   return false;
+}
+
+int user_cache::exists_in_db(const std::string& name)
+{
+   int exists = m_store->exists(name);
+   if ( !m_bloom_trusted.load(std::memory_order_relaxed) )
+      return exists;
+   if ( exists == 1 )
+      m_bloom_true_positives.fetch_add(1, std::memory_order_relaxed);
+   else if ( exists == 0 )
+      m_bloom_false_positives.fetch_add(1, std::memory_order_relaxed);
+   return exists;
+}
+
+int user_cache::lookup_db(const std::string& name, std::string& passwd)
+{
+   int ret = m_store->lookup(name, passwd);
+   if ( ret == 1 )
+      insert(name, passwd);
+   return ret;
+}
+
+int user_cache::insert_db(const std::string& name, const std::string& passwd)
+{
+   return m_store->insert(name, passwd);
+}
+
+void user_cache::report(std::string& out) const
+{
+   unsigned long hits = 0, misses = 0;
+   for (int i = 0; i < SHARD_NUM; ++i)
+   {
+      hits += m_shards[i].hits.load(std::memory_order_relaxed);
+      misses += m_shards[i].misses.load(std::memory_order_relaxed);
+   }
+
+   /*实际误判率 = 误判次数 / 所有数据库中不存在的用户名的判断次数*/
+   unsigned long negatives = m_bloom_negatives.load(std::memory_order_relaxed);
+   unsigned long tp = m_bloom_true_positives.load(std::memory_order_relaxed);
+   unsigned long fp = m_bloom_false_positives.load(std::memory_order_relaxed);
+
+   char buf[768];
+   int len = snprintf(buf, sizeof(buf),
+                      "user_cache_size %lu\n"
+                      "user_cache_hits %lu\n"
+                      "user_cache_misses %lu\n"
+                      "user_cache_hit_ratio %.4f\n"
+                      "user_bloom_stages %d\n"
+                      "user_bloom_bits %lu\n"
+                      "user_bloom_negatives %lu\n"
+                      "user_bloom_true_positives %lu\n"
+                      "user_bloom_false_positives %lu\n"
+                      "user_bloom_false_positive_rate %.6f\n"
+                      "user_bloom_estimated_false_positive_rate %.6f\n"
+                      "user_bloom_trusted %d\n",
+                      (unsigned long)size(), hits, misses,
+                      (hits + misses) ? (double)hits / (hits + misses) : 0.0,
+                      m_names.stages(), (unsigned long)m_names.bits(), negatives, tp, fp,
+                      (fp + negatives) ? (double)fp / (fp + negatives) : 0.0,
+                      m_names.estimated_fp_rate(), m_bloom_trusted.load(std::memory_order_relaxed) ? 1 : 0);
+   out.append(buf, len);
+
+   len = snprintf(buf, sizeof(buf),
+                  "user_snapshot_users %lu\n"
+                  "user_snapshot_watermark %llu\n"
+                  "user_snapshot_saves %lu\n"
+                  "user_snapshot_failures %lu\n",
+                  (unsigned long)m_snapshot_size.load(std::memory_order_relaxed),
+                  (unsigned long long)m_snapshot_watermark.load(std::memory_order_relaxed),
+                  m_snapshot_saves.load(std::memory_order_relaxed),
+                  m_snapshot_failures.load(std::memory_order_relaxed));
+   out.append(buf, len);
+}
@@ -0,0 +1,143 @@
+/*
+   用户凭据缓存（全局只允许一个实例）
+   1、启动时从存储后端加载一次全部用户，之后注册成功的用户增量写入，请求处理时不再查询整张表
+   2、按用户名哈希分成若干分片，每个分片一把读写锁，登录校验只加读锁，不同分片之间互不影响，
+      分片内部使用开放寻址的 flat_table，哈希值只计算一次，分片和表内定位共用
+   3、另外维护一个用户名的布隆过滤器，注册时一定不存在的用户名直接写数据库，
+      只有可能重名的才到数据库确认，数据库是唯一的权威数据；
+      直接写库靠后端的唯一约束兜底，后端的用户名没有唯一约束时不走这条路
+   4、统计缓存大小、命中率和布隆过滤器的误判率，通过 /metrics 输出
+   5、可以定期把存储后端中的用户写成快照文件，重启时直接 mmap 快照作为只读的底层，
+      只从后端加载水位之后的新用户，启动时间不再随用户表变大而变长
+*/
+
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <string>
+#include <atomic>
+#include <shared_mutex>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "user_store.h"
+#include "flat_table.h"
+#include "bloom_filter.h"
+#include "user_snapshot.h"
+
+class user_cache
+{
+public:
+   static const int SHARD_NUM = 16;
+
+private:
+   /*每个分片独占缓存行，避免不同分片的锁互相干扰*/
+   struct alignas(64) shard
+   {
+      mutable std::shared_mutex  mutex;
+      flat_table                 users;         //用户名 -> 密码
+      std::atomic<unsigned long> hits;
+      std::atomic<unsigned long> misses;
+   };
+
+   shard                m_shards[SHARD_NUM];
+   std::atomic<size_t>  m_size;
+   user_store*          m_store;
+   int                  m_close_log;
+
+   /*已经存在的用户名，只增不减*/
+   bloom_filter         m_names;
+   std::atomic<unsigned long>
+                        m_bloom_negatives;      //判断为一定不存在
+   std::atomic<unsigned long>
+                        m_bloom_true_positives; //判断为可能存在，数据库中确实存在
+   std::atomic<unsigned long>
+                        m_bloom_false_positives;//判断为可能存在，数据库中不存在
+   std::atomic<bool>    m_bloom_trusted;        //一定不存在的判断可以跳过数据库确认
+
+   /*启动时映射的快照，分片中没有时再查它，加载完成后只读*/
+   user_snapshot        m_snapshot;
+   std::atomic<size_t>  m_snapshot_size;
+   std::string          m_snapshot_path;
+   std::string          m_store_spec;
+
+   /*定期写快照的线程*/
+   std::thread          m_snapshot_thread;
+   std::mutex           m_snapshot_mutex;
+   std::condition_variable
+                        m_snapshot_cond;
+   bool                 m_snapshot_stop;
+   std::atomic<unsigned long>
+                        m_snapshot_saves;
+   std::atomic<unsigned long>
+                        m_snapshot_failures;
+   std::atomic<uint64_t>
+                        m_snapshot_watermark;   //最近一次写出的快照的水位
+
+private:
+   user_cache();
+   ~user_cache();
+
+   void                 snapshot_loop(int interval);
+
+   /*load 的加载部分，失败返回 false*/
+   bool                 load_users(user_store* store, const std::string& snapshot,
+                                   const std::string& store_spec);
+
+   /*用哈希值的高位选择分片，低位留给 flat_table*/
+   shard&               get_shard(uint64_t h) { return m_shards[(h >> 56) % SHARD_NUM]; }
+
+public:
+   static user_cache*   get_instance();
+
+   /*
+      启动时从存储后端加载全部用户，返回缓存中的用户数，失败返回 -1，之后的读写都使用这个后端，
+      失败后可以重新调用，成功之前注册不走布隆过滤器的快速路径
+      snapshot 不为空时先映射快照文件，快照有效就只加载水位之后的用户，
+      store_spec 是后端的配置，和快照中记录的不同时不使用快照
+   */
+   int                  load(user_store* store, int close_log, const std::string& snapshot = "",
+                             const std::string& store_spec = "");
+
+   /*以上一次写出的快照为基础，加上后端中水位之后的用户，写出新的快照，失败返回 false*/
+   bool                 save_snapshot();
+
+   /*每隔 interval 秒写一次快照，启动时没有可用的快照则立即写一次*/
+   void                 start_snapshot(int interval);
+
+   user_store*          store() const { return m_store; }
+
+   /*查找用户密码，找不到返回 false*/
+   bool                 find(const std::string& name, std::string& passwd);
+
+   /*用户名已存在时返回 false，注册时先占住用户名再写数据库*/
+   bool                 insert(const std::string& name, const std::string& passwd);
+
+   /*数据库写入失败时撤销 insert*/
+   void                 erase(const std::string& name);
+
+   /*布隆过滤器判断用户名是否可能已经存在，后端没有唯一约束时总是返回 true*/
+   bool                 may_exist(const std::string& name);
+
+   /*
+      以下函数访问存储后端
+      exists_in_db：确认用户名是否存在，返回 1 存在，0 不存在，-1 出错，同时统计布隆过滤器的误判
+      lookup_db：缓存中没有时到后端查密码，找到后放进缓存，返回值同上
+      insert_db：写入新用户，返回 0 成功，1 用户名重复，-1 出错
+   */
+   int                  exists_in_db(const std::string& name);
+   int                  lookup_db(const std::string& name, std::string& passwd);
+   int                  insert_db(const std::string& name, const std::string& passwd);
+
+   size_t               size() const
+                        {
+                           return m_size.load(std::memory_order_relaxed) +
+                                  m_snapshot_size.load(std::memory_order_relaxed);
+                        }
+
+   /*按 Prometheus 文本格式追加统计信息*/
+   void                 report(std::string& out) const;
+};
+
+#endif
@@ -0,0 +1,259 @@
+#include "user_snapshot.h"
+#include "flat_table.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char     SNAPSHOT_MAGIC[8] = { 'X', 'U', 'S', 'N', 'A', 'P', '\0', '\1' };
+static const uint64_t SNAPSHOT_SEED     = 0x5851f42d4c957f2dULL;
+static const uint64_t OFFSET_MASK       = (1ULL << 48) - 1;
+
+user_snapshot::user_snapshot() :
+   m_map(NULL),
+   m_len(0),
+   m_hdr(NULL),
+   m_index(NULL),
+   m_data(NULL)
+{
+
+}
+
+user_snapshot::~user_snapshot()
+{
+   close();
+}
+
+void user_snapshot::close()
+{
+   if ( m_map )
+      munmap(m_map, m_len);
+   m_map = NULL;
+   m_len = 0;
+   m_hdr = NULL;
+   m_index = NULL;
+   m_data = NULL;
+}
+
+uint64_t user_snapshot::checksum(const char* data, size_t len, uint64_t h)
+{
+   const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+   size_t i = 0;
+   for (; i + 8 <= len; i += 8)
+   {
+      uint64_t w;
+      memcpy(&w, data + i, 8);
+      h = (h ^ w) * prime;
+      h ^= h >> 32;
+   }
+   for (; i < len; ++i)
+   {
+      h = (h ^ (unsigned char)data[i]) * prime;
+      h ^= h >> 32;
+   }
+   return h;
+}
+
+bool user_snapshot::open(const std::string& path, const std::string& store)
+{
+   close();
+
+   int fd = ::open(path.c_str(), O_RDONLY);
+   if ( fd < 0 )
+      return false;
+
+   struct stat st;
+   if ( fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header) )
+   {
+      ::close(fd);
+      return false;
+   }
+
+   void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   ::close(fd);
+   if ( map == MAP_FAILED )
+      return false;
+
+   m_map = (char*)map;
+   m_len = st.st_size;
+   const header* hdr = (const header*)m_map;
+
+   /*先检查各部分的大小能对上，再算校验和*/
+   size_t body = m_len - sizeof(header);
+   bool ok = memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+             hdr->version == VERSION &&
+             hdr->index_cap != 0 && (hdr->index_cap & (hdr->index_cap - 1)) == 0 &&
+             hdr->index_cap <= body / sizeof(uint64_t) &&
+             hdr->data_size == body - hdr->index_cap * sizeof(uint64_t) &&
+             strncmp(hdr->store, store.c_str(), STORE_LEN - 1) == 0;
+
+   if ( ok )
+   {
+      header copy = *hdr;
+      copy.checksum = 0;
+      uint64_t sum = checksum((const char*)&copy, sizeof(copy), SNAPSHOT_SEED);
+      ok = checksum(m_map + sizeof(header), body, sum) == hdr->checksum;
+   }
+
+   if ( !ok )
+   {
+      close();
+      return false;
+   }
+
+   m_hdr = hdr;
+   m_index = (const uint64_t*)(m_map + sizeof(header));
+   m_data = m_map + sizeof(header) + hdr->index_cap * sizeof(uint64_t);
+   return true;
+}
+
+const char* user_snapshot::record(uint64_t entry) const
+{
+   uint64_t off = (entry & OFFSET_MASK) - 1;
+   if ( off + 4 > m_hdr->data_size )
+      return NULL;
+
+   uint16_t name_len, passwd_len;
+   memcpy(&name_len, m_data + off, 2);
+   memcpy(&passwd_len, m_data + off + 2, 2);
+   if ( off + 4 + name_len + passwd_len > m_hdr->data_size )
+      return NULL;
+   return m_data + off;
+}
+
+bool user_snapshot::find(const char* name, size_t len, uint64_t h, std::string* passwd) const
+{
+   if ( !m_hdr )
+      return false;
+
+   uint64_t mask = m_hdr->index_cap - 1;
+   uint64_t tag = h >> 48;
+   uint64_t i = h & mask;
+   for (uint64_t n = 0; n <= mask; ++n, i = (i + 1) & mask)
+   {
+      uint64_t entry = m_index[i];
+      if ( entry == 0 )
+         return false;
+      if ( (entry >> 48) != tag )
+         continue;
+
+      const char* r = record(entry);
+      if ( r == NULL )
+         return false;
+
+      uint16_t name_len, passwd_len;
+      memcpy(&name_len, r, 2);
+      memcpy(&passwd_len, r + 2, 2);
+      if ( name_len == len && memcmp(r + 4, name, len) == 0 )
+      {
+         if ( passwd )
+            passwd->assign(r + 4 + name_len, passwd_len);
+         return true;
+      }
+   }
+   return false;
+}
+
+void user_snapshot::visit(const user_store::user_visitor& visit) const
+{
+   if ( !m_hdr )
+      return;
+
+   uint64_t off = 0;
+   while ( off + 4 <= m_hdr->data_size )
+   {
+      const char* r = record(off + 1);
+      if ( r == NULL )
+         break;
+
+      uint16_t name_len, passwd_len;
+      memcpy(&name_len, r, 2);
+      memcpy(&passwd_len, r + 2, 2);
+      visit(std::string(r + 4, name_len), std::string(r + 4 + name_len, passwd_len));
+      off += 4 + name_len + passwd_len;
+   }
+}
+
+bool user_snapshot::write(const std::string& path, const std::string& store, uint64_t watermark,
+                          const user_store::user_list& users)
+{
+   /*索引的装载率不超过一半，探测序列很短*/
+   uint64_t cap = 16;
+   while ( cap < users.size() * 2 )
+      cap <<= 1;
+
+   uint64_t data_size = 0;
+   for (auto& u : users)
+   {
+      if ( u.first.size() > 0xffff || u.second.size() > 0xffff )
+         return false;
+      data_size += 4 + u.first.size() + u.second.size();
+   }
+
+   std::string buf(sizeof(header) + cap * sizeof(uint64_t) + data_size, '\0');
+   header* hdr = (header*)&buf[0];
+   memcpy(hdr->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+   hdr->version = VERSION;
+   hdr->count = users.size();
+   hdr->watermark = watermark;
+   hdr->index_cap = cap;
+   hdr->data_size = data_size;
+   hdr->checksum = 0;
+   strncpy(hdr->store, store.c_str(), STORE_LEN - 1);
+
+   uint64_t* index = (uint64_t*)&buf[sizeof(header)];
+   char* data = &buf[sizeof(header) + cap * sizeof(uint64_t)];
+   uint64_t off = 0;
+   for (auto& u : users)
+   {
+      uint16_t name_len = u.first.size(), passwd_len = u.second.size();
+      memcpy(data + off, &name_len, 2);
+      memcpy(data + off + 2, &passwd_len, 2);
+      memcpy(data + off + 4, u.first.data(), name_len);
+      memcpy(data + off + 4 + name_len, u.second.data(), passwd_len);
+
+      uint64_t h = flat_table::hash(u.first.data(), u.first.size());
+      uint64_t i = h & (cap - 1);
+      while ( index[i] != 0 )
+         i = (i + 1) & (cap - 1);
+      index[i] = ((h >> 48) << 48) | (off + 1);
+
+      off += 4 + name_len + passwd_len;
+   }
+
+   uint64_t sum = checksum(buf.data(), sizeof(header), SNAPSHOT_SEED);
+   hdr->checksum = checksum(buf.data() + sizeof(header), buf.size() - sizeof(header), sum);
+
+   std::string tmp = path + ".tmp";
+   //快照中有明文密码，只允许运行服务器的用户读写，旧的临时文件权限可能更宽，打开后再设一次
+   int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if ( fd < 0 )
+      return false;
+   if ( fchmod(fd, 0600) != 0 )
+   {
+      ::close(fd);
+      unlink(tmp.c_str());
+      return false;
+   }
+
+   size_t done = 0;
+   while ( done < buf.size() )
+   {
+      ssize_t n = ::write(fd, buf.data() + done, buf.size() - done);
+      if ( n <= 0 )
+         break;
+      done += n;
+   }
+
+   bool ok = done == buf.size() && fsync(fd) == 0;
+   ::close(fd);
+   if ( !ok || rename(tmp.c_str(), path.c_str()) != 0 )
+   {
+      unlink(tmp.c_str());
+      return false;
+   }
+   return true;
+}
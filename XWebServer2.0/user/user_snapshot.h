@@ -0,0 +1,81 @@
+/*
+   用户表快照，重启时不再全表查询
+   1、文件由头部、索引、记录三部分组成，可以直接 mmap 后使用，不需要反序列化：
+      索引是开放寻址的数组，每项高 16 位是哈希标签，低 48 位是记录的偏移 + 1（0 表示空），
+      记录是 [用户名长度 u16][密码长度 u16][用户名][密码]
+   2、头部记录校验和，打开时校验整个文件，文件损坏或者和当前的存储后端不匹配时不使用
+   3、头部记录水位：存储后端中序号不超过水位的用户都在快照里，重启后只加载更新的用户
+   4、写入时先写临时文件再 rename，进程在写入过程中退出也不会留下半个快照
+   打开后只读，多个线程可以同时查找
+*/
+
+#ifndef USER_SNAPSHOT_H
+#define USER_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "user_store.h"
+
+class user_snapshot
+{
+public:
+   static const uint32_t VERSION = 1;
+   static const int STORE_LEN = 64;
+
+private:
+   struct header
+   {
+      char        magic[8];
+      uint32_t    version;
+      uint32_t    count;            //用户数
+      uint64_t    watermark;        //存储后端中已经包含在快照里的最大序号
+      uint64_t    index_cap;        //索引项数，2 的幂
+      uint64_t    data_size;        //记录区字节数
+      uint64_t    checksum;         //计算时这个字段按 0 处理
+      char        store[STORE_LEN]; //存储后端的配置，换了后端的快照不能用
+   };
+
+   char*             m_map;
+   size_t            m_len;
+   const header*     m_hdr;
+   const uint64_t*   m_index;
+   const char*       m_data;
+
+private:
+   user_snapshot(const user_snapshot&) = delete;
+   user_snapshot& operator=(const user_snapshot&) = delete;
+
+   /*按 8 字节一组计算的校验和，只用来发现文件损坏*/
+   static uint64_t   checksum(const char* data, size_t len, uint64_t seed);
+
+   /*返回索引指向的记录，越界返回 NULL*/
+   const char*       record(uint64_t entry) const;
+
+public:
+   user_snapshot();
+   ~user_snapshot();
+
+   /*映射并校验快照文件，store 是当前存储后端的配置，失败返回 false*/
+   bool              open(const std::string& path, const std::string& store);
+
+   void              close();
+
+   bool              is_open() const { return m_map != NULL; }
+
+   /*h 是 flat_table::hash 的结果，和 user_cache 共用*/
+   bool              find(const char* name, size_t len, uint64_t h, std::string* passwd) const;
+
+   /*逐个访问快照中的用户*/
+   void              visit(const user_store::user_visitor& visit) const;
+
+   size_t            size() const { return m_hdr ? m_hdr->count : 0; }
+   uint64_t          watermark() const { return m_hdr ? m_hdr->watermark : 0; }
+
+   /*把 users 写成快照，users 中不能有重复的用户名，失败返回 false*/
+   static bool       write(const std::string& path, const std::string& store, uint64_t watermark,
+                           const user_store::user_list& users);
+};
+
+#endif
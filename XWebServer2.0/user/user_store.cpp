@@ -0,0 +1,54 @@
+#include "user_store.h"
+#include "memory_store.h"
+#include "mysql_store.h"
+#include "sharded_store.h"
+#include "sqlite_store.h"
+#include "../log/log.h"
+
+void user_store::insert_batch(const user_list& users, std::vector<int>& results)
+{
+   results.resize(users.size());
+   for (size_t i = 0; i < users.size(); ++i)
+   {
+      results[i] = insert(users[i].first, users[i].second);
+   }
+}
+
+user_store* user_store::create(const std::string& spec, connection_pool* connPool, int close_log,
+                               const db_params* params)
+{
+   int m_close_log = close_log;
+
+   if ( spec == "mysql" )
+      return new mysql_user_store(connPool, close_log, db_router::get_instance(), "",
+                                  params ? params->lookup_window : 0);
+
+   if ( spec.compare(0, 6, "shard:") == 0 && params != NULL )
+   {
+      sharded_user_store* store = new sharded_user_store(close_log);
+      if ( store->open(spec.substr(6), *params) )
+         return store;
+      delete store;
+      return NULL;
+   }
+
+   if ( spec == "memory" )
+      return new memory_user_store;
+
+   if ( spec == "sqlite" || spec.compare(0, 7, "sqlite:") == 0 )
+   {
+#ifdef USE_SQLITE
+      std::string path = spec.size() > 7 ? spec.substr(7) : "users.db";
+      sqlite_user_store* store = new sqlite_user_store(close_log);
+      if ( store->open(path) )
+         return store;
+      delete store;
+#else
+      LOG_ERROR("%s", "sqlite user store is not compiled in, build with SQLITE=1");
+#endif
+      return NULL;
+   }
+
+   LOG_ERROR("unknown user store: %s", spec.c_str());
+   return NULL;
+}
@@ -0,0 +1,88 @@
+/*
+   用户数据的存储后端
+   1、登录和注册只通过这个接口读写用户数据，不直接依赖某一种数据库
+   2、目前有四种实现，启动时按配置选择：
+      mysql          MySQL，连接来自连接池，使用预处理语句
+      shard:地址列表 按用户名一致性哈希分布到多个 MySQL 实例，见 sharded_store.h
+      sqlite[:路径]  嵌入式的 SQLite，默认文件为 users.db，不需要单独的数据库服务
+      memory         只在内存中保存，重启后丢失，用于压测和对比不同后端
+   3、实现必须是线程安全的，工作线程和注册写入线程会同时调用
+*/
+
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+
+class connection_pool;
+
+/*MySQL 类的后端使用的数据库参数，shard 后端按它给每个实例建立连接池*/
+struct db_params
+{
+   std::string    user;
+   std::string    passwd;
+   std::string    db_name;
+   int            max_conn;
+   int            min_conn;
+   int            lookup_window;    //登录查询合并的时间窗口（微秒），0 表示不合并
+};
+
+class user_store
+{
+public:
+   typedef std::vector<std::pair<std::string, std::string>> user_list;
+   typedef std::function<void(const std::string&, const std::string&)> user_visitor;
+
+public:
+   virtual ~user_store() {}
+
+   virtual const char*  name() const = 0;
+
+   /*逐个访问全部用户，返回用户数，失败返回 -1*/
+   virtual int          load(const user_visitor& visit) = 0;
+
+   /*
+      增量加载：只访问序号大于 since 的用户，watermark 返回访问到的最大序号（没有新用户时不变）
+      序号随写入单调增加，MySQL 使用自增列 id，SQLite 使用 rowid
+      不支持时返回 -1（内存后端重启后没有数据，快照对它没有意义）
+   */
+   virtual int          load_since(uint64_t /*since*/, const user_visitor& /*visit*/, uint64_t& /*watermark*/)
+                        {
+                           return -1;
+                        }
+
+   /*用户名是否存在，返回 1 存在，0 不存在，-1 出错*/
+   virtual int          exists(const std::string& name) = 0;
+
+   /*查询密码，返回值同上*/
+   virtual int          lookup(const std::string& name, std::string& passwd) = 0;
+
+   /*写入新用户，返回 0 成功，1 用户名重复，-1 出错*/
+   virtual int          insert(const std::string& name, const std::string& passwd) = 0;
+
+   /*
+      用户名是否有唯一约束，返回 1 有，0 没有，-1 出错
+      没有唯一约束时 insert 不会返回 1，注册不能跳过到数据库确认重名这一步
+   */
+   virtual int          unique_names() { return 1; }
+
+   /*
+      批量写入，results 中是每个用户各自的结果，取值同 insert
+      默认逐条调用 insert，支持事务的后端在一个事务中提交
+   */
+   virtual void         insert_batch(const user_list& users, std::vector<int>& results);
+
+   /*
+      按配置创建后端，配置不认识或者打开失败返回 NULL，
+      mysql 后端需要先初始化 connPool，shard 后端按 params 给每个实例建立连接池，
+      params 为空时 mysql 后端不合并查询，shard 后端不可用
+   */
+   static user_store*   create(const std::string& spec, connection_pool* connPool, int close_log,
+                               const db_params* params = NULL);
+};
+
+#endif
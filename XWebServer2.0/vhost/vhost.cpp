@@ -0,0 +1,92 @@
+#include "vhost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+vhost_table::vhost_table()
+{
+   m_default.max_content_length = 0;
+}
+
+vhost_table* vhost_table::get_instance()
+{
+   static vhost_table table;
+   return &table;
+}
+
+void vhost_table::set_default(const char* root, long max_content_length)
+{
+   m_default.name = "";
+   m_default.root = root;
+   m_default.max_content_length = max_content_length;
+}
+
+bool vhost_table::normalize(const char* host, char* out)
+{
+   int len = 0;
+
+   /*IPv6 字面量形如 [::1]:80，端口在右括号之后*/
+   bool bracket = (host[0] == '[');
+   for (const char* p = host; *p != '\0'; ++p)
+   {
+      if ( *p == ':' && !bracket )
+         break;
+      if ( *p == ']' )
+         bracket = false;
+      if ( isspace((unsigned char)*p) )
+         break;
+      if ( len >= HOST_LEN - 1 )
+         return false;
+      out[len++] = tolower((unsigned char)*p);
+   }
+
+   if ( len > 0 && out[len - 1] == '.' )
+      --len;
+   out[len] = '\0';
+   return len > 0;
+}
+
+bool vhost_table::load(const char* file_name)
+{
+   FILE* fp = fopen(file_name, "r");
+   if ( fp == NULL )
+      return false;
+
+   char line[1024];
+   while ( fgets(line, sizeof(line), fp) )
+   {
+      char name[HOST_LEN], root[512], key[HOST_LEN];
+      long max_content_length = m_default.max_content_length;
+
+      if ( line[0] == '#' )
+         continue;
+
+      int n = sscanf(line, "%255s %511s %ld", name, root, &max_content_length);
+      if ( n < 2 )
+         continue;
+
+      if ( !normalize(name, key) )
+         continue;
+
+      vhost host;
+      host.name = key;
+      host.root = root;
+      host.max_content_length = max_content_length;
+      m_hosts[host.name] = host;
+   }
+
+   fclose(fp);
+   return true;
+}
+
+const vhost* vhost_table::find(const char* host) const
+{
+   char name[HOST_LEN];
+   if ( host == NULL || m_hosts.empty() || !normalize(host, name) )
+      return &m_default;
+
+   auto it = m_hosts.find(name);
+   return it == m_hosts.end() ? &m_default : &it->second;
+}
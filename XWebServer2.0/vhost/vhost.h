@@ -0,0 +1,55 @@
+/*
+   虚拟主机（全局只允许一个实例）
+   1、根据请求的 Host 头选择网站根目录和请求限制，Host 统一转成小写并去掉端口
+   2、启动时从配置文件加载，之后只读，工作线程查找不需要加锁
+   配置文件每行一个虚拟主机，# 开头为注释：
+      主机名  网站根目录  [请求体最大字节数]
+*/
+
+#ifndef VHOST_H
+#define VHOST_H
+
+#include <string>
+#include <unordered_map>
+
+struct vhost
+{
+   std::string    name;                   //主机名
+   std::string    root;                   //网站根目录
+   long           max_content_length;     //请求体最大长度
+};
+
+class vhost_table
+{
+public:
+   static const int HOST_LEN = 256;
+
+private:
+   std::unordered_map<std::string, vhost> 
+                  m_hosts;                //主机名 -> 虚拟主机
+   vhost          m_default;              //没有匹配时使用
+
+private:
+   vhost_table();
+   ~vhost_table() {}
+
+   /*转成小写、去掉端口和末尾的点，失败返回 false*/
+   static bool    normalize(const char* host, char* out);
+
+public:
+   static vhost_table* 
+                  get_instance();
+
+   /*设置默认虚拟主机*/
+   void           set_default(const char* root, long max_content_length);
+
+   /*加载配置文件，失败返回 false*/
+   bool           load(const char* file_name);
+
+   /*host 为 NULL 或者没有匹配时返回默认虚拟主机*/
+   const vhost*   find(const char* host) const;
+
+   size_t         size() const { return m_hosts.size(); }
+};
+
+#endif